@@ -6,6 +6,16 @@ CONFIG += c++14
 SOURCES += \
     src/Main.cpp \
     src/miniplayer/MiniPlayer.cpp \
+    src/miniplayer/Metrics.cpp \
+    src/miniplayer/Executor.cpp \
+    src/miniplayer/PipelineStage.cpp \
+    src/miniplayer/InputPrefetcher.cpp \
+    src/miniplayer/StreamInfoCache.cpp \
+    src/miniplayer/BufferPolicy.cpp \
+    src/miniplayer/TimeStretch.cpp \
+    src/miniplayer/ReadAheadIO.cpp \
+    src/miniplayer/TimeshiftStore.cpp \
+    src/miniplayer/PacketRecorder.cpp \
     src/miniplayer/output/audio/AudioOutputOpenAL.cpp \
     src/miniplayer/qt/QmlMiniPlayer.cpp \
     src/miniplayer/qt/QmlVideoSurface.cpp \
@@ -48,7 +58,22 @@ LIBS += \
 
 HEADERS += \
     src/miniplayer/MiniPlayer.hpp \
+    src/miniplayer/Metrics.hpp \
+    src/miniplayer/Executor.hpp \
+    src/miniplayer/PipelineStage.hpp \
+    src/miniplayer/InputPrefetcher.hpp \
+    src/miniplayer/StreamInfoCache.hpp \
+    src/miniplayer/BufferPolicy.hpp \
+    src/miniplayer/TimeStretch.hpp \
+    src/miniplayer/ReadAheadIO.hpp \
+    src/miniplayer/TimeshiftStore.hpp \
+    src/miniplayer/PacketRecorder.hpp \
+    src/miniplayer/KeyframeIndex.hpp \
     src/miniplayer/Queue.hpp \
+    src/miniplayer/FramePool.hpp \
+    src/miniplayer/RingBuffer.hpp \
+    src/miniplayer/TimeBase.hpp \
+    src/miniplayer/WaitEvent.hpp \
     src/miniplayer/Command.hpp \
     src/miniplayer/output/audio/AudioOutput.hpp \
     src/miniplayer/output/audio/AudioOutputOpenAL.hpp \
@@ -0,0 +1,489 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include <QDebug>
+
+#include "miniplayer/MiniPlayer.hpp"
+#include "miniplayer/output/audio/AudioOutputNull.hpp"
+#include "miniplayer/ReadAheadIO.hpp"
+#include "ThrottledHttpServer.hpp"
+
+using namespace miniplayer;
+
+/*
+ * Headless throughput benchmark: plays a file through the whole pipeline with a null
+ * audio output and a video callback that drops every frame. In free-run mode (the
+ * default) the render threads do not pace to the clocks, so the numbers reflect how
+ * fast the demuxer and decoders can go.
+ */
+
+class NullCallback : public MiniPlayer::Callback
+{
+public:
+    NullCallback() :
+        mOpened(false),
+        mFinished(false)
+    {}
+
+    void setFramePool(const std::shared_ptr<AVFramePool> & pool)
+    {
+        mFramePool = pool;
+    }
+
+    void onVideoRender(AVFrame * frame)
+    {
+        mFramePool->release(&frame);
+    }
+
+    void onPositionChanged(double) {}
+    void onBufferingChanged(bool) {}
+
+    void onStateChanged(int state)
+    {
+        std::lock_guard<std::mutex> l(mMutex);
+        if(state == MiniPlayer::Playing)
+        {
+            mOpened = true;
+            mStartTime = std::chrono::steady_clock::now();
+        }
+        else if(state == MiniPlayer::Stopped)
+        {
+            mEndTime = std::chrono::steady_clock::now();
+            mFinished = true;
+            mCond.notify_all();
+        }
+    }
+
+    //returns false on timeout
+    bool waitFinished(int timeoutSec)
+    {
+        std::unique_lock<std::mutex> l(mMutex);
+        auto finished = [this] { return mFinished; };
+        if(timeoutSec <= 0)
+        {
+            mCond.wait(l, finished);
+            return true;
+        }
+        return mCond.wait_for(l, std::chrono::seconds(timeoutSec), finished);
+    }
+
+    bool isOpened()
+    {
+        std::lock_guard<std::mutex> l(mMutex);
+        return mOpened;
+    }
+
+    double elapsed()
+    {
+        std::lock_guard<std::mutex> l(mMutex);
+        auto end = mFinished ? mEndTime : std::chrono::steady_clock::now();
+        return std::chrono::duration<double>(end - mStartTime).count();
+    }
+
+private:
+    std::shared_ptr<AVFramePool> mFramePool;
+    std::mutex mMutex;
+    std::condition_variable mCond;
+    bool mOpened;
+    bool mFinished;
+    std::chrono::steady_clock::time_point mStartTime;
+    std::chrono::steady_clock::time_point mEndTime;
+};
+
+static bool verbose = false;
+
+//fetch check: bytes read per avio_read(), seeks done after the sequential pass
+static const int FetchCheckBlock = 64 * 1024;
+static const int FetchCheckSeeks = 16;
+static const int DefaultFetchReadAheadMb = 16;
+
+static bool readExpected(AVIOContext * context, const std::vector<uint8_t> & expected, int64_t pos, int64_t size)
+{
+    std::vector<uint8_t> buffer(static_cast<size_t>(size));
+    int64_t got = 0;
+    while(got < size)
+    {
+        int ret = avio_read(context, buffer.data() + got, static_cast<int>(size - got));
+        if(ret <= 0)
+            break;
+        got += ret;
+    }
+    return got == size && memcmp(buffer.data(), expected.data() + pos, static_cast<size_t>(size)) == 0;
+}
+
+/*
+ * Reads url (the stand-in server's copy of path) through ReadAheadIO from start to end and
+ * compares every byte with the file, then seeks to pseudo-random offsets (inside and outside
+ * the ring, so claimed ranges are dropped and claimed again) and compares what follows.
+ */
+static bool fetchCheck(const std::string & url, const std::string & path, int64_t capacity, int connections)
+{
+    std::vector<uint8_t> expected;
+    FILE * file = fopen(path.c_str(), "rb");
+    if(!file)
+        return false;
+    uint8_t block[FetchCheckBlock];
+    size_t count;
+    while((count = fread(block, 1, sizeof(block), file)) > 0)
+        expected.insert(expected.end(), block, block + count);
+    fclose(file);
+    int64_t size = static_cast<int64_t>(expected.size());
+
+    ReadAheadIO io(capacity, connections);
+    AVIOInterruptCB interrupt = { nullptr, nullptr };
+    auto start = std::chrono::steady_clock::now();
+    if(!io.open(url, interrupt))
+    {
+        fprintf(stderr, "fetch check: failed to open %s\n", url.c_str());
+        return false;
+    }
+    AVIOContext * context = io.context();
+
+    bool same = true;
+    int64_t pos = 0;
+    std::vector<uint8_t> buffer(FetchCheckBlock);
+    for(;;)
+    {
+        int ret = avio_read(context, buffer.data(), FetchCheckBlock);
+        if(ret <= 0)
+            break;
+        if(pos + ret > size || memcmp(buffer.data(), expected.data() + pos, static_cast<size_t>(ret)) != 0)
+            same = false;
+        pos += ret;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    bool complete = pos == size;
+
+    int seeksFailed = 0;
+    uint64_t seed = 1;
+    for(int i = 0; i < FetchCheckSeeks && size > 0; i++)
+    {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        int64_t offset = static_cast<int64_t>((seed >> 33) % static_cast<uint64_t>(size));
+        int64_t length = std::min<int64_t>(FetchCheckBlock, size - offset);
+        if(avio_seek(context, offset, SEEK_SET) != offset || !readExpected(context, expected, offset, length))
+            seeksFailed ++;
+    }
+
+    ReadAheadIO::Info info;
+    io.dump(info);
+    printf("fetch                 %d connections: %lld/%lld bytes in %.2f s (%.1f KiB/s), %s, %d/%d seeks failed, "
+           "%lld bytes from the input\n", info.connections, (long long)pos, (long long)size, seconds,
+           pos / 1024.0 / (seconds > 0 ? seconds : 1e-9), !complete ? "incomplete" : (same ? "identical" : "MISMATCH"),
+           seeksFailed, FetchCheckSeeks, (long long)info.bytesRead);
+    return complete && same && seeksFailed == 0;
+}
+
+static void onMessage(QtMsgType type, const QMessageLogContext &, const QString & msg)
+{
+    if(type == QtDebugMsg && !verbose)
+        return;
+    fprintf(stderr, "%s\n", qPrintable(msg));
+}
+
+static int64_t peakRss()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if(!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+    return static_cast<int64_t>(counters.PeakWorkingSetSize);
+#else
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return static_cast<int64_t>(usage.ru_maxrss);
+#else
+    return static_cast<int64_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+static void usage(const char * name)
+{
+    fprintf(stderr,
+            "usage: %s [options] <input> [<input>...]\n"
+            "  --realtime          pace to the clocks like normal playback\n"
+            "  --executor <n>      run the decode/render stages on a pool of n threads\n"
+            "  --threads <n>       video decoder threads (default: one per core)\n"
+            "  --thread-type <t>   auto, frame or slice\n"
+            "  --fast-open         cap probing and skip it for inputs in the stream info cache\n"
+            "  --stream-cache <f>  stream info cache file used by --fast-open\n"
+            "  --read-ahead <mb>   read the input through a ring of mb MiB filled by an I/O thread\n"
+            "  --connections <n>   with --read-ahead, fetch seekable inputs as n parallel byte ranges\n"
+            "  --serve <kib>       serve the input over local HTTP capped at kib KiB/s per connection and play that\n"
+            "  --fetch-check       with --serve, only fetch the input through the read-ahead with 1 and\n"
+            "                      --connections connections, compare it with the file and report throughput\n"
+            "  --timeshift <f>     record live inputs into ring file f and play them back from it\n"
+            "  --timeshift-mb <mb> disk budget of the timeshift ring (default 512)\n"
+            "  --record <f>        remux the input into f while it plays\n"
+            "  --loop              play the inputs after the first one as a looping playlist\n"
+            "  --rate <r>          playback rate 0.5..2, audio goes through the time stretcher\n"
+            "  --latency <s>       live inputs: catch up when more than s seconds behind\n"
+            "  --trick <speed>     keyframe-only trick play at speed (2..32, negative rewinds)\n"
+            "  --timeout <sec>     stop after sec seconds (default: play to the end)\n"
+            "  --metrics <file>    append the per-stage latency table to file\n"
+            "  --verbose           print player debug output\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    std::string input;
+    std::vector<std::string> playlist;
+    bool playlistLoop = false;
+    std::string metricsPath;
+    bool realtime = false;
+    bool fastOpen = false;
+    int readAheadMb = 0;
+    int connections = 1;
+    int serveKib = 0;
+    bool fetchOnly = false;
+    std::string timeshiftPath;
+    int timeshiftMb = 512;
+    std::string recordPath;
+    std::string streamCachePath;
+    int timeout = 0;
+    int trickSpeed = 0;
+    double playbackRate = 1;
+    double liveLatency = 0;
+    int executorThreads = 0;
+    int decoderThreads = 0;
+    int decoderThreadType = MiniPlayer::DecoderThreadAuto;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(!strcmp(argv[i], "--realtime"))
+            realtime = true;
+        else if(!strcmp(argv[i], "--executor") && i + 1 < argc)
+            executorThreads = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--threads") && i + 1 < argc)
+            decoderThreads = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--thread-type") && i + 1 < argc)
+        {
+            const char * type = argv[++i];
+            decoderThreadType = !strcmp(type, "frame") ? MiniPlayer::DecoderThreadFrame :
+                                !strcmp(type, "slice") ? MiniPlayer::DecoderThreadSlice : MiniPlayer::DecoderThreadAuto;
+        }
+        else if(!strcmp(argv[i], "--fast-open"))
+            fastOpen = true;
+        else if(!strcmp(argv[i], "--stream-cache") && i + 1 < argc)
+            streamCachePath = argv[++i];
+        else if(!strcmp(argv[i], "--read-ahead") && i + 1 < argc)
+            readAheadMb = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--connections") && i + 1 < argc)
+            connections = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--serve") && i + 1 < argc)
+            serveKib = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--fetch-check"))
+            fetchOnly = true;
+        else if(!strcmp(argv[i], "--timeshift") && i + 1 < argc)
+            timeshiftPath = argv[++i];
+        else if(!strcmp(argv[i], "--timeshift-mb") && i + 1 < argc)
+            timeshiftMb = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--record") && i + 1 < argc)
+            recordPath = argv[++i];
+        else if(!strcmp(argv[i], "--loop"))
+            playlistLoop = true;
+        else if(!strcmp(argv[i], "--rate") && i + 1 < argc)
+            playbackRate = atof(argv[++i]);
+        else if(!strcmp(argv[i], "--latency") && i + 1 < argc)
+            liveLatency = atof(argv[++i]);
+        else if(!strcmp(argv[i], "--trick") && i + 1 < argc)
+            trickSpeed = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--timeout") && i + 1 < argc)
+            timeout = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--metrics") && i + 1 < argc)
+            metricsPath = argv[++i];
+        else if(!strcmp(argv[i], "--verbose"))
+            verbose = true;
+        else if(argv[i][0] == '-')
+        {
+            usage(argv[0]);
+            return 2;
+        }
+        else if(input.empty())
+            input = argv[i];
+        else
+            playlist.push_back(argv[i]);
+    }
+
+    if(input.empty())
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    qInstallMessageHandler(onMessage);
+    MiniPlayer::init();
+
+    std::unique_ptr<ThrottledHttpServer> server;
+    if(serveKib > 0)
+    {
+        server.reset(new ThrottledHttpServer(input, static_cast<int64_t>(serveKib) * 1024));
+        if(!server->start())
+        {
+            fprintf(stderr, "failed to serve %s\n", input.c_str());
+            return 1;
+        }
+    }
+
+    if(fetchOnly)
+    {
+        if(!server)
+        {
+            usage(argv[0]);
+            return 2;
+        }
+        int64_t capacity = static_cast<int64_t>(readAheadMb > 0 ? readAheadMb : DefaultFetchReadAheadMb) * 1024 * 1024;
+        printf("input                 %s (%s, %d KiB/s per connection)\n", input.c_str(), server->url().c_str(), serveKib);
+        bool ok = fetchCheck(server->url(), input, capacity, 1);
+        if(connections > 1)
+            ok = fetchCheck(server->url(), input, capacity, connections) && ok;
+        ThrottledHttpServer::Info serverInfo;
+        server->dump(serverInfo);
+        printf("server                %lld connections, %lld range requests, %lld bytes sent\n",
+               (long long)serverInfo.connections, (long long)serverInfo.rangeRequests, (long long)serverInfo.bytesSent);
+        server.reset();
+        MiniPlayer::uninit();
+        return ok ? 0 : 1;
+    }
+    std::string source = server ? server->url() : input;
+
+    std::unique_ptr<Executor> executor;
+    if(executorThreads > 0)
+        executor.reset(new Executor(executorThreads));
+
+    NullCallback callback;
+    AudioOutputNull audioOutput;
+    MiniPlayer * player = new MiniPlayer(&callback, &audioOutput);
+    callback.setFramePool(player->getVideoFramePool());
+    player->setMetricsEnabled(true);
+    player->setFreeRun(!realtime);
+    player->setExecutor(executor.get());
+    player->setDecoderThreads(decoderThreads);
+    player->setDecoderThreadType(decoderThreadType);
+    player->setFastOpen(fastOpen);
+    player->setReadAheadSize(static_cast<int64_t>(readAheadMb) * 1024 * 1024);
+    player->setReadAheadConnections(connections);
+    player->setTimeshift(timeshiftPath, static_cast<int64_t>(timeshiftMb) * 1024 * 1024);
+    if(!streamCachePath.empty())
+        StreamInfoCache::shared()->setPath(streamCachePath);
+    player->setTrickSpeed(trickSpeed);
+    player->setPlaybackRate(playbackRate);
+    player->setLiveLatency(liveLatency);
+    if(!recordPath.empty())
+        player->startRecording(recordPath);
+    player->setPlaylistLoop(playlistLoop);
+    player->setPlaylist(playlist);
+    player->open(source);
+
+    bool timedOut = !callback.waitFinished(timeout);
+    double elapsed = callback.elapsed();
+    bool opened = callback.isOpened();
+    bool endReached = player->isEndReached();
+
+    if(timedOut)
+        player->stop();
+
+    MiniPlayer::DumpInfo info;
+    player->dump(info);
+    if(!metricsPath.empty())
+        player->dumpMetrics(metricsPath);
+    delete player;
+    server.reset();
+    MiniPlayer::uninit();
+
+    if(!opened)
+    {
+        fprintf(stderr, "failed to open %s\n", input.c_str());
+        return 1;
+    }
+
+    const auto & metrics = info.metrics;
+    double seconds = elapsed > 0 ? elapsed : 1e-9;
+    auto rate = [&](PipelineMetrics::Counter counter) { return metrics.counters[counter] / seconds; };
+
+    printf("input                 %s\n", source.c_str());
+    printf("mode                  %s\n", realtime ? "realtime" : "free-run");
+    printf("trickSpeed            %d\n", trickSpeed);
+    printf("playbackRate          %.2f\n", playbackRate);
+    printf("executorThreads       %d\n", executorThreads);
+    printf("decoderThreads        %d (type %d)\n", info.videoDecoderThreads, info.videoDecoderThreadType);
+    printf("streamInfoCached      %s\n", info.streamInfoCached ? "yes" : "no");
+    for(int i = 0; i < PipelineMetrics::StartupPhaseCount; i++)
+        printf("%-22s%.1f\n", (std::string(PipelineMetrics::startupPhaseName(i)) + "(ms)").c_str(), metrics.startup[i]);
+    printf("completed             %s\n", timedOut ? "timeout" : (endReached ? "eof" : "error"));
+    printf("wallTime(s)           %.3f\n", elapsed);
+    printf("videoFrames           %llu (%.1f/s)\n", (unsigned long long)metrics.counters[PipelineMetrics::VideoFramesRendered],
+           rate(PipelineMetrics::VideoFramesRendered));
+    printf("audioFrames           %llu (%.1f/s)\n", (unsigned long long)metrics.counters[PipelineMetrics::AudioFramesRendered],
+           rate(PipelineMetrics::AudioFramesRendered));
+    printf("droppedFrames         %llu\n", (unsigned long long)(metrics.counters[PipelineMetrics::VideoFramesDropped] +
+                                                               metrics.counters[PipelineMetrics::AudioFramesDropped]));
+    printf("packets               %llu (%.1f/s)\n", (unsigned long long)metrics.counters[PipelineMetrics::PacketsRead],
+           rate(PipelineMetrics::PacketsRead));
+    printf("bytes                 %llu (%.1f/s)\n", (unsigned long long)metrics.counters[PipelineMetrics::BytesRead],
+           rate(PipelineMetrics::BytesRead));
+    printf("videoDecoderFps       %.1f\n", metrics.videoDecoderThroughput);
+    printf("audioDecoderFps       %.1f\n", metrics.audioDecoderThroughput);
+    const auto & stretch = metrics.stages[PipelineMetrics::AudioStretch];
+    printf("audioStretch(ms)      %.3f mean, %.3f p99 over %llu frames\n", stretch.mean, stretch.p99,
+           (unsigned long long)stretch.count);
+    printf("startBuffer(s)        %.2f\n", info.startBufferDuration);
+    printf("maxPacketBuffer       %lld\n", (long long)info.maxPacketBufferSize);
+    printf("rebuffers             %d\n", info.rebufferCount);
+    printf("liveLatency(s)        %.2f (target %.2f)\n", info.liveLatency, info.liveLatencyTarget);
+    printf("catchUp               %llu speed-ups, %llu jumps\n", (unsigned long long)info.catchUpSpeedUps,
+           (unsigned long long)info.catchUpJumps);
+    if(info.readAhead.capacity > 0)
+    {
+        printf("readAhead             %lld/%lld bytes, %lld stalls (%.1f ms), %lld window/%lld input seeks\n",
+               (long long)info.readAhead.fill, (long long)info.readAhead.capacity, (long long)info.readAhead.stalls,
+               info.readAhead.stallTime, (long long)info.readAhead.windowSeeks, (long long)info.readAhead.inputSeeks);
+        printf("readAheadInput        %lld bytes over %d connections (%.1f/s)\n", (long long)info.readAhead.bytesRead,
+               info.readAhead.connections, info.readAhead.bytesRead / seconds);
+    }
+    if(info.timeshift.budget > 0)
+        printf("timeshift             %lld/%lld bytes, window %.1f-%.1f s, %lld written, %lld read, %lld overruns\n",
+               (long long)info.timeshift.used, (long long)info.timeshift.budget, info.timeshift.windowStart,
+               info.timeshift.windowEnd, (long long)info.timeshift.packetsWritten, (long long)info.timeshift.packetsRead,
+               (long long)info.timeshift.overruns);
+    if(!recordPath.empty())
+        printf("recording             %.1f s, %lld packets (%lld bytes) written, %lld dropped\n",
+               info.recording.duration, (long long)info.recording.packetsWritten,
+               (long long)info.recording.bytesWritten, (long long)info.recording.packetsDropped);
+    if(!playlist.empty())
+        printf("playlist              %zu items after the first, %llu switches, last gap %.1f ms\n",
+               playlist.size(), (unsigned long long)info.itemSwitches, info.itemSwitchGap);
+    printf("packetShells          %lld\n", (long long)info.packetShellsAllocated);
+    printf("videoFramePool        %lld allocated, %lld in use\n", (long long)info.videoFramePool.allocated,
+           (long long)info.videoFramePool.inUse);
+    printf("audioFramePool        %lld allocated, %lld in use\n", (long long)info.audioFramePool.allocated,
+           (long long)info.audioFramePool.inUse);
+    printf("peakRss(KiB)          %lld\n", (long long)(peakRss() / 1024));
+    double totalCpu = 0;
+    for(int i = 0; i < PipelineMetrics::ThreadCount; i++)
+    {
+        totalCpu += metrics.threadCpuTime[i];
+        printf("%-22s%.1f (%.1f%%)\n", (std::string(PipelineMetrics::threadName(i)) + "Cpu(ms)").c_str(),
+               metrics.threadCpuTime[i], metrics.threadCpuTime[i] / 10 / seconds);
+    }
+    printf("pipelineCpu(ms)       %.1f (%.1f%%)\n", totalCpu, totalCpu / 10 / seconds);
+
+    return timedOut || endReached ? 0 : 1;
+}
@@ -0,0 +1,69 @@
+# Headless pipeline benchmark, runs without an audio device or a display:
+#   qmake bench/MiniPlayerBench.pro && make
+#   MiniPlayerBench [--realtime] [--timeout sec] [--metrics file] <input>
+# parallel range fetching against a local server throttled to 512 KiB/s per connection:
+#   MiniPlayerBench --serve 512 --connections 4 --fetch-check <input>
+
+TEMPLATE = app
+TARGET = MiniPlayerBench
+
+QT = core
+CONFIG += c++14 console
+CONFIG -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+SOURCES += \
+    Main.cpp \
+    ThrottledHttpServer.cpp \
+    ../src/miniplayer/MiniPlayer.cpp \
+    ../src/miniplayer/Metrics.cpp \
+    ../src/miniplayer/Executor.cpp \
+    ../src/miniplayer/PipelineStage.cpp \
+    ../src/miniplayer/InputPrefetcher.cpp \
+    ../src/miniplayer/StreamInfoCache.cpp \
+    ../src/miniplayer/BufferPolicy.cpp \
+    ../src/miniplayer/TimeStretch.cpp \
+    ../src/miniplayer/ReadAheadIO.cpp \
+    ../src/miniplayer/TimeshiftStore.cpp \
+    ../src/miniplayer/PacketRecorder.cpp \
+    ../src/miniplayer/output/audio/AudioOutputNull.cpp
+
+HEADERS += \
+    ThrottledHttpServer.hpp \
+    ../src/miniplayer/MiniPlayer.hpp \
+    ../src/miniplayer/Metrics.hpp \
+    ../src/miniplayer/Executor.hpp \
+    ../src/miniplayer/PipelineStage.hpp \
+    ../src/miniplayer/InputPrefetcher.hpp \
+    ../src/miniplayer/StreamInfoCache.hpp \
+    ../src/miniplayer/BufferPolicy.hpp \
+    ../src/miniplayer/TimeStretch.hpp \
+    ../src/miniplayer/ReadAheadIO.hpp \
+    ../src/miniplayer/TimeshiftStore.hpp \
+    ../src/miniplayer/PacketRecorder.hpp \
+    ../src/miniplayer/KeyframeIndex.hpp \
+    ../src/miniplayer/Queue.hpp \
+    ../src/miniplayer/FramePool.hpp \
+    ../src/miniplayer/RingBuffer.hpp \
+    ../src/miniplayer/TimeBase.hpp \
+    ../src/miniplayer/WaitEvent.hpp \
+    ../src/miniplayer/Command.hpp \
+    ../src/miniplayer/output/audio/AudioOutput.hpp \
+    ../src/miniplayer/output/audio/AudioOutputNull.hpp
+
+INCLUDEPATH += \
+    ../src \
+    ../3rdparty/ffmpeg-3.2.2/include
+
+win32 {
+    LIBS += \
+        $$PWD/../3rdparty/ffmpeg-3.2.2/lib/avformat.lib \
+        $$PWD/../3rdparty/ffmpeg-3.2.2/lib/avcodec.lib \
+        $$PWD/../3rdparty/ffmpeg-3.2.2/lib/avutil.lib \
+        $$PWD/../3rdparty/ffmpeg-3.2.2/lib/swresample.lib \
+        -lpsapi \
+        -lws2_32
+} else {
+    LIBS += -lavformat -lavcodec -lavutil -lswresample
+}
@@ -0,0 +1,289 @@
+#include "ThrottledHttpServer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <QDebug>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef int socklen_t;
+#define closeSocket closesocket
+#define SHUTDOWN_BOTH SD_BOTH
+#define fseek64 _fseeki64
+#define ftell64 _ftelli64
+#else
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#define closeSocket ::close
+#define SHUTDOWN_BOTH SHUT_RDWR
+#define fseek64 fseeko
+#define ftell64 ftello
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+//bytes per send(), the rate cap is applied between them
+static const int64_t SendChunkSize = 16 * 1024;
+static const int MaxRequestSize = 8 * 1024;
+//ms the accept loop waits before looking at the stop flag again
+static const int AcceptPollInterval = 100;
+
+static int64_t nowUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+ThrottledHttpServer::ThrottledHttpServer(const std::string & path, int64_t bytesPerSecond) :
+    mPath(path),
+    mFileSize(-1),
+    mBytesPerSecond(bytesPerSecond),
+    mListen(-1),
+    mPort(0),
+    mStop(false),
+    mConnections(0),
+    mRangeRequests(0),
+    mBytesSent(0)
+{
+}
+
+ThrottledHttpServer::~ThrottledHttpServer()
+{
+    stop();
+}
+
+bool ThrottledHttpServer::start()
+{
+    FILE * file = fopen(mPath.c_str(), "rb");
+    if(!file)
+    {
+        qWarning() << __FUNCTION__ << "fopen" << "failure" << mPath.c_str();
+        return false;
+    }
+    fseek64(file, 0, SEEK_END);
+    mFileSize = ftell64(file);
+    fclose(file);
+
+#ifdef _WIN32
+    WSADATA wsaData;
+    WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+    mListen = static_cast<Socket>(socket(AF_INET, SOCK_STREAM, 0));
+    if(mListen < 0)
+    {
+        qWarning() << __FUNCTION__ << "socket" << "failure";
+        return false;
+    }
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t length = sizeof(addr);
+    if(bind(mListen, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+       listen(mListen, 16) != 0 ||
+       getsockname(mListen, reinterpret_cast<sockaddr *>(&addr), &length) != 0)
+    {
+        qWarning() << __FUNCTION__ << "bind/listen" << "failure";
+        closeSocket(mListen);
+        mListen = -1;
+        return false;
+    }
+    mPort = ntohs(addr.sin_port);
+    mStop = false;
+    mAcceptThread = std::thread(&ThrottledHttpServer::acceptThread, this);
+    qDebug() << __FUNCTION__ << url().c_str() << "size:" << mFileSize << "rate:" << mBytesPerSecond;
+    return true;
+}
+
+void ThrottledHttpServer::stop()
+{
+    if(mListen < 0)
+        return;
+    mStop = true;
+    if(mAcceptThread.joinable())
+        mAcceptThread.join();
+    closeSocket(mListen);
+    mListen = -1;
+
+    std::vector<std::thread> threads;
+    {
+        std::lock_guard<std::mutex> l(mMutex);
+        //wakes clients blocked in recv()/send()
+        for(Socket client : mClients)
+            shutdown(client, SHUTDOWN_BOTH);
+        threads.swap(mClientThreads);
+        mFinished.clear();
+    }
+    for(auto & thread : threads)
+        thread.join();
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+std::string ThrottledHttpServer::url() const
+{
+    //the extension lets the demuxer probe as it would for the file
+    const char * name = strrchr(mPath.c_str(), '/');
+    return "http://127.0.0.1:" + std::to_string(mPort) + "/" + (name ? name + 1 : mPath.c_str());
+}
+
+void ThrottledHttpServer::acceptThread()
+{
+    while(!mStop)
+    {
+        fd_set set;
+        FD_ZERO(&set);
+        FD_SET(mListen, &set);
+        timeval timeout = { 0, AcceptPollInterval * 1000 };
+        reapClients();
+        if(select(static_cast<int>(mListen) + 1, &set, nullptr, nullptr, &timeout) <= 0)
+            continue;
+        Socket client = static_cast<Socket>(accept(mListen, nullptr, nullptr));
+        if(client < 0)
+            continue;
+        mConnections ++;
+        std::lock_guard<std::mutex> l(mMutex);
+        mClients.push_back(client);
+        mClientThreads.push_back(std::thread(&ThrottledHttpServer::serve, this, client));
+    }
+}
+
+//joins the threads of connections that closed, a long run opens one per seek
+void ThrottledHttpServer::reapClients()
+{
+    std::vector<std::thread> finished;
+    {
+        std::lock_guard<std::mutex> l(mMutex);
+        for(auto id : mFinished)
+        {
+            auto it = std::find_if(mClientThreads.begin(), mClientThreads.end(),
+                                   [&](const std::thread & thread) { return thread.get_id() == id; });
+            if(it == mClientThreads.end())
+                continue;
+            finished.push_back(std::move(*it));
+            mClientThreads.erase(it);
+        }
+        mFinished.clear();
+    }
+    for(auto & thread : finished)
+        thread.join();
+}
+
+//sends size bytes, sleeping so that the connection never runs ahead of the rate cap
+bool ThrottledHttpServer::sendAll(Socket client, const char * data, int64_t size, int64_t & sent, int64_t startTime)
+{
+    while(size > 0 && !mStop)
+    {
+        if(mBytesPerSecond > 0)
+        {
+            int64_t due = startTime + sent * 1000000 / mBytesPerSecond;
+            int64_t now = nowUs();
+            if(due > now)
+                std::this_thread::sleep_for(std::chrono::microseconds(due - now));
+        }
+        int chunk = static_cast<int>(std::min(size, SendChunkSize));
+        int ret = send(client, data, chunk, MSG_NOSIGNAL);
+        //the reader closing the connection (a seek) ends the response
+        if(ret <= 0)
+            return false;
+        data += ret;
+        size -= ret;
+        sent += ret;
+        mBytesSent += ret;
+    }
+    return size == 0;
+}
+
+void ThrottledHttpServer::serve(Socket client)
+{
+    std::string request;
+    char buffer[1024];
+    while(request.find("\r\n\r\n") == std::string::npos && static_cast<int>(request.size()) < MaxRequestSize)
+    {
+        int ret = recv(client, buffer, sizeof(buffer), 0);
+        if(ret <= 0)
+            break;
+        request.append(buffer, ret);
+    }
+
+    bool head = request.compare(0, 5, "HEAD ") == 0;
+    int64_t first = 0;
+    int64_t last = mFileSize - 1;
+    bool range = false;
+    //only the single range FFmpeg sends: bytes=first- or bytes=first-last
+    size_t rangePos = request.find("Range: bytes=");
+    if(rangePos == std::string::npos)
+        rangePos = request.find("range: bytes=");
+    if(rangePos != std::string::npos)
+    {
+        const char * spec = request.c_str() + rangePos + strlen("Range: bytes=");
+        char * end = nullptr;
+        first = strtoll(spec, &end, 10);
+        if(end && *end == '-' && end[1] >= '0' && end[1] <= '9')
+            last = std::min<int64_t>(strtoll(end + 1, nullptr, 10), mFileSize - 1);
+        range = true;
+        mRangeRequests ++;
+    }
+
+    std::string header;
+    if(request.empty() || (request.compare(0, 4, "GET ") != 0 && !head))
+        header = "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    else if(first >= mFileSize || first > last)
+        header = "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */" + std::to_string(mFileSize) +
+                 "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    else
+    {
+        header = std::string(range ? "HTTP/1.1 206 Partial Content\r\n" : "HTTP/1.1 200 OK\r\n") +
+                 "Content-Type: application/octet-stream\r\nAccept-Ranges: bytes\r\nConnection: close\r\n" +
+                 "Content-Length: " + std::to_string(last - first + 1) + "\r\n";
+        if(range)
+            header += "Content-Range: bytes " + std::to_string(first) + "-" + std::to_string(last) + "/" +
+                      std::to_string(mFileSize) + "\r\n";
+        header += "\r\n";
+    }
+
+    bool ok = send(client, header.data(), static_cast<int>(header.size()), MSG_NOSIGNAL) == static_cast<int>(header.size());
+    bool body = ok && !head && header.compare(9, 1, "2") == 0;
+    FILE * file = body ? fopen(mPath.c_str(), "rb") : nullptr;
+    if(file)
+    {
+        fseek64(file, first, SEEK_SET);
+        std::vector<char> data(static_cast<size_t>(SendChunkSize));
+        int64_t remaining = last - first + 1;
+        int64_t sent = 0;
+        int64_t startTime = nowUs();
+        while(remaining > 0)
+        {
+            size_t count = fread(data.data(), 1, static_cast<size_t>(std::min(remaining, SendChunkSize)), file);
+            if(count == 0 || !sendAll(client, data.data(), static_cast<int64_t>(count), sent, startTime))
+                break;
+            remaining -= static_cast<int64_t>(count);
+        }
+        fclose(file);
+    }
+
+    {
+        std::lock_guard<std::mutex> l(mMutex);
+        mClients.erase(std::remove(mClients.begin(), mClients.end(), client), mClients.end());
+        mFinished.push_back(std::this_thread::get_id());
+    }
+    closeSocket(client);
+}
+
+void ThrottledHttpServer::dump(Info & info) const
+{
+    info.connections = mConnections;
+    info.rangeRequests = mRangeRequests;
+    info.bytesSent = mBytesSent;
+}
@@ -0,0 +1,66 @@
+#ifndef THROTTLEDHTTPSERVER_HPP
+#define THROTTLEDHTTPSERVER_HPP
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+/*
+ * Stand-in for a VOD server: serves one file over HTTP on 127.0.0.1 with range requests
+ * and a rate cap per connection, so parallel range fetching can be measured and checked
+ * without a network. Every request gets its own connection (Connection: close), like a
+ * seek of FFmpeg's http protocol does.
+ */
+class ThrottledHttpServer
+{
+public:
+    typedef struct {
+        int64_t connections;
+        int64_t rangeRequests;  //requests with a Range header
+        int64_t bytesSent;
+    } Info;
+
+    //bytesPerSecond per connection, 0 for no cap
+    ThrottledHttpServer(const std::string & path, int64_t bytesPerSecond);
+    ~ThrottledHttpServer();
+
+    ThrottledHttpServer(const ThrottledHttpServer&) = delete;
+    ThrottledHttpServer& operator=(const ThrottledHttpServer&) = delete;
+
+    //listens on a free port of 127.0.0.1
+    bool start();
+    void stop();
+    std::string url() const;
+    void dump(Info & info) const;
+
+private:
+    typedef intptr_t Socket;
+
+    void acceptThread();
+    void reapClients();
+    void serve(Socket client);
+    bool sendAll(Socket client, const char * data, int64_t size, int64_t & sent, int64_t startTime);
+
+private:
+    std::string mPath;
+    int64_t mFileSize;
+    int64_t mBytesPerSecond;
+    Socket mListen;
+    int mPort;
+    std::atomic_bool mStop;
+    std::thread mAcceptThread;
+
+    std::mutex mMutex;
+    std::vector<std::thread> mClientThreads;
+    std::vector<Socket> mClients;   //open client sockets, shut down by stop()
+    std::vector<std::thread::id> mFinished;     //client threads done serving, joined by the accept thread
+
+    std::atomic<int64_t> mConnections;
+    std::atomic<int64_t> mRangeRequests;
+    std::atomic<int64_t> mBytesSent;
+};
+
+#endif // THROTTLEDHTTPSERVER_HPP
@@ -186,6 +186,11 @@ Window {
                     ctlPlayer.position = ctlProgress.value;
                 }
             }
+            onValueChanged: {
+                if(ctlProgress.pressed) {
+                    ctlPlayer.scrub(ctlProgress.value);
+                }
+            }
         }
 
         Text {
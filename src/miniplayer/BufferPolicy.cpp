@@ -0,0 +1,92 @@
+#include "BufferPolicy.hpp"
+#include <algorithm>
+
+extern "C"
+{
+#include <libavutil/time.h>
+}
+
+using namespace miniplayer;
+
+static const double MinStart = 0.5;             //s
+static const double MaxStart = 10;              //s
+static const double DefaultStart = 2;           //s, until the headroom is known
+static const double LiveStart = 1;              //s
+static const int MaxRebufferSteps = 4;
+static const int64_t RebufferDecayTime = 60000000;  //us of smooth playback per forgiven rebuffer
+static const double LiveReadAhead = 10;         //s
+static const double SeekableReadAhead = 60;     //s
+static const int64_t MinCeiling = 2 * 1024 * 1024;
+static const int64_t MaxCeiling = 64 * 1024 * 1024;
+static const int64_t DefaultCeiling = 5 * 1024 * 1024;
+
+BufferPolicy::BufferPolicy() :
+    mLive(false),
+    mContainerBitrate(0),
+    mLastRebufferTime(0),
+    mRebuffers(0),
+    mStartThreshold(DefaultStart),
+    mCeiling(DefaultCeiling),
+    mStartOverride(0),
+    mCeilingOverride(0)
+{
+}
+
+void BufferPolicy::reset(bool live, int64_t bitrate)
+{
+    mLive = live;
+    mContainerBitrate = bitrate > 0 ? bitrate : 0;
+    mLastRebufferTime = 0;
+    mRebuffers = 0;
+    update(0, 0);
+}
+
+void BufferPolicy::onRebuffer()
+{
+    if(mRebuffers < MaxRebufferSteps)
+        mRebuffers ++;
+    mLastRebufferTime = av_gettime_relative();
+}
+
+void BufferPolicy::update(int64_t downloadSpeed, int64_t measuredBitrate)
+{
+    if(mRebuffers > 0 && av_gettime_relative() - mLastRebufferTime > RebufferDecayTime)
+    {
+        mRebuffers --;
+        mLastRebufferTime = av_gettime_relative();
+    }
+
+    int64_t bitrate = mContainerBitrate > 0 ? mContainerBitrate : measuredBitrate;
+
+    double start = DefaultStart;
+    if(mLive)
+        start = LiveStart;
+    else if(bitrate > 0 && downloadSpeed > 0)
+    {
+        //1s of cushion at twice the stream rate, growing steeply as the headroom runs out
+        double headroom = downloadSpeed * 8.0 / bitrate;
+        start = 1.0 / std::max(headroom - 1, 0.1);
+    }
+    start *= 1 + mRebuffers;
+    mStartThreshold = std::min(std::max(start, MinStart), MaxStart);
+
+    int64_t ceiling = DefaultCeiling;
+    if(bitrate > 0)
+    {
+        double readAhead = std::max(mLive ? LiveReadAhead : SeekableReadAhead, mStartThreshold * 2);
+        ceiling = static_cast<int64_t>(bitrate / 8 * readAhead);
+    }
+    mCeiling = std::min(std::max(ceiling, MinCeiling), MaxCeiling);
+}
+
+double BufferPolicy::startThreshold() const
+{
+    double start = mStartOverride;
+    return start > 0 ? start : mStartThreshold.load();
+}
+
+int64_t BufferPolicy::ceiling() const
+{
+    int64_t ceiling = mCeilingOverride;
+    return ceiling > 0 ? ceiling : mCeiling.load();
+}
@@ -0,0 +1,58 @@
+#ifndef BUFFERPOLICY_HPP
+#define BUFFERPOLICY_HPP
+
+#include <atomic>
+#include <cstdint>
+
+namespace miniplayer
+{
+
+/*
+ * Sizes the buffering of one playback session: how many seconds must be buffered before
+ * playback (re)starts and how many bytes of packets may be queued ahead.
+ *
+ * The start threshold follows the download headroom (download speed / stream bitrate):
+ * a link much faster than the stream refills quickly and can start early, a link barely
+ * keeping up needs a long cushion. Live inputs arrive at the stream rate, so they start
+ * from a short fixed threshold instead. Every rebuffer of the session raises the threshold
+ * and a minute of smooth playback takes one back. The ceiling holds ReadAhead seconds of
+ * the stream, much more for seekable inputs where a fast CDN can burst ahead.
+ *
+ * Only the read thread updates the policy, the results can be read from any thread.
+ */
+class BufferPolicy
+{
+public:
+    BufferPolicy();
+
+    //new session, bitrate in bits/s from the container (0 when unknown)
+    void reset(bool live, int64_t bitrate);
+
+    //downloadSpeed in bytes/s, measuredBitrate in bits/s from the queued packets (0 when unknown)
+    void update(int64_t downloadSpeed, int64_t measuredBitrate);
+    void onRebuffer();
+
+    //manual overrides, 0 goes back to adaptive
+    void setStartOverride(double seconds) { mStartOverride = seconds; }
+    double getStartOverride() const { return mStartOverride; }
+    void setCeilingOverride(int64_t bytes) { mCeilingOverride = bytes; }
+    int64_t getCeilingOverride() const { return mCeilingOverride; }
+
+    double startThreshold() const;
+    int64_t ceiling() const;
+    int rebuffers() const { return mRebuffers; }
+
+private:
+    bool mLive;
+    int64_t mContainerBitrate;
+    int64_t mLastRebufferTime;
+    std::atomic_int mRebuffers;
+    std::atomic<double> mStartThreshold;
+    std::atomic<int64_t> mCeiling;
+    std::atomic<double> mStartOverride;
+    std::atomic<int64_t> mCeilingOverride;
+};
+
+}
+
+#endif // BUFFERPOLICY_HPP
@@ -6,7 +6,8 @@ namespace miniplayer
 
 typedef enum {
     Open = 2001,
-    Stop
+    Stop,
+    Seek
 } CommandType;
 
 struct Command
@@ -38,6 +39,17 @@ struct StopCommand : public Command
     {}
 };
 
+struct SeekCommand : public Command
+{
+    double position;
+    bool preview;   //scrubbing, only the keyframe nearest to position is shown
+    SeekCommand(double position, bool preview) :
+        Command(CommandType::Seek),
+        position(position),
+        preview(preview)
+    {}
+};
+
 }
 
 #endif // COMMAND_HPP
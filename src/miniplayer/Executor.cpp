@@ -0,0 +1,203 @@
+#include "Executor.hpp"
+#include <algorithm>
+#include <QDebug>
+
+extern "C"
+{
+#include <libavutil/time.h>
+}
+
+using namespace miniplayer;
+
+static thread_local Executor * currentExecutor = nullptr;
+static thread_local int currentWorker = -1;
+
+Executor::Executor(int threadCount) :
+    mNextWorker(0),
+    mPending(0),
+    mIdle(0),
+    mStopping(false),
+    mNextTimer(INT64_MAX)
+{
+    if(threadCount <= 0)
+        threadCount = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    qDebug() << __FUNCTION__ << "threads:" << threadCount;
+
+    for(int i = 0; i < threadCount; i++)
+    {
+        mWorkers.emplace_back(new Worker());
+        mWorkers.back()->picks = 0;
+    }
+    for(int i = 0; i < threadCount; i++)
+        mWorkers[i]->thread = std::thread(&Executor::workerThread, this, i);
+}
+
+Executor::~Executor()
+{
+    qDebug() << __FUNCTION__;
+    {
+        std::lock_guard<std::mutex> l(mIdleMutex);
+        mStopping = true;
+        mIdleCond.notify_all();
+    }
+    for(auto & worker : mWorkers)
+    {
+        if(worker->thread.joinable())
+            worker->thread.join();
+    }
+}
+
+Executor * Executor::shared()
+{
+    static Executor executor;
+    return &executor;
+}
+
+void Executor::schedule(Task * task)
+{
+    int level = task->mGroup && task->mGroup->isBoosted() ? High : Normal;
+    unsigned index = currentExecutor == this ? static_cast<unsigned>(currentWorker)
+                                             : mNextWorker.fetch_add(1, std::memory_order_relaxed) % mWorkers.size();
+    {
+        Worker & worker = *mWorkers[index];
+        std::lock_guard<std::mutex> l(worker.mutex);
+        worker.queues[level].push_back(task);
+    }
+    mPending.fetch_add(1);
+    wakeIdle();
+}
+
+void Executor::scheduleAt(Task * task, int64_t time)
+{
+    std::lock_guard<std::mutex> l(mTimerMutex);
+    if(task->mHasTimer)
+        mTimers.erase(task->mTimer);
+    task->mTimer = mTimers.emplace(time, task);
+    task->mHasTimer = true;
+    if(time < mNextTimer.load())
+    {
+        mNextTimer = time;
+        wakeIdle();
+    }
+}
+
+void Executor::cancelTimer(Task * task)
+{
+    //only the task itself arms its timer, so a cleared flag cannot be set behind our back
+    if(!task->mHasTimer)
+        return;
+    std::lock_guard<std::mutex> l(mTimerMutex);
+    if(task->mHasTimer)
+    {
+        mTimers.erase(task->mTimer);
+        task->mHasTimer = false;
+    }
+}
+
+void Executor::wakeIdle()
+{
+    //pairs with the idle count/pending check in workerThread()
+    if(mIdle.load() == 0)
+        return;
+    std::lock_guard<std::mutex> l(mIdleMutex);
+    mIdleCond.notify_one();
+}
+
+int64_t Executor::fireTimers()
+{
+    int64_t now = av_gettime_relative();
+    if(mNextTimer.load() > now)
+        return mNextTimer;
+
+    //onTimer() runs locked so cancelTimer() guarantees no callback is in flight afterwards
+    std::lock_guard<std::mutex> l(mTimerMutex);
+    while(!mTimers.empty() && mTimers.begin()->first <= now)
+    {
+        Task * task = mTimers.begin()->second;
+        mTimers.erase(mTimers.begin());
+        task->mHasTimer = false;
+        task->onTimer();
+    }
+    mNextTimer = mTimers.empty() ? INT64_MAX : mTimers.begin()->first;
+    return mNextTimer;
+}
+
+Executor::Task * Executor::popFront(Worker & worker, int level)
+{
+    std::lock_guard<std::mutex> l(worker.mutex);
+    auto & queue = worker.queues[level];
+    if(queue.empty())
+        return nullptr;
+    Task * task = queue.front();
+    queue.pop_front();
+    return task;
+}
+
+Executor::Task * Executor::popBack(Worker & worker, int level)
+{
+    std::lock_guard<std::mutex> l(worker.mutex);
+    auto & queue = worker.queues[level];
+    if(queue.empty())
+        return nullptr;
+    Task * task = queue.back();
+    queue.pop_back();
+    return task;
+}
+
+Executor::Task * Executor::take(int index)
+{
+    if(mPending.load() == 0)
+        return nullptr;
+
+    Worker & self = *mWorkers[index];
+    int levels[LevelCount] = { High, Normal };
+    if(++self.picks % BoostRatio == 0)
+        std::swap(levels[0], levels[1]);
+
+    int count = static_cast<int>(mWorkers.size());
+    for(int level : levels)
+    {
+        Task * task = popFront(self, level);
+        for(int i = 1; !task && i < count; i++)
+            task = popBack(*mWorkers[(index + i) % count], level);
+        if(task)
+        {
+            mPending.fetch_sub(1);
+            return task;
+        }
+    }
+    return nullptr;
+}
+
+void Executor::workerThread(int index)
+{
+    currentExecutor = this;
+    currentWorker = index;
+
+    for(;;)
+    {
+        int64_t nextTimer = fireTimers();
+
+        Task * task = take(index);
+        if(task)
+        {
+            task->run();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> l(mIdleMutex);
+        if(mStopping)
+            break;
+        mIdle.fetch_add(1);
+        auto ready = [&]
+        {
+            int64_t timer = mNextTimer.load();
+            return mStopping || mPending.load() > 0 || timer < nextTimer || timer <= av_gettime_relative();
+        };
+        if(nextTimer == INT64_MAX)
+            mIdleCond.wait(l, ready);
+        else
+            mIdleCond.wait_for(l, std::chrono::microseconds(nextTimer - av_gettime_relative()), ready);
+        mIdle.fetch_sub(1);
+    }
+}
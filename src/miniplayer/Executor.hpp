@@ -0,0 +1,121 @@
+#ifndef EXECUTOR_HPP
+#define EXECUTOR_HPP
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <cstdint>
+
+namespace miniplayer
+{
+
+/*
+ * Work-stealing pool that runs the pipeline stages of many players on a fixed number
+ * of threads. Every worker owns a run queue; tasks woken from a worker land on that
+ * worker's queue (the next stage of the same player usually wants the same caches)
+ * and idle workers steal from the others.
+ *
+ * A task runs for one short slice and goes to the back of the queue when it still has
+ * work, so runnable players get CPU round-robin. Tasks of a boosted group (the focused
+ * or audible player) have their own queue level that is served first, except for
+ * every BoostRatio-th pick which goes to the normal level so nobody starves.
+ */
+class Executor
+{
+public:
+    class Group
+    {
+    public:
+        Group() :
+            mBoosted(false)
+        {}
+
+        void setBoosted(bool boosted) { mBoosted = boosted; }
+        bool isBoosted() const { return mBoosted; }
+
+    private:
+        std::atomic_bool mBoosted;
+    };
+
+    class Task
+    {
+    public:
+        Task() :
+            mGroup(nullptr),
+            mHasTimer(false)
+        {}
+
+        virtual ~Task() {}
+
+        //runs one slice, the task reschedules itself through schedule()/scheduleAt()
+        virtual void run() = 0;
+        virtual void onTimer() = 0;
+
+    protected:
+        Group * mGroup;
+
+    private:
+        friend class Executor;
+        std::atomic_bool mHasTimer;
+        std::multimap<int64_t, Task *>::iterator mTimer;
+    };
+
+    enum { SliceTime = 2000, BoostRatio = 4 }; //us, picks
+
+    explicit Executor(int threadCount = 0);
+    ~Executor();
+
+    Executor(const Executor&) = delete;
+    Executor& operator=(const Executor&) = delete;
+
+    //process wide pool with one worker per core
+    static Executor * shared();
+
+    int threadCount() const { return static_cast<int>(mWorkers.size()); }
+
+    //queues a task that is not queued yet
+    void schedule(Task * task);
+    //calls task->onTimer() at time (av_gettime_relative() based), replaces the previous timer of the task
+    void scheduleAt(Task * task, int64_t time);
+    void cancelTimer(Task * task);
+
+private:
+    enum { High = 0, Normal, LevelCount };
+
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<Task *> queues[LevelCount];
+        std::thread thread;
+        unsigned picks;
+    };
+
+    void workerThread(int index);
+    Task * take(int index);
+    Task * popFront(Worker & worker, int level);
+    Task * popBack(Worker & worker, int level);
+    int64_t fireTimers();
+    void wakeIdle();
+
+private:
+    std::vector<std::unique_ptr<Worker>> mWorkers;
+    std::atomic<unsigned> mNextWorker;
+    std::atomic_int mPending;
+    std::atomic_int mIdle;
+    std::atomic_bool mStopping;
+    std::mutex mIdleMutex;
+    std::condition_variable mIdleCond;
+
+    std::mutex mTimerMutex;
+    std::multimap<int64_t, Task *> mTimers;
+    std::atomic<int64_t> mNextTimer;
+};
+
+}
+
+#endif // EXECUTOR_HPP
@@ -0,0 +1,126 @@
+#ifndef FRAMEPOOL_HPP
+#define FRAMEPOOL_HPP
+
+extern "C"
+{
+#include <libavutil/frame.h>
+}
+
+#include <mutex>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+
+namespace miniplayer
+{
+
+/*
+ * Recycles AVFrame shells between the decoder and whoever ends up holding the frame
+ * (frame queue, renderer, video surface). Shells are taken by the decoder thread but may
+ * come back from any thread, so the free list is a plain locked vector: one short lock
+ * per frame is far cheaper than the malloc/free pair it replaces.
+ *
+ * The pixel/sample buffers themselves are refcounted and come from libavcodec's own
+ * buffer pool, release() only drops the references.
+ */
+class AVFramePool
+{
+public:
+    typedef struct {
+        int64_t allocated;  //shells ever allocated
+        int64_t available;  //shells sitting in the pool
+        int64_t inUse;      //shells out in the pipeline or held by a surface
+    } Info;
+
+    AVFramePool() :
+        mCapacity(0),
+        mAllocated(0),
+        mFreed(0)
+    {}
+
+    ~AVFramePool()
+    {
+        for(auto frame : mFrames)
+            av_frame_free(&frame);
+    }
+
+    AVFramePool(const AVFramePool&) = delete;
+    AVFramePool& operator=(const AVFramePool&) = delete;
+
+    //keeps up to capacity shells around and pre-allocates them
+    void reserve(size_t capacity)
+    {
+        std::lock_guard<std::mutex> l(mMutex);
+        mCapacity = capacity;
+        while(mFrames.size() < mCapacity)
+        {
+            AVFrame * frame = av_frame_alloc();
+            if(!frame)
+                break;
+            mAllocated ++;
+            mFrames.push_back(frame);
+        }
+        while(mFrames.size() > mCapacity)
+        {
+            av_frame_free(&mFrames.back());
+            mFrames.pop_back();
+            mFreed ++;
+        }
+    }
+
+    //an empty shell, falls back to av_frame_alloc when the pool ran dry
+    AVFrame * acquire()
+    {
+        {
+            std::lock_guard<std::mutex> l(mMutex);
+            if(!mFrames.empty())
+            {
+                AVFrame * frame = mFrames.back();
+                mFrames.pop_back();
+                return frame;
+            }
+        }
+        AVFrame * frame = av_frame_alloc();
+        if(frame)
+            mAllocated ++;
+        return frame;
+    }
+
+    //drop-in replacement for av_frame_free(), safe from any thread
+    void release(AVFrame ** frame)
+    {
+        if(!*frame)
+            return;
+        av_frame_unref(*frame);
+        {
+            std::lock_guard<std::mutex> l(mMutex);
+            if(mFrames.size() < mCapacity)
+            {
+                mFrames.push_back(*frame);
+                *frame = nullptr;
+                return;
+            }
+        }
+        av_frame_free(frame);
+        mFreed ++;
+    }
+
+    void dump(Info & info) const
+    {
+        std::lock_guard<std::mutex> l(mMutex);
+        info.allocated = mAllocated;
+        info.available = static_cast<int64_t>(mFrames.size());
+        info.inUse = mAllocated - mFreed - info.available;
+    }
+
+private:
+    mutable std::mutex mMutex;
+    std::vector<AVFrame *> mFrames;
+    size_t mCapacity;
+    std::atomic<int64_t> mAllocated;
+    std::atomic<int64_t> mFreed;
+};
+
+}
+
+#endif // FRAMEPOOL_HPP
@@ -0,0 +1,297 @@
+#include "InputPrefetcher.hpp"
+#include <algorithm>
+#include <functional>
+#include <chrono>
+#include <QDebug>
+
+using namespace miniplayer;
+
+InputPrefetcher::InputPrefetcher() :
+    mProbing(0),
+    mMaxInputs(2),
+    mMaxBytes(16 * 1024 * 1024),
+    mMaxProbes(1)
+{
+}
+
+InputPrefetcher::~InputPrefetcher()
+{
+    clear();
+}
+
+InputPrefetcher * InputPrefetcher::shared()
+{
+    static InputPrefetcher prefetcher;
+    return &prefetcher;
+}
+
+void InputPrefetcher::prefetch(const std::vector<std::string> & urls)
+{
+    std::vector<std::unique_ptr<Standby>> stopped;
+    {
+        std::lock_guard<std::mutex> l(mMutex);
+        std::vector<std::string> wanted;
+        for(const auto & url : urls)
+        {
+            if(static_cast<int>(wanted.size()) >= mMaxInputs)
+                break;
+            if(!url.empty() && std::find(wanted.begin(), wanted.end(), url) == wanted.end())
+                wanted.push_back(url);
+        }
+
+        for(auto iter = mStandbys.begin(); iter != mStandbys.end(); )
+        {
+            if(std::find(wanted.begin(), wanted.end(), iter->first) != wanted.end())
+            {
+                ++iter;
+                continue;
+            }
+            iter->second->stop = true;
+            stopped.push_back(std::move(iter->second));
+            iter = mStandbys.erase(iter);
+        }
+
+        for(const auto & url : wanted)
+        {
+            if(mStandbys.count(url))
+                continue;
+            qDebug() << __FUNCTION__ << url.c_str();
+            std::unique_ptr<Standby> standby(new Standby(url));
+            standby->thread = std::thread(&InputPrefetcher::readThread, this, standby.get());
+            mStandbys[url] = std::move(standby);
+        }
+        mProbeCond.notify_all();
+    }
+    stopAll(stopped);
+}
+
+void InputPrefetcher::clear()
+{
+    std::vector<std::unique_ptr<Standby>> stopped;
+    {
+        std::lock_guard<std::mutex> l(mMutex);
+        for(auto & item : mStandbys)
+        {
+            item.second->stop = true;
+            stopped.push_back(std::move(item.second));
+        }
+        mStandbys.clear();
+        mProbeCond.notify_all();
+    }
+    stopAll(stopped);
+}
+
+std::unique_ptr<PrefetchedInput> InputPrefetcher::take(const std::string & url)
+{
+    std::unique_ptr<Standby> standby;
+    {
+        std::lock_guard<std::mutex> l(mMutex);
+        auto iter = mStandbys.find(url);
+        if(iter == mStandbys.end())
+            return nullptr;
+        standby = std::move(iter->second);
+        mStandbys.erase(iter);
+        standby->stop = true;
+        mProbeCond.notify_all();
+    }
+
+    if(standby->thread.joinable())
+        standby->thread.join();
+    if(!standby->probed)
+    {
+        qDebug() << __FUNCTION__ << url.c_str() << "not probed yet";
+        return nullptr;
+    }
+    qDebug() << __FUNCTION__ << url.c_str() << "packets:" << standby->input->packets.size();
+    //the standby goes away, the new owner installs its own interrupt callback
+    standby->input->interrupt.callback = nullptr;
+    standby->input->interrupt.opaque = nullptr;
+    return std::move(standby->input);
+}
+
+void InputPrefetcher::setMaxInputs(int count)
+{
+    mMaxInputs = std::max(count, 0);
+}
+
+void InputPrefetcher::setMaxProbes(int count)
+{
+    std::lock_guard<std::mutex> l(mMutex);
+    mMaxProbes = std::max(count, 1);
+    mProbeCond.notify_all();
+}
+
+void InputPrefetcher::dump(Info & info) const
+{
+    std::lock_guard<std::mutex> l(mMutex);
+    info.inputs = static_cast<int>(mStandbys.size());
+    info.ready = 0;
+    info.bytes = 0;
+    for(const auto & item : mStandbys)
+    {
+        if(item.second->probed && item.second->keyframe)
+            info.ready ++;
+        info.bytes += item.second->bytes;
+    }
+}
+
+void InputPrefetcher::stopAll(std::vector<std::unique_ptr<Standby>> & standbys)
+{
+    for(auto & standby : standbys)
+    {
+        if(standby->thread.joinable())
+            standby->thread.join();
+    }
+    standbys.clear();
+}
+
+int InputPrefetcher::onInterruptCallback(void * ctx)
+{
+    Standby * standby = (Standby *)ctx;
+    return standby->stop;
+}
+
+bool InputPrefetcher::open(Standby * standby, PrefetchedInput * input)
+{
+    {
+        std::unique_lock<std::mutex> l(mMutex);
+        mProbeCond.wait(l, [&] { return standby->stop || mProbing < mMaxProbes; });
+        if(standby->stop)
+            return false;
+        mProbing ++;
+    }
+    std::unique_ptr<int, std::function<void (int *)>> scope((int *)1, [&](void*)
+    {
+        std::lock_guard<std::mutex> l(mMutex);
+        mProbing --;
+        mProbeCond.notify_all();
+    });
+
+    AVFormatContext * formatContext = avformat_alloc_context();
+    formatContext->interrupt_callback.opaque = (void *)input;
+    formatContext->interrupt_callback.callback = &PrefetchedInput::onInterruptCallback;
+    input->interrupt.opaque = (void *)standby;
+    input->interrupt.callback = &InputPrefetcher::onInterruptCallback;
+
+    int ret = avformat_open_input(&formatContext, standby->url.c_str(), NULL, NULL);
+    if (ret < 0)
+    {
+        qWarning() << __FUNCTION__ << "avformat_open_input" << "failure" << standby->url.c_str();
+        return false;
+    }
+    input->formatContext = formatContext;
+
+    ret = avformat_find_stream_info(formatContext, NULL);
+    if(ret < 0)
+    {
+        qWarning() << __FUNCTION__ << "avformat_find_stream_info" << "failure" << standby->url.c_str();
+        return false;
+    }
+
+    //same choice as MiniPlayer::openThread(): the first stream of each type
+    for (uint i = 0; i < formatContext->nb_streams; i++)
+    {
+        auto codecType = formatContext->streams[i]->codec->codec_type;
+        if (codecType == AVMediaType::AVMEDIA_TYPE_VIDEO && input->videoStream < 0)
+            input->videoStream = i;
+        else if(codecType == AVMediaType::AVMEDIA_TYPE_AUDIO && input->audioStream < 0)
+            input->audioStream = i;
+    }
+    return input->videoStream >= 0 && input->audioStream >= 0;
+}
+
+void InputPrefetcher::readThread(Standby * standby)
+{
+    qDebug() << __FUNCTION__ << "start" << standby->url.c_str();
+    standby->input.reset(new PrefetchedInput());
+    PrefetchedInput * input = standby->input.get();
+    if(!open(standby, input))
+        return;
+    standby->probed = true;
+
+    AVFormatContext * formatContext = input->formatContext;
+    bool live = formatContext->duration == AV_NOPTS_VALUE ||
+                !formatContext->pb || !(formatContext->pb->seekable & AVIO_SEEKABLE_NORMAL);
+
+    auto drop = [&]
+    {
+        for(auto packet : input->packets)
+            av_packet_free(&packet);
+        input->packets.clear();
+        standby->bytes = 0;
+    };
+
+    while(!standby->stop)
+    {
+        AVPacket * packet = av_packet_alloc();
+        int ret = av_read_frame(formatContext, packet);
+        if(ret < 0)
+        {
+            av_packet_free(&packet);
+            if(ret == AVERROR(EAGAIN))
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+            break;
+        }
+
+        bool video = packet->stream_index == input->videoStream;
+        if(!video && packet->stream_index != input->audioStream)
+        {
+            av_packet_free(&packet);
+            continue;
+        }
+
+        //the player takes these over long after the next av_read_frame()
+        if(!packet->buf)
+        {
+            AVPacket * copy = av_packet_alloc();
+            ret = av_packet_ref(copy, packet);
+            av_packet_free(&packet);
+            if(ret < 0)
+            {
+                av_packet_free(&copy);
+                continue;
+            }
+            packet = copy;
+        }
+
+        bool keyframe = video && (packet->flags & AV_PKT_FLAG_KEY);
+        if(keyframe && standby->keyframe)
+        {
+            //a whole GOP is enough to start a file, live inputs move on to the newest one
+            if(!live)
+            {
+                input->packets.push_back(packet);
+                standby->bytes += packet->size;
+                break;
+            }
+            drop();
+        }
+        if(keyframe)
+            standby->keyframe = true;
+
+        //nothing before the first keyframe is decodable
+        if(!standby->keyframe)
+        {
+            av_packet_free(&packet);
+            continue;
+        }
+
+        int64_t budget = mMaxBytes / std::max(1, mMaxInputs.load());
+        if(standby->bytes + packet->size > budget)
+        {
+            av_packet_free(&packet);
+            if(!live)
+                break;
+            drop();
+            standby->keyframe = false;
+            continue;
+        }
+
+        input->packets.push_back(packet);
+        standby->bytes += packet->size;
+    }
+    qDebug() << __FUNCTION__ << "end" << standby->url.c_str() << "packets:" << input->packets.size();
+}
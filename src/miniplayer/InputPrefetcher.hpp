@@ -0,0 +1,141 @@
+#ifndef INPUTPREFETCHER_HPP
+#define INPUTPREFETCHER_HPP
+
+extern "C"
+{
+#include <libavformat/avformat.h>
+}
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <map>
+#include <vector>
+#include <memory>
+#include <string>
+#include <cstdint>
+
+namespace miniplayer
+{
+
+//an opened and probed input, ready to be handed to a player
+class PrefetchedInput
+{
+public:
+    PrefetchedInput() :
+        formatContext(nullptr),
+        videoStream(-1),
+        audioStream(-1)
+    {
+        interrupt.callback = nullptr;
+        interrupt.opaque = nullptr;
+    }
+
+    ~PrefetchedInput()
+    {
+        for(auto packet : packets)
+            av_packet_free(&packet);
+        if(formatContext)
+            avformat_close_input(&formatContext);
+    }
+
+    PrefetchedInput(const PrefetchedInput&) = delete;
+    PrefetchedInput& operator=(const PrefetchedInput&) = delete;
+
+    AVFormatContext * formatContext;
+    int videoStream;
+    int audioStream;
+    std::deque<AVPacket *> packets; //refcounted, starting at a video keyframe
+
+    //the I/O layer keeps a copy of the interrupt callback it was opened with, which points
+    //here for good, so whoever owns the input now is reached through this forward
+    AVIOInterruptCB interrupt;
+
+    static int onInterruptCallback(void * ctx)
+    {
+        PrefetchedInput * input = (PrefetchedInput *)ctx;
+        return input->interrupt.callback ? input->interrupt.callback(input->interrupt.opaque) : 0;
+    }
+};
+
+/*
+ * Keeps a standby set of inputs (usually the channels adjacent to the one playing) opened
+ * and probed, with the latest video keyframe and everything after it buffered, so that
+ * open() on one of them skips avformat_open_input/avformat_find_stream_info and can show
+ * a picture right away.
+ *
+ * Every standby input has its own reader thread. Live inputs keep reading and only retain
+ * the latest GOP, seekable files stop after the first one. Probing is the expensive part,
+ * so at most maxProbes inputs probe at the same time, and the buffered packets of the
+ * whole set are capped at maxBytes.
+ */
+class InputPrefetcher
+{
+public:
+    typedef struct {
+        int inputs;     //standby inputs, probing or ready
+        int ready;      //probed and holding a keyframe
+        int64_t bytes;  //buffered packet data of the whole set
+    } Info;
+
+    InputPrefetcher();
+    ~InputPrefetcher();
+
+    static InputPrefetcher * shared();
+
+    //keeps exactly these inputs warm (the first maxInputs of them), the others are dropped
+    void prefetch(const std::vector<std::string> & urls);
+    void clear();
+
+    //hands the warm input over, nullptr when the url was not prefetched or not probed yet
+    std::unique_ptr<PrefetchedInput> take(const std::string & url);
+
+    void setMaxInputs(int count);
+    int getMaxInputs() const { return mMaxInputs; }
+    void setMaxBytes(int64_t bytes) { mMaxBytes = bytes; }
+    int64_t getMaxBytes() const { return mMaxBytes; }
+    void setMaxProbes(int count);
+    int getMaxProbes() const { return mMaxProbes; }
+
+    void dump(Info & info) const;
+
+private:
+    struct Standby
+    {
+        std::string url;
+        std::thread thread;
+        std::atomic_bool stop;
+        std::atomic_bool probed;
+        std::atomic_bool keyframe;
+        std::atomic<int64_t> bytes;
+        std::unique_ptr<PrefetchedInput> input;    //owned by the reader thread until it is joined
+
+        Standby(const std::string & url) :
+            url(url),
+            stop(false),
+            probed(false),
+            keyframe(false),
+            bytes(0)
+        {}
+    };
+
+    void readThread(Standby * standby);
+    bool open(Standby * standby, PrefetchedInput * input);
+    void stopAll(std::vector<std::unique_ptr<Standby>> & standbys);
+    static int onInterruptCallback(void * ctx);
+
+private:
+    mutable std::mutex mMutex;
+    std::condition_variable mProbeCond;
+    std::map<std::string, std::unique_ptr<Standby>> mStandbys;
+    int mProbing;
+    std::atomic_int mMaxInputs;
+    std::atomic<int64_t> mMaxBytes;
+    std::atomic_int mMaxProbes;
+};
+
+}
+
+#endif // INPUTPREFETCHER_HPP
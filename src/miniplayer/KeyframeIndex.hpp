@@ -0,0 +1,92 @@
+#ifndef KEYFRAMEINDEX_HPP
+#define KEYFRAMEINDEX_HPP
+
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+namespace miniplayer
+{
+
+/*
+ * Video keyframes seen while demuxing: time (s, relative to the stream start) -> byte
+ * position in the input. Entries read one after another without a seek in between are
+ * linked, so a lookup can tell whether the keyframe it found really is the last one
+ * before the target or whether an unread gap follows it.
+ *
+ * Only the read thread adds and looks up, size() may be read from any thread.
+ */
+class KeyframeIndex
+{
+public:
+    typedef struct {
+        double time;
+        int64_t pos;
+        bool linked;    //read right after the previous entry
+    } Entry;
+
+    enum { MaxEntries = 64 * 1024 };
+
+    KeyframeIndex() :
+        mLast(-1),
+        mSize(0)
+    {}
+
+    void add(double time, int64_t pos)
+    {
+        auto iter = std::lower_bound(mEntries.begin(), mEntries.end(), time,
+                                     [](const Entry & entry, double time) { return entry.time < time; });
+        int index = static_cast<int>(iter - mEntries.begin());
+        if(iter == mEntries.end() || iter->time != time)
+        {
+            if(mEntries.size() >= MaxEntries)
+            {
+                mLast = -1;
+                return;
+            }
+            mEntries.insert(iter, Entry{time, pos, false});
+            if(mLast >= index)
+                mLast ++;
+            mSize = mEntries.size();
+        }
+        if(mLast >= 0 && mLast == index - 1)
+            mEntries[index].linked = true;
+        mLast = index;
+    }
+
+    //the next add() does not follow the previous one (seek)
+    void breakRun()
+    {
+        mLast = -1;
+    }
+
+    //last keyframe at or before time, only when the keyframe after it is known too
+    bool lookup(double time, Entry & entry) const
+    {
+        auto iter = std::upper_bound(mEntries.begin(), mEntries.end(), time,
+                                     [](double time, const Entry & entry) { return time < entry.time; });
+        if(iter == mEntries.begin() || iter == mEntries.end() || !iter->linked)
+            return false;
+        entry = *(iter - 1);
+        return true;
+    }
+
+    void clear()
+    {
+        mEntries.clear();
+        mLast = -1;
+        mSize = 0;
+    }
+
+    size_t size() const { return mSize; }
+
+private:
+    std::vector<Entry> mEntries;
+    int mLast;                  //entry added last, -1 after a seek
+    std::atomic<size_t> mSize;
+};
+
+}
+
+#endif // KEYFRAMEINDEX_HPP
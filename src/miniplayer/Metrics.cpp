@@ -0,0 +1,292 @@
+#include "Metrics.hpp"
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <QDebug>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+using namespace miniplayer;
+
+void LatencyHistogram::reset()
+{
+    for(auto & bucket : mBuckets)
+        bucket.store(0, std::memory_order_relaxed);
+    mCount.store(0, std::memory_order_relaxed);
+    mSum.store(0, std::memory_order_relaxed);
+    mMax.store(0, std::memory_order_relaxed);
+}
+
+int LatencyHistogram::bucketIndex(uint64_t value)
+{
+    if(value < SubBuckets)
+        return static_cast<int>(value);
+
+    int octave = 63;
+    while(!(value & (1ULL << octave)))
+        octave --;
+
+    int sub = static_cast<int>((value >> (octave - 2)) & (SubBuckets - 1));
+    int index = (octave - 1) * SubBuckets + sub;
+    return index < BucketCount ? index : BucketCount - 1;
+}
+
+double LatencyHistogram::bucketValue(int index)
+{
+    if(index < SubBuckets)
+        return index;
+
+    //midpoint of the bucket
+    int octave = index / SubBuckets + 1;
+    int sub = index % SubBuckets;
+    double low = static_cast<double>(1ULL << octave) * (1.0 + sub / static_cast<double>(SubBuckets));
+    double width = static_cast<double>(1ULL << octave) / SubBuckets;
+    return low + width / 2;
+}
+
+LatencyInfo LatencyHistogram::info() const
+{
+    LatencyInfo result = { 0 };
+    uint64_t counts[BucketCount];
+    uint64_t total = 0;
+    for(int i = 0; i < BucketCount; i++)
+    {
+        counts[i] = mBuckets[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+
+    result.count = total;
+    if(total == 0)
+        return result;
+
+    result.mean = mSum.load(std::memory_order_relaxed) / static_cast<double>(mCount.load(std::memory_order_relaxed)) / 1000;
+    result.max = mMax.load(std::memory_order_relaxed) / 1000.0;
+
+    const double percentiles[] = { 0.50, 0.95, 0.99 };
+    double * targets[] = { &result.p50, &result.p95, &result.p99 };
+    uint64_t seen = 0;
+    int p = 0;
+    for(int i = 0; i < BucketCount && p < 3; i++)
+    {
+        seen += counts[i];
+        while(p < 3 && seen >= percentiles[p] * total)
+        {
+            *targets[p] = std::min(bucketValue(i), static_cast<double>(mMax.load(std::memory_order_relaxed))) / 1000;
+            p ++;
+        }
+    }
+    return result;
+}
+
+//------------------------------------------------------------------------------------------------------
+
+PipelineMetrics::PipelineMetrics() :
+    mEnabled(false)
+{
+    reset();
+    beginStartup(0);
+}
+
+void PipelineMetrics::reset()
+{
+    for(auto & stage : mStages)
+        stage.reset();
+    mAVDrift.reset();
+    mAVDriftSum = 0;
+    for(auto & counter : mCounters)
+        counter.store(0, std::memory_order_relaxed);
+    mVideoDecodedBytes = 0;
+    mAudioDecodedBytes = 0;
+    for(auto & time : mThreadCpuTime)
+        time.store(0, std::memory_order_relaxed);
+    mLastTickTime = 0;
+    mLastVideoFrames = mLastAudioFrames = 0;
+    mLastVideoBytes = mLastAudioBytes = 0;
+    mVideoDecodeFps = mAudioDecodeFps = 0;
+    mVideoDecodeBitrate = mAudioDecodeBitrate = 0;
+}
+
+void PipelineMetrics::tick()
+{
+    if(!isEnabled())
+        return;
+
+    int64_t time = av_gettime_relative();
+    uint64_t videoFrames = mCounters[VideoFramesDecoded].load(std::memory_order_relaxed);
+    uint64_t audioFrames = mCounters[AudioFramesDecoded].load(std::memory_order_relaxed);
+    int64_t videoBytes = mVideoDecodedBytes.load(std::memory_order_relaxed);
+    int64_t audioBytes = mAudioDecodedBytes.load(std::memory_order_relaxed);
+
+    if(mLastTickTime > 0 && time > mLastTickTime)
+    {
+        double seconds = (time - mLastTickTime) / 1000000.0;
+        mVideoDecodeFps = (videoFrames - mLastVideoFrames) / seconds;
+        mAudioDecodeFps = (audioFrames - mLastAudioFrames) / seconds;
+        mVideoDecodeBitrate = (videoBytes - mLastVideoBytes) / seconds;
+        mAudioDecodeBitrate = (audioBytes - mLastAudioBytes) / seconds;
+    }
+
+    mLastTickTime = time;
+    mLastVideoFrames = videoFrames;
+    mLastAudioFrames = audioFrames;
+    mLastVideoBytes = videoBytes;
+    mLastAudioBytes = audioBytes;
+}
+
+void PipelineMetrics::dump(Info & info) const
+{
+    info.enabled = isEnabled();
+    for(int i = 0; i < StageCount; i++)
+        info.stages[i] = mStages[i].info();
+    info.avDrift = mAVDrift.info();
+    info.avDriftMean = info.avDrift.count > 0 ? mAVDriftSum.load(std::memory_order_relaxed) / 1000.0 / info.avDrift.count : 0;
+    for(int i = 0; i < CounterCount; i++)
+        info.counters[i] = mCounters[i].load(std::memory_order_relaxed);
+    info.videoDecodeFps = mVideoDecodeFps;
+    info.audioDecodeFps = mAudioDecodeFps;
+    info.videoDecodeBitrate = mVideoDecodeBitrate;
+    info.audioDecodeBitrate = mAudioDecodeBitrate;
+    //what the decoders could sustain if they never had to wait for input or queue space
+    auto throughput = [](uint64_t frames, const LatencyInfo & decode)
+    {
+        double busy = decode.mean * decode.count / 1000;
+        return busy > 0 ? frames / busy : 0;
+    };
+    info.videoDecoderThroughput = throughput(info.counters[VideoFramesDecoded], info.stages[VideoDecode]);
+    info.audioDecoderThroughput = throughput(info.counters[AudioFramesDecoded], info.stages[AudioDecode]);
+    for(int i = 0; i < ThreadCount; i++)
+        info.threadCpuTime[i] = mThreadCpuTime[i].load(std::memory_order_relaxed) / 1000.0;
+    for(int i = 0; i < StartupPhaseCount; i++)
+        info.startup[i] = mStartup[i].load(std::memory_order_relaxed) / 1000.0;
+}
+
+bool PipelineMetrics::dumpToFile(const std::string & path) const
+{
+    std::ofstream out(path.c_str(), std::ios::out | std::ios::app);
+    if(!out)
+    {
+        qWarning() << __FUNCTION__ << "failed to open" << path.c_str();
+        return false;
+    }
+
+    Info info;
+    dump(info);
+
+    out << std::fixed << std::setprecision(3);
+    out << "# miniplayer metrics @" << av_gettime_relative() << "us" << (info.enabled ? "" : " (disabled)") << "\n";
+    out << "stage                 count      mean(ms)   p50(ms)    p95(ms)    p99(ms)    max(ms)\n";
+    auto writeLatency = [&](const char * name, const LatencyInfo & latency)
+    {
+        out << std::left << std::setw(22) << name << std::right
+            << std::setw(10) << latency.count << " "
+            << std::setw(10) << latency.mean << " "
+            << std::setw(10) << latency.p50 << " "
+            << std::setw(10) << latency.p95 << " "
+            << std::setw(10) << latency.p99 << " "
+            << std::setw(10) << latency.max << "\n";
+    };
+    for(int i = 0; i < StageCount; i++)
+        writeLatency(stageName(i), info.stages[i]);
+    writeLatency("avDrift", info.avDrift);
+    out << "avDriftMean(ms)       " << info.avDriftMean << "\n";
+    for(int i = 0; i < CounterCount; i++)
+        out << std::left << std::setw(22) << counterName(i) << std::right << info.counters[i] << "\n";
+    out << "videoDecodeFps        " << info.videoDecodeFps << "\n";
+    out << "audioDecodeFps        " << info.audioDecodeFps << "\n";
+    out << "videoDecodeBitrate    " << info.videoDecodeBitrate << "\n";
+    out << "audioDecodeBitrate    " << info.audioDecodeBitrate << "\n";
+    out << "videoDecoderFps       " << info.videoDecoderThroughput << "\n";
+    out << "audioDecoderFps       " << info.audioDecoderThroughput << "\n";
+    for(int i = 0; i < ThreadCount; i++)
+        out << std::left << std::setw(22) << (std::string(threadName(i)) + "Cpu(ms)") << std::right << info.threadCpuTime[i] << "\n";
+    for(int i = 0; i < StartupPhaseCount; i++)
+        out << std::left << std::setw(22) << (std::string(startupPhaseName(i)) + "(ms)") << std::right << info.startup[i] << "\n";
+    out << "\n";
+    return true;
+}
+
+const char * PipelineMetrics::stageName(int stage)
+{
+    static const char * names[StageCount] = {
+        "demuxRead",
+        "videoPacketWait",
+        "audioPacketWait",
+        "videoDecode",
+        "audioDecode",
+        "videoFrameWait",
+        "audioFrameWait",
+        "videoPresent",
+        "audioQueue",
+        "seek",
+        "audioStretch"
+    };
+    return stage >= 0 && stage < StageCount ? names[stage] : "";
+}
+
+const char * PipelineMetrics::counterName(int counter)
+{
+    static const char * names[CounterCount] = {
+        "packetsRead",
+        "bytesRead",
+        "videoPacketsDecoded",
+        "audioPacketsDecoded",
+        "videoFramesDecoded",
+        "audioFramesDecoded",
+        "videoFramesRendered",
+        "audioFramesRendered",
+        "videoFramesDropped",
+        "audioFramesDropped",
+        "seekFramesSkipped"
+    };
+    return counter >= 0 && counter < CounterCount ? names[counter] : "";
+}
+
+const char * PipelineMetrics::threadName(int thread)
+{
+    static const char * names[ThreadCount] = {
+        "readThread",
+        "videoDecodeThread",
+        "audioDecodeThread",
+        "videoRenderThread",
+        "audioRenderThread"
+    };
+    return thread >= 0 && thread < ThreadCount ? names[thread] : "";
+}
+
+const char * PipelineMetrics::startupPhaseName(int phase)
+{
+    static const char * names[StartupPhaseCount] = {
+        "openInput",
+        "findStreamInfo",
+        "codecOpen",
+        "firstPacket",
+        "firstFrame",
+        "firstRender",
+        "firstAudio"
+    };
+    return phase >= 0 && phase < StartupPhaseCount ? names[phase] : "";
+}
+
+int64_t PipelineMetrics::currentThreadCpuTime()
+{
+#ifdef _WIN32
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if(!GetThreadTimes(GetCurrentThread(), &creationTime, &exitTime, &kernelTime, &userTime))
+        return 0;
+    ULARGE_INTEGER kernel, user;
+    kernel.LowPart = kernelTime.dwLowDateTime;
+    kernel.HighPart = kernelTime.dwHighDateTime;
+    user.LowPart = userTime.dwLowDateTime;
+    user.HighPart = userTime.dwHighDateTime;
+    return static_cast<int64_t>((kernel.QuadPart + user.QuadPart) / 10); //100ns units
+#else
+    struct timespec ts;
+    if(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+        return 0;
+    return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
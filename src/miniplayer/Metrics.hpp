@@ -0,0 +1,272 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+extern "C"
+{
+#include <libavutil/time.h>
+}
+
+#include <atomic>
+#include <string>
+#include <algorithm>
+#include <cstdint>
+
+namespace miniplayer
+{
+
+typedef struct {
+    uint64_t count;
+    double mean;    //ms
+    double p50;     //ms
+    double p95;     //ms
+    double p99;     //ms
+    double max;     //ms
+} LatencyInfo;
+
+/*
+ * Lock-free log-linear histogram of microsecond samples: every power of two is split
+ * into four buckets, which keeps percentiles within ~20% of the real value up to hours.
+ */
+class LatencyHistogram
+{
+public:
+    enum { SubBuckets = 4, BucketCount = 64 * SubBuckets };
+
+    LatencyHistogram() { reset(); }
+
+    void record(int64_t us)
+    {
+        if(us < 0)
+            us = 0;
+        mBuckets[bucketIndex(static_cast<uint64_t>(us))].fetch_add(1, std::memory_order_relaxed);
+        mCount.fetch_add(1, std::memory_order_relaxed);
+        mSum.fetch_add(us, std::memory_order_relaxed);
+        int64_t max = mMax.load(std::memory_order_relaxed);
+        while(us > max && !mMax.compare_exchange_weak(max, us, std::memory_order_relaxed))
+            ;
+    }
+
+    void reset();
+    LatencyInfo info() const;
+
+private:
+    static int bucketIndex(uint64_t value);
+    static double bucketValue(int index);
+
+private:
+    std::atomic<uint64_t> mBuckets[BucketCount];
+    std::atomic<uint64_t> mCount;
+    std::atomic<int64_t> mSum;
+    std::atomic<int64_t> mMax;
+};
+
+class PipelineMetrics
+{
+public:
+    typedef enum {
+        DemuxRead = 0,      //time spent inside av_read_frame
+        VideoPacketWait,    //packet enqueue -> video decode start
+        AudioPacketWait,    //packet enqueue -> audio decode start
+        VideoDecode,        //video decode start -> end
+        AudioDecode,        //audio decode start -> end
+        VideoFrameWait,     //frame enqueue -> video render
+        AudioFrameWait,     //frame enqueue -> audio render
+        VideoPresent,       //Callback::onVideoRender
+        AudioQueue,         //AudioOutput::render
+        Seek,               //seek() -> first video frame rendered after it
+        AudioStretch,       //TimeStretch push/pull per decoded audio frame
+        StageCount
+    } Stage;
+
+    typedef enum {
+        PacketsRead = 0,
+        BytesRead,
+        VideoPacketsDecoded,
+        AudioPacketsDecoded,
+        VideoFramesDecoded,
+        AudioFramesDecoded,
+        VideoFramesRendered,
+        AudioFramesRendered,
+        VideoFramesDropped,
+        AudioFramesDropped,
+        SeekFramesSkipped,  //decoded before an accurate seek target and never queued
+        CounterCount
+    } Counter;
+
+    typedef enum {
+        ReadThread = 0,
+        VideoDecodeThread,
+        AudioDecodeThread,
+        VideoRenderThread,
+        AudioRenderThread,
+        ThreadCount
+    } Thread;
+
+    typedef enum {
+        OpenInput = 0,      //avformat_open_input returned (or the standby input was taken over)
+        FindStreamInfo,     //stream parameters known, probed or taken from the cache
+        CodecOpen,          //both decoders opened
+        FirstPacket,        //first packet read by the read thread
+        FirstFrame,         //first video frame decoded
+        FirstRender,        //first video frame handed to the callback
+        FirstAudio,         //first audio frame handed to the audio output
+        StartupPhaseCount
+    } StartupPhase;
+
+    typedef struct {
+        bool enabled;
+        LatencyInfo stages[StageCount];
+        LatencyInfo avDrift;        //|video clock - audio clock| at each presented video frame
+        double avDriftMean;         //signed, ms
+        uint64_t counters[CounterCount];
+        double videoDecodeFps;
+        double audioDecodeFps;
+        double videoDecodeBitrate;  //bytes/s fed into the video decoder
+        double audioDecodeBitrate;  //bytes/s fed into the audio decoder
+        double videoDecoderThroughput; //frames per second of time spent in send/receive
+        double audioDecoderThroughput;
+        double threadCpuTime[ThreadCount]; //ms of CPU time used by each pipeline thread
+        double startup[StartupPhaseCount];  //ms from open() to the end of each phase, 0 when not reached
+    } Info;
+
+    PipelineMetrics();
+
+    void setEnabled(bool enabled) { mEnabled.store(enabled, std::memory_order_relaxed); }
+    bool isEnabled() const { return mEnabled.load(std::memory_order_relaxed); }
+
+    //monotonic timestamp in microseconds, 0 when disabled so the hooks below become no-ops
+    int64_t now() const
+    {
+        return isEnabled() ? av_gettime_relative() : 0;
+    }
+
+    void record(Stage stage, int64_t start)
+    {
+        if(start > 0 && isEnabled())
+            mStages[stage].record(av_gettime_relative() - start);
+    }
+
+    void recordDuration(Stage stage, int64_t us)
+    {
+        if(isEnabled())
+            mStages[stage].record(us);
+    }
+
+    void recordAVDrift(double drift)
+    {
+        if(!isEnabled())
+            return;
+        int64_t us = static_cast<int64_t>(drift * 1000000);
+        mAVDrift.record(us < 0 ? -us : us);
+        mAVDriftSum.fetch_add(us, std::memory_order_relaxed);
+    }
+
+    void count(Counter counter, uint64_t value = 1)
+    {
+        if(isEnabled())
+            mCounters[counter].fetch_add(value, std::memory_order_relaxed);
+    }
+
+    void addDecodedBytes(bool video, int64_t bytes)
+    {
+        if(isEnabled())
+            (video ? mVideoDecodedBytes : mAudioDecodedBytes).fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    //recorded regardless of isEnabled(), it costs one clock read per thread lifetime
+    void setThreadCpuTime(Thread thread, int64_t us)
+    {
+        mThreadCpuTime[thread].store(us, std::memory_order_relaxed);
+    }
+
+    //stages running on a shared executor add up their slices
+    void addThreadCpuTime(Thread thread, int64_t us)
+    {
+        mThreadCpuTime[thread].fetch_add(us, std::memory_order_relaxed);
+    }
+
+    //startup phases are recorded regardless of isEnabled() and survive reset(), one clock read each
+    void beginStartup(int64_t openTime)
+    {
+        for(auto & time : mStartup)
+            time.store(0, std::memory_order_relaxed);
+        mStartupBase.store(openTime, std::memory_order_relaxed);
+    }
+
+    void markStartup(StartupPhase phase)
+    {
+        int64_t base = mStartupBase.load(std::memory_order_relaxed);
+        if(base == 0 || mStartup[phase].load(std::memory_order_relaxed) != 0)
+            return;
+        int64_t expected = 0;
+        mStartup[phase].compare_exchange_strong(expected, std::max<int64_t>(av_gettime_relative() - base, 1),
+                                                std::memory_order_relaxed);
+    }
+
+    //called once per second to refresh the throughput figures
+    void tick();
+    void reset();
+    void dump(Info & info) const;
+    bool dumpToFile(const std::string & path) const;
+
+    static const char * stageName(int stage);
+    static const char * counterName(int counter);
+    static const char * threadName(int thread);
+    static const char * startupPhaseName(int phase);
+
+    //CPU time consumed by the calling thread in microseconds
+    static int64_t currentThreadCpuTime();
+
+private:
+    std::atomic_bool mEnabled;
+    LatencyHistogram mStages[StageCount];
+    LatencyHistogram mAVDrift;
+    std::atomic<int64_t> mAVDriftSum;
+    std::atomic<uint64_t> mCounters[CounterCount];
+    std::atomic<int64_t> mVideoDecodedBytes;
+    std::atomic<int64_t> mAudioDecodedBytes;
+    std::atomic<int64_t> mThreadCpuTime[ThreadCount];
+    std::atomic<int64_t> mStartupBase;
+    std::atomic<int64_t> mStartup[StartupPhaseCount];
+
+    //tick state, only touched by the thread calling tick()
+    int64_t mLastTickTime;
+    uint64_t mLastVideoFrames;
+    uint64_t mLastAudioFrames;
+    int64_t mLastVideoBytes;
+    int64_t mLastAudioBytes;
+    std::atomic<double> mVideoDecodeFps;
+    std::atomic<double> mAudioDecodeFps;
+    std::atomic<double> mVideoDecodeBitrate;
+    std::atomic<double> mAudioDecodeBitrate;
+};
+
+//publishes the CPU time of the current thread when it goes out of scope
+class ThreadCpuTimer
+{
+public:
+    ThreadCpuTimer(PipelineMetrics & metrics, PipelineMetrics::Thread thread) :
+        mMetrics(metrics),
+        mThread(thread),
+        mStart(PipelineMetrics::currentThreadCpuTime())
+    {}
+
+    ~ThreadCpuTimer()
+    {
+        update();
+    }
+
+    void update()
+    {
+        mMetrics.setThreadCpuTime(mThread, PipelineMetrics::currentThreadCpuTime() - mStart);
+    }
+
+private:
+    PipelineMetrics & mMetrics;
+    PipelineMetrics::Thread mThread;
+    int64_t mStart;
+};
+
+}
+
+#endif // METRICS_HPP
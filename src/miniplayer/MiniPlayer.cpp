@@ -1,8 +1,36 @@
 #include "MiniPlayer.hpp"
+#include "TimeBase.hpp"
 #include <cassert>
 
 using namespace miniplayer;
 
+//upper bound for every blocking wait, the stages are normally woken by their events
+static const int64_t MaxWaitTime = 250;
+//frames outside the queue: decoder, renderer and what the surface still shows
+static const size_t FramePoolSlack = 4;
+//fast-open probing caps, libavformat defaults are 5 MB and 5 s
+static const int64_t FastOpenProbeSize = 256 * 1024;
+static const int64_t FastOpenAnalyzeDuration = 500000;
+//buffered before playback resumes after a seek, capped below the adaptive start threshold
+static const double SeekBufferDuration = 1;
+//live catch-up: speed-up starts CatchUpBand s above the target and grows with the excess up to
+//CatchUpMaxRate, beyond CatchUpJumpExcess s the buffer is dropped for the next keyframe
+static const double CatchUpBand = 0.5;
+static const double CatchUpGain = 0.02;
+static const double CatchUpMinRate = 1.02;
+static const double CatchUpMaxRate = 1.1;
+static const double CatchUpJumpExcess = 5;
+//trick play: at most one keyframe per interval (us), close targets are read up to instead of seeked to (s)
+static const int64_t TrickMinInterval = 125000;
+static const int64_t TrickFrameTimeout = 1000000;
+static const double TrickSeekDistance = 4;
+//accurate seek: packets this far (s) before the target are decoded as references only
+static const double SkipNonRefDistance = 1;
+//a frame this close before an item's start (s) already belongs to it
+static const double ItemStartTolerance = 0.001;
+//s the audio output is kept fed ahead of the device when it reports its latency
+static const double MinAudioLatency = 0.05;
+
 MiniPlayer::MiniPlayer(Callback * callback, AudioOutput * audioOutput) :
     mCallback(callback),
     mAudioOutput(audioOutput),
@@ -16,30 +44,120 @@ MiniPlayer::MiniPlayer(Callback * callback, AudioOutput * audioOutput) :
     mAudioStream(nullptr),
     mFormatContext(nullptr),
     mAudioClock(-1),
+    mAudioClockEnd(-1),
+    mAudioClockTime(0),
     mAudioClockDrift(-1),
     mVideoClock(-1),
     mVideoClockDrift(-1),
     mClockBase(-1),
-    mMaxPacketBufferSize(5 * 1024 * 1024),
-    mMaxBufferDuration(5),
+    mStartBufferDuration(-1),
     mMaxFrameQueueSize(40),
     mPosition(-1),
     mDuration(-1),
     mSeekToPosition(-1),
+    mSeekPreview(false),
+    mSeekSerial(0),
+    mReadSeekSerial(0),
     mTotalBytes(0),
     mDownloadSpeed(0),
     mFps(0),
     mEndReached(false),
-    mState(State::Stopped)
+    mFreeRun(false),
+    mVideoDrained(false),
+    mAudioDrained(false),
+    mVideoReceivePending(false),
+    mAudioReceivePending(false),
+    mVideoSkipUntil(-1),
+    mAudioSkipUntil(-1),
+    mDecoderThreads(0),
+    mDecoderThreadType(DecoderThreadType::DecoderThreadAuto),
+    mVideoDecoderThreads(0),
+    mVideoDecoderThreadType(0),
+    mState(State::Stopped),
+    mExecutor(nullptr),
+    mPrefetcher(nullptr),
+    mWarmStart(false),
+    mFastOpen(false),
+    mReadAheadSize(0),
+    mReadAheadConnections(1),
+    mTimeshiftBudget(512 * 1024 * 1024),
+    mTimeshifting(false),
+    mRecordRequested(false),
+    mPlaylistLoop(false),
+    mRetiredFormatContext(nullptr),
+    mRetiredVideoStream(nullptr),
+    mRetiredAudioStream(nullptr),
+    mNextVideoCodec(nullptr),
+    mNextAudioCodec(nullptr),
+    mRebasing(false),
+    mVideoQueuedEnd(0),
+    mAudioQueuedEnd(0),
+    mItemStart(0),
+    mItemsPending(false),
+    mItemSwitches(0),
+    mItemSwitchGap(0),
+    mStreamInfoCached(false),
+    mOpenTime(0),
+    mAccurateSeek(false),
+    mSeekTarget(-1),
+    mSeekStartTime(0),
+    mTrickSpeed(0),
+    mTrickActive(false),
+    mTrickFramesShown(0),
+    mPlaybackRate(1),
+    mLiveLatencyTarget(0),
+    mLiveLatency(-1),
+    mCatchUpRate(1),
+    mCatchUpSpeedUps(0),
+    mCatchUpJumps(0),
+    mVideoStartTime(AV_NOPTS_VALUE),
+    mAudioStartTime(AV_NOPTS_VALUE),
+    mVideoCodec(nullptr),
+    mAudioCodec(nullptr),
+    mVideoSwitching(false),
+    mAudioSwitching(false),
+    mAudioStretching(false),
+    mVideoDecodeFrame(av_frame_alloc()),
+    mAudioDecodeFrame(av_frame_alloc()),
+    mVideoRenderFrame(nullptr),
+    mAudioRenderFrame(nullptr),
+    mVideoRenderWakeTime(0),
+    mAudioRenderWakeTime(0),
+    mAudioRenderPaused(false),
+    mRenderBaseTime(0),
+    mRenderTimeCount(0),
+    mRenderFrameCount(0),
+    mRenderItemStart(0),
+    mLastPresentTime(0),
+    mLastFrameDuration(0),
+    mVideoDecodeStage("videoDecodeThread", mVideoDecodeEvent, mMetrics, PipelineMetrics::VideoDecodeThread,
+                      [this] { return videoDecodeStep(); }),
+    mAudioDecodeStage("audioDecodeThread", mAudioDecodeEvent, mMetrics, PipelineMetrics::AudioDecodeThread,
+                      [this] { return audioDecodeStep(); }),
+    mVideoRenderStage("videoRenderThread", mVideoRenderEvent, mMetrics, PipelineMetrics::VideoRenderThread,
+                      [this] { return videoRenderStep(); }),
+    mAudioRenderStage("audioRenderThread", mAudioRenderEvent, mMetrics, PipelineMetrics::AudioRenderThread,
+                      [this] { return audioRenderStep(); })
 {
     qDebug() << __FUNCTION__;
+    mVideoPacketQueue.setEvents(&mVideoDecodeEvent, &mReadEvent);
+    mAudioPacketQueue.setEvents(&mAudioDecodeEvent, &mReadEvent);
+    mVideoFrameQueue.setEvents(&mVideoRenderEvent, &mVideoDecodeEvent);
+    mAudioFrameQueue.setEvents(&mAudioRenderEvent, &mAudioDecodeEvent);
+    mVideoFramePool = std::make_shared<AVFramePool>();
+    mAudioFramePool = std::make_shared<AVFramePool>();
+    mVideoFrameQueue.setPool(mVideoFramePool);
+    mAudioFrameQueue.setPool(mAudioFramePool);
+    mVideoTimeBase = mAudioTimeBase = MicrosecondTimeBase;
+    //only the item after the current one is worth holding open
+    mPlaylistPrefetcher.setMaxInputs(1);
 }
 
 MiniPlayer::~MiniPlayer()
 {
     qDebug() << __FUNCTION__;
 
-    mAbort = true;
+    setAbort(true);
     clearCommand();
 
     if(mOpenThread.joinable())
@@ -48,22 +166,18 @@ MiniPlayer::~MiniPlayer()
         mStopThread.join();
     if(mReadPacketThread.joinable())
         mReadPacketThread.join();
-    if(mVideoDecodeThread.joinable())
-        mVideoDecodeThread.join();
-    if(mAudioDecodeThread.joinable())
-        mAudioDecodeThread.join();
-    if(mVideoRenderThread.joinable())
-        mVideoRenderThread.join();
-    if(mAudioRenderThread.joinable())
-        mAudioRenderThread.join();
-
-    if(mFormatContext) {
-        avcodec_close(mVideoStream->codec);
-        avcodec_close(mAudioStream->codec);
-        avformat_close_input(&mFormatContext);
-        mVideoStream = nullptr;
-        mAudioStream = nullptr;
-    }
+    if(mTimeshiftThread.joinable())
+        mTimeshiftThread.join();
+    if(mVideoDecodeStage.joinable())
+        mVideoDecodeStage.join();
+    if(mAudioDecodeStage.joinable())
+        mAudioDecodeStage.join();
+    if(mVideoRenderStage.joinable())
+        mVideoRenderStage.join();
+    if(mAudioRenderStage.joinable())
+        mAudioRenderStage.join();
+
+    closeInput();
 
     mVideoPacketQueue.clear();
     mAudioPacketQueue.clear();
@@ -75,6 +189,224 @@ MiniPlayer::~MiniPlayer()
         mAudioInited = false;
         mAudioOutput->close();
     }
+
+    av_frame_free(&mVideoDecodeFrame);
+    av_frame_free(&mAudioDecodeFrame);
+}
+
+//everything the open set up for the input, also after an open that failed half way
+void MiniPlayer::closeInput()
+{
+    if(mVideoStream)
+        avcodec_close(mVideoStream->codec);
+    if(mAudioStream)
+        avcodec_close(mAudioStream->codec);
+    if(mFormatContext)
+        avformat_close_input(&mFormatContext);
+    closeRetiredInput();
+    mPrefetchedInput.reset();
+    closeReadAhead();
+    closeTimeshift();
+    stopRecording();
+    mVideoStream = nullptr;
+    mAudioStream = nullptr;
+}
+
+void MiniPlayer::closeReadAhead()
+{
+    //dump() may be reading it, the I/O thread is joined outside the lock
+    std::unique_ptr<ReadAheadIO> readAhead;
+    {
+        std::lock_guard<std::mutex> l(mReadAheadMutex);
+        readAhead.swap(mReadAhead);
+    }
+}
+
+void MiniPlayer::closeTimeshift()
+{
+    std::unique_ptr<TimeshiftStore> timeshift;
+    {
+        std::lock_guard<std::mutex> l(mTimeshiftMutex);
+        timeshift.swap(mTimeshift);
+        mTimeshifting = false;
+    }
+}
+
+//the previous playlist item, once neither decoder holds its codec any more
+void MiniPlayer::closeRetiredInput()
+{
+    if(!mRetiredFormatContext)
+        return;
+    avcodec_close(mRetiredVideoStream->codec);
+    avcodec_close(mRetiredAudioStream->codec);
+    avformat_close_input(&mRetiredFormatContext);
+    mRetiredInput.reset();
+    //only the input open() started with reads through the ring
+    closeReadAhead();
+    mRetiredVideoStream = nullptr;
+    mRetiredAudioStream = nullptr;
+}
+
+void MiniPlayer::prefetchNextItem()
+{
+    std::vector<std::string> next;
+    {
+        std::lock_guard<std::mutex> l(mPlaylistMutex);
+        if(!mPlaylist.empty())
+            next.push_back(mPlaylist.front());
+    }
+    mPlaylistPrefetcher.prefetch(next);
+}
+
+bool MiniPlayer::hasNextItem() const
+{
+    std::lock_guard<std::mutex> l(mPlaylistMutex);
+    return !mPlaylist.empty();
+}
+
+//read thread: opens a playlist item, nullptr when it cannot be played. Only a stop interrupts the open, seeks
+//are meant for the item still playing
+std::unique_ptr<PrefetchedInput> MiniPlayer::openItem(const std::string & path, AVStream *& videoStream, AVStream *& audioStream)
+{
+    std::unique_ptr<PrefetchedInput> input = mPlaylistPrefetcher.take(path);
+    if(!input)
+    {
+        //not probed in time, opened here while the decoders still work through the current input
+        qDebug() << __FUNCTION__ << "not prefetched, opening";
+        input.reset(new PrefetchedInput());
+        input->interrupt.opaque = (void *)this;
+        input->interrupt.callback = &MiniPlayer::onAbortCallback;
+        input->formatContext = avformat_alloc_context();
+        input->formatContext->interrupt_callback.opaque = (void *)input.get();
+        input->formatContext->interrupt_callback.callback = &PrefetchedInput::onInterruptCallback;
+        int ret = avformat_open_input(&input->formatContext, path.c_str(), NULL, NULL);
+        if(ret >= 0)
+            ret = avformat_find_stream_info(input->formatContext, NULL);
+        if(ret < 0)
+        {
+            qWarning() << __FUNCTION__ << "open" << "failure" << path.c_str() << ret;
+            return nullptr;
+        }
+    }
+
+    AVFormatContext * formatContext = input->formatContext;
+    videoStream = nullptr;
+    audioStream = nullptr;
+    for (uint i = 0; i < formatContext->nb_streams; i++)
+    {
+        auto codecType = formatContext->streams[i]->codec->codec_type;
+        if (codecType == AVMediaType::AVMEDIA_TYPE_VIDEO && !videoStream)
+            videoStream = formatContext->streams[i];
+        else if(codecType == AVMediaType::AVMEDIA_TYPE_AUDIO && !audioStream)
+            audioStream = formatContext->streams[i];
+    }
+    if(!videoStream || !audioStream)
+    {
+        qWarning() << __FUNCTION__ << "no video or audio stream" << path.c_str();
+        return nullptr;
+    }
+
+    AVCodec * videoCodec = avcodec_find_decoder(videoStream->codec->codec_id);
+    AVCodec * audioCodec = avcodec_find_decoder(audioStream->codec->codec_id);
+    videoStream->codec->thread_count = decoderThreadCount();
+    videoStream->codec->thread_type = decoderThreadType();
+    if(!videoCodec || !audioCodec ||
+       avcodec_open2(videoStream->codec, videoCodec, NULL) < 0 || avcodec_open2(audioStream->codec, audioCodec, NULL) < 0)
+    {
+        qWarning() << __FUNCTION__ << "avcodec_open2" << "failure" << path.c_str();
+        avcodec_close(videoStream->codec);
+        avcodec_close(audioStream->codec);
+        return nullptr;
+    }
+
+    //from here on the input is the player's, a seek interrupts it like any other
+    input->interrupt.opaque = (void *)this;
+    input->interrupt.callback = &MiniPlayer::onInterruptCallback;
+    return input;
+}
+
+//read thread: the current input ended, reading goes on with the next playlist item right behind it; false when
+//there is none or none can be opened. The decoders finish the current input and take the next codecs over
+//at the switch marker, the current input is retired until then
+bool MiniPlayer::switchInput()
+{
+    //items that cannot be opened are skipped, each one at most once
+    size_t attempts = 0;
+    {
+        std::lock_guard<std::mutex> l(mPlaylistMutex);
+        attempts = mPlaylist.size();
+    }
+    std::string path;
+    std::string loopPath = mItemPath;
+    std::unique_ptr<PrefetchedInput> input;
+    AVStream * videoStream = nullptr;
+    AVStream * audioStream = nullptr;
+    for(; !input && attempts > 0 && !mAbort; attempts --)
+    {
+        {
+            std::lock_guard<std::mutex> l(mPlaylistMutex);
+            if(mPlaylist.empty())
+                return false;
+            path = mPlaylist.front();
+            mPlaylist.pop_front();
+            if(mPlaylistLoop)
+                mPlaylist.push_back(loopPath);
+        }
+        qDebug() << __FUNCTION__ << path.c_str();
+        input = openItem(path, videoStream, audioStream);
+        prefetchNextItem();
+        loopPath = path;
+    }
+    if(!input)
+        return false;
+    AVFormatContext * formatContext = input->formatContext;
+
+    //audio plays on sample by sample, the next item starts where it ends
+    double itemStart = mAudioQueuedEnd > 0 ? mAudioQueuedEnd : std::max(mVideoQueuedEnd, 0.0);
+
+    //set before the markers go in, a flush coming first switches the decoders right away
+    mNextVideoCodec = videoStream->codec;
+    mNextAudioCodec = audioStream->codec;
+    //seeks that came in meanwhile are dropped (takeSeek), the markers always go in
+    while(!mVideoPacketQueue.appendSwitchPacket() && !mAbort)
+        mReadEvent.waitFor(MaxWaitTime, [&] { return mAbort || !mVideoPacketQueue.isFull(); });
+    while(!mAudioPacketQueue.appendSwitchPacket() && !mAbort)
+        mReadEvent.waitFor(MaxWaitTime, [&] { return mAbort || !mAudioPacketQueue.isFull(); });
+
+    stopRecording();
+    mRetiredFormatContext = mFormatContext;
+    mRetiredVideoStream = mVideoStream;
+    mRetiredAudioStream = mAudioStream;
+    mRetiredInput = std::move(mPrefetchedInput);
+    mFormatContext = formatContext;
+    input->formatContext = nullptr;
+    mPrefetchedInput = std::move(input);
+    mVideoStream = videoStream;
+    mAudioStream = audioStream;
+    mVideoWidth = videoStream->codec->width;
+    mVideoHeight = videoStream->codec->height;
+    mItemPath = path;
+    mKeyframeIndex.clear();
+    mSeekable = formatContext->duration >= 0 && formatContext->pb && (formatContext->pb->seekable & AVIO_SEEKABLE_NORMAL);
+    mRebasing = true;
+    mItemStart = itemStart;
+    {
+        std::lock_guard<std::mutex> l(mPendingItemsMutex);
+        double duration = formatContext->duration >= 0 ? (double)formatContext->duration / AV_TIME_BASE : -1;
+        mPendingItems.push_back(PlaylistItem{ itemStart, duration });
+        mItemsPending = true;
+    }
+    qDebug() << __FUNCTION__ << "item start:" << itemStart << "prefetched GOP:" << mPrefetchedInput->packets.size();
+
+    //the standby's GOP goes first
+    for(auto & packet : mPrefetchedInput->packets)
+    {
+        onPacketRead(*packet);
+        queuePacket(*packet);
+        av_packet_free(&packet);
+    }
+    mPrefetchedInput->packets.clear();
+    return true;
 }
 
 static void onFFmpegLogCallback(void* ctx, int level,const char* fmt, va_list vl)
@@ -105,18 +437,20 @@ void MiniPlayer::stopThread()
 {
     qDebug() << __FUNCTION__ << "start";
 
-    mAbort = true;
+    setAbort(true);
 
     if(mReadPacketThread.joinable())
         mReadPacketThread.join();
-    if(mVideoDecodeThread.joinable())
-        mVideoDecodeThread.join();
-    if(mAudioDecodeThread.joinable())
-        mAudioDecodeThread.join();
-    if(mVideoRenderThread.joinable())
-        mVideoRenderThread.join();
-    if(mAudioRenderThread.joinable())
-        mAudioRenderThread.join();
+    if(mTimeshiftThread.joinable())
+        mTimeshiftThread.join();
+    if(mVideoDecodeStage.joinable())
+        mVideoDecodeStage.join();
+    if(mAudioDecodeStage.joinable())
+        mAudioDecodeStage.join();
+    if(mVideoRenderStage.joinable())
+        mVideoRenderStage.join();
+    if(mAudioRenderStage.joinable())
+        mAudioRenderStage.join();
 
     std::unique_ptr<int, std::function<void (int *)>> scope((int *)1, [&](void*)
     {
@@ -125,14 +459,7 @@ void MiniPlayer::stopThread()
         onCommandFinished();
     });
 
-    if(mFormatContext)
-    {
-        avcodec_close(mVideoStream->codec);
-        avcodec_close(mAudioStream->codec);
-        avformat_close_input(&mFormatContext);
-        mVideoStream = nullptr;
-        mAudioStream = nullptr;
-    }
+    closeInput();
 
     mVideoPacketQueue.clear();
     mAudioPacketQueue.clear();
@@ -150,6 +477,10 @@ void MiniPlayer::stopThread()
     mPosition = mDuration = -1;
     mSeekable = false;
     mSeekToPosition = -1;
+    mSeekPreview = false;
+    mReadSeekSerial = mSeekSerial.load();
+    mTrickSpeed = 0;
+    mTrickActive = false;
     mSynced = false;
     mTotalBytes = 0;
     mDownloadSpeed = 0;
@@ -163,31 +494,27 @@ void MiniPlayer::openThread()
 {
     qDebug() << __FUNCTION__ << "start";
 
-    mAbort = true;
+    setAbort(true);
     if(mReadPacketThread.joinable())
         mReadPacketThread.join();
-    if(mVideoDecodeThread.joinable())
-        mVideoDecodeThread.join();
-    if(mAudioDecodeThread.joinable())
-        mAudioDecodeThread.join();
-    if(mVideoRenderThread.joinable())
-        mVideoRenderThread.join();
-    if(mAudioRenderThread.joinable())
-        mAudioRenderThread.join();
-
-    if(mFormatContext) {
-        avcodec_close(mVideoStream->codec);
-        avcodec_close(mAudioStream->codec);
-        avformat_close_input(&mFormatContext);
-        mVideoStream = nullptr;
-        mAudioStream = nullptr;
-    }
+    if(mTimeshiftThread.joinable())
+        mTimeshiftThread.join();
+    if(mVideoDecodeStage.joinable())
+        mVideoDecodeStage.join();
+    if(mAudioDecodeStage.joinable())
+        mAudioDecodeStage.join();
+    if(mVideoRenderStage.joinable())
+        mVideoRenderStage.join();
+    if(mAudioRenderStage.joinable())
+        mAudioRenderStage.join();
+
+    closeInput();
     mVideoPacketQueue.clear();
     mAudioPacketQueue.clear();
     mVideoFrameQueue.clear();
     mAudioFrameQueue.clear();
 
-    mAbort = false;
+    setAbort(false);
     if(mAudioInited)
     {
         mAudioInited = false;
@@ -197,11 +524,57 @@ void MiniPlayer::openThread()
     mPosition = mDuration = -1;
     mSeekable = false;
     mSeekToPosition = -1;
+    mSeekPreview = false;
+    mReadSeekSerial = mSeekSerial.load();
     mTotalBytes = 0;
     mDownloadSpeed = 0;
     mFps = 0;
     mSynced = false;
     mEndReached = false;
+    mVideoDrained = false;
+    mAudioDrained = false;
+    mVideoReceivePending = false;
+    mAudioReceivePending = false;
+    mVideoSkipUntil = -1;
+    mAudioSkipUntil = -1;
+    mSeekTarget = -1;
+    mSeekStartTime = 0;
+    mKeyframeIndex.clear();
+    mVideoDecoderThreads = 0;
+    mVideoDecoderThreadType = 0;
+    mRenderBaseTime = av_gettime_relative();
+    mRenderTimeCount = 0;
+    mRenderFrameCount = 0;
+    mVideoRenderWakeTime = 0;
+    mAudioRenderWakeTime = 0;
+    mAudioRenderPaused = false;
+    mAudioStretching = false;
+    mLiveLatency = -1;
+    mCatchUpRate = 1;
+    mCatchUpSpeedUps = 0;
+    mCatchUpJumps = 0;
+    mVideoCodec = mAudioCodec = nullptr;
+    mNextVideoCodec = nullptr;
+    mNextAudioCodec = nullptr;
+    mVideoSwitching = mAudioSwitching = false;
+    mItemPath = mMediaPath;
+    mRebasing = false;
+    mVideoQueuedEnd = mAudioQueuedEnd = 0;
+    mItemStart = 0;
+    {
+        std::lock_guard<std::mutex> l(mPendingItemsMutex);
+        mPendingItems.clear();
+        mItemsPending = false;
+    }
+    mItemSwitches = 0;
+    mItemSwitchGap = 0;
+    mRenderItemStart = 0;
+    mLastPresentTime = 0;
+    mLastFrameDuration = 0;
+    mVideoFramePool->reserve(mMaxFrameQueueSize + FramePoolSlack);
+    mAudioFramePool->reserve(mMaxFrameQueueSize + FramePoolSlack);
+    mMetrics.reset();
+    mMetrics.beginStartup(mOpenTime);
     setBuffering(true);
     //-----------------------------------------------
     bool success = false;
@@ -210,31 +583,86 @@ void MiniPlayer::openThread()
         if(!success)
         {
             qWarning() << __FUNCTION__ << "failure";
+            //no thread was started yet, a half open input goes right away instead of with the next open
+            closeInput();
             changeState(-1, State::Stopped);
             setBuffering(false);
-            mAbort = true;
+            setAbort(true);
         }
         onCommandFinished();
     });
 
-    mFormatContext = avformat_alloc_context();
-    //mFormatContext->flags |= AVFMT_FLAG_GENPTS;
-    mFormatContext->interrupt_callback.opaque = (void *)this;
-    mFormatContext->interrupt_callback.callback = &MiniPlayer::onInterruptCallback;
+    InputPrefetcher * prefetcher = mPrefetcher;
+    if(prefetcher)
+        mPrefetchedInput = prefetcher->take(mMediaPath);
+    mWarmStart = mPrefetchedInput != nullptr;
+    mStreamInfoCached = false;
+    mStartBufferDuration = mWarmStart ? 0 : -1;
 
-    int ret = avformat_open_input(&mFormatContext, mMediaPath.c_str(), NULL, NULL);
-    if (ret < 0)
+    int ret = 0;
+    if(mWarmStart)
     {
-        qWarning() << __FUNCTION__ << "avformat_open_input" << "failure";
-        return;
+        //already opened and probed by the standby, only the interrupt callback changes hands
+        qDebug() << __FUNCTION__ << "warm start";
+        mFormatContext = mPrefetchedInput->formatContext;
+        mPrefetchedInput->formatContext = nullptr;
+        mPrefetchedInput->interrupt.opaque = (void *)this;
+        mPrefetchedInput->interrupt.callback = &MiniPlayer::onInterruptCallback;
+        mMetrics.markStartup(PipelineMetrics::OpenInput);
     }
-
-    ret = avformat_find_stream_info(mFormatContext, NULL);
-    if(ret < 0)
+    else
     {
-        qWarning() << __FUNCTION__ << "avformat_find_stream_info" << "failure";
-        return;
+        mFormatContext = avformat_alloc_context();
+        //mFormatContext->flags |= AVFMT_FLAG_GENPTS;
+        mFormatContext->interrupt_callback.opaque = (void *)this;
+        mFormatContext->interrupt_callback.callback = &MiniPlayer::onInterruptCallback;
+
+        //network I/O on its own thread, the demuxer reads from the ring it fills
+        int64_t readAheadSize = mReadAheadSize;
+        if(readAheadSize > 0)
+        {
+            std::unique_ptr<ReadAheadIO> readAhead(new ReadAheadIO(readAheadSize, mReadAheadConnections));
+            if(readAhead->open(mMediaPath, mFormatContext->interrupt_callback))
+            {
+                mFormatContext->pb = readAhead->context();
+                std::lock_guard<std::mutex> l(mReadAheadMutex);
+                mReadAhead = std::move(readAhead);
+            }
+            else
+                qWarning() << __FUNCTION__ << "read-ahead not available, reading directly";
+        }
+
+        AVDictionary * options = nullptr;
+        if(mFastOpen)
+        {
+            av_dict_set_int(&options, "probesize", FastOpenProbeSize, 0);
+            av_dict_set_int(&options, "analyzeduration", FastOpenAnalyzeDuration, 0);
+        }
+        ret = avformat_open_input(&mFormatContext, mMediaPath.c_str(), NULL, &options);
+        av_dict_free(&options);
+        if (ret < 0)
+        {
+            qWarning() << __FUNCTION__ << "avformat_open_input" << "failure";
+            return;
+        }
+        mMetrics.markStartup(PipelineMetrics::OpenInput);
+
+        //a channel seen before needs no probing, its decoder parameters come from the cache
+        mStreamInfoCached = mFastOpen && StreamInfoCache::shared()->apply(mMediaPath, mFormatContext);
+        if(!mStreamInfoCached)
+        {
+            ret = avformat_find_stream_info(mFormatContext, NULL);
+            if(ret < 0)
+            {
+                qWarning() << __FUNCTION__ << "avformat_find_stream_info" << "failure";
+                return;
+            }
+            if(mFastOpen)
+                StreamInfoCache::shared()->store(mMediaPath, mFormatContext);
+        }
+        qDebug() << __FUNCTION__ << "stream info cached:" << mStreamInfoCached;
     }
+    mMetrics.markStartup(PipelineMetrics::FindStreamInfo);
 
     if(mFormatContext->duration >= 0)
     {
@@ -244,6 +672,7 @@ void MiniPlayer::openThread()
         if(mFormatContext->pb->seekable & AVIO_SEEKABLE_NORMAL)
             mSeekable = true;
     }
+    mBufferPolicy.reset(!mSeekable, mFormatContext->bit_rate);
 
     mVideoStream = mAudioStream = nullptr;
     for (uint i = 0; i < mFormatContext->nb_streams; i++)
@@ -256,6 +685,8 @@ void MiniPlayer::openThread()
             mVideoStream = mFormatContext->streams[i];
             mVideoWidth = mVideoStream->codec->width;
             mVideoHeight = mVideoStream->codec->height;
+            mVideoTimeBase = mVideoStream->time_base;
+            mVideoStartTime = mVideoStream->start_time;
             auto timeBase = av_q2d(mVideoStream->time_base);
             mVideoPacketQueue.setTimeBase(timeBase);
             mVideoFrameQueue.setTimeBase(timeBase);
@@ -266,6 +697,8 @@ void MiniPlayer::openThread()
             if(mAudioStream)
                 continue;
             mAudioStream = mFormatContext->streams[i];
+            mAudioTimeBase = mAudioStream->time_base;
+            mAudioStartTime = mAudioStream->start_time;
             auto timeBase = av_q2d(mAudioStream->time_base);
             mAudioPacketQueue.setTimeBase(timeBase);
             mAudioFrameQueue.setTimeBase(timeBase);
@@ -279,12 +712,18 @@ void MiniPlayer::openThread()
         return;
     }
 
+   mVideoStream->codec->thread_count = decoderThreadCount();
+   mVideoStream->codec->thread_type = decoderThreadType();
    ret = avcodec_open2(mVideoStream->codec,codec,NULL);
    if(ret < 0)
    {
        qWarning() << __FUNCTION__ << "avcodec_open2 for video" << "failure";
        return;
    }
+   mVideoDecoderThreads = mVideoStream->codec->thread_count;
+   mVideoDecoderThreadType = mVideoStream->codec->active_thread_type;
+   qDebug() << __FUNCTION__ << "video decoder threads:" << mVideoDecoderThreads
+            << ", active thread type:" << mVideoDecoderThreadType;
 
    codec = avcodec_find_decoder(mAudioStream->codec->codec_id);
    if (!codec)
@@ -300,14 +739,48 @@ void MiniPlayer::openThread()
        return;
    }
 
+   mVideoCodec = mVideoStream->codec;
+   mAudioCodec = mAudioStream->codec;
+   mMetrics.markStartup(PipelineMetrics::CodecOpen);
    qDebug() << __FUNCTION__ << "duration:" << static_cast<double_t>(mFormatContext->duration) / AV_TIME_BASE;
 
+   //the standby's GOP goes first, the read thread continues right behind it
+   if(mPrefetchedInput)
+   {
+       for(auto & packet : mPrefetchedInput->packets)
+       {
+           onPacketRead(*packet);
+           queuePacket(*packet);
+           av_packet_free(&packet);
+       }
+       mPrefetchedInput->packets.clear();
+   }
+
+   //live inputs are recorded by a thread of their own, playback reads the recording back
+   std::string timeshiftPath = getTimeshiftPath();
+   if(!mSeekable && !timeshiftPath.empty())
+   {
+       std::unique_ptr<TimeshiftStore> timeshift(new TimeshiftStore());
+       if(timeshift->open(timeshiftPath, mTimeshiftBudget))
+       {
+           std::lock_guard<std::mutex> l(mTimeshiftMutex);
+           mTimeshift = std::move(timeshift);
+           mTimeshifting = true;
+       }
+       else
+           qWarning() << __FUNCTION__ << "timeshift not available, playing live only";
+   }
+
    changeState(-1, State::Playing);
+   if(mTimeshifting)
+       mTimeshiftThread = std::thread(&MiniPlayer::timeshiftThread,this);
    mReadPacketThread = std::thread(&MiniPlayer::readPacketThread,this);
-   mVideoDecodeThread = std::thread(&MiniPlayer::videoDecodeThread,this);
-   mAudioDecodeThread = std::thread(&MiniPlayer::audioDecodeThread,this);
-   mVideoRenderThread = std::thread(&MiniPlayer::videoRenderThread,this);
-   mAudioRenderThread = std::thread(&MiniPlayer::audioRenderThread,this);
+   //with an executor only the read thread (blocking I/O) stays dedicated
+   Executor * executor = mExecutor;
+   mVideoDecodeStage.start(executor, &mExecutorGroup);
+   mAudioDecodeStage.start(executor, &mExecutorGroup);
+   mVideoRenderStage.start(executor, &mExecutorGroup);
+   mAudioRenderStage.start(executor, &mExecutorGroup);
    success = true;
    qDebug() << __FUNCTION__ << "end";
 }
@@ -315,74 +788,266 @@ void MiniPlayer::openThread()
 void MiniPlayer::readPacketThread()
 {
     qDebug() << __FUNCTION__ << "start";
+    ThreadCpuTimer cpuTimer(mMetrics, PipelineMetrics::ReadThread);
 
     AVPacket packet = { 0 };
     bool eof = false;
     bool feof = false;
+    bool videoDrainQueued = false;
+    bool audioDrainQueued = false;
+    bool previewing = false;
+    bool previewShown = false;
+    int trickSpeed = 0;
+    double trickBase = 0;           //content position at trickBaseTime
+    int64_t trickBaseTime = 0;
+    double trickLast = 0;           //keyframe queued last
+    int64_t trickStepTime = 0;
+    uint64_t trickExpected = 0;     //mTrickFramesShown once the last keyframe is on screen
+    bool catchUpKeyframe = false;   //live catch-up dropped the buffer, waiting for a video keyframe
 
     for(; !mAbort; )
     {
+        if(mRetiredFormatContext && !mNextVideoCodec && !mNextAudioCodec)
+            closeRetiredInput();
+
         //seek begin ------------------------------------------
-        if(mSeekable && mSeekToPosition >= 0)
+        double seekToPosition = -1;
+        bool preview = false;
+        uint64_t seekSerial = 0;
+        if(takeSeek(seekToPosition, preview, seekSerial))
         {
-            qDebug() << __FUNCTION__ << "seek start";
+            qDebug() << __FUNCTION__ << "seek start" << seekToPosition << preview;
             setBuffering(true);
-            mVideoPacketQueue.clear();
-            mAudioPacketQueue.clear();
-            mVideoFrameQueue.clear();
-            mAudioFrameQueue.clear();
-            mVideoPacketQueue.appendFlushPacket();
-            mAudioPacketQueue.appendFlushPacket();
+            previewing = preview;
+            previewShown = false;
+            //the decoders pick the target up together with the flush packet
+            mSeekTarget = mAccurateSeek && !preview ? seekToPosition + mItemStart : -1;
+            //the decode threads drop the stale packets and flush their frame queues
+            flushPacketQueues();
+            //a recording of the input skips the jump, the timeshift thread records what it reads live
+            if(!mTimeshifting)
+                mRecorder.discontinuity();
             mAudioOutput->stop();
             mSynced = false;
             eof = false;
             feof = false;
+            videoDrainQueued = false;
+            audioDrainQueued = false;
             clearClock();
+            mStartBufferDuration = std::min(mBufferPolicy.startThreshold(), SeekBufferDuration);
 
-            auto seekToPosition = mSeekToPosition;
-            mPosition = seekToPosition;
+            if(mTimeshifting)
+            {
+                //inside the recording, the input itself keeps going
+                if(!mTimeshift->seek(seekToPosition))
+                    qWarning() << __FUNCTION__ << "timeshift seek" << "failure";
+            }
+            else
+            {
+                //an interrupted read or seek leaves the I/O context flagged, the seek starts over anyway
+                if(mFormatContext->pb)
+                {
+                    mFormatContext->pb->eof_reached = 0;
+                    mFormatContext->pb->error = 0;
+                }
 
-            int seekFlags = 0;
-            int64_t pos = seekToPosition * AV_TIME_BASE;
-            int ret = avformat_seek_file(mFormatContext, -1, INT64_MIN, pos, INT64_MAX, seekFlags);
-            if(ret < 0)
-                qWarning() << __FUNCTION__ << "avformat_seek_file" << "failure" << ret;
+                //a keyframe read before is one direct byte seek away, no timestamp search over the input
+                int ret = -1;
+                KeyframeIndex::Entry keyframe;
+                bool byteSeek = !(mFormatContext->iformat->flags & AVFMT_NO_BYTE_SEEK) &&
+                        mKeyframeIndex.lookup(seekToPosition, keyframe);
+                if(byteSeek)
+                {
+                    ret = av_seek_frame(mFormatContext, -1, keyframe.pos, AVSEEK_FLAG_BYTE);
+                    qDebug() << __FUNCTION__ << "byte seek" << keyframe.time << keyframe.pos << ret;
+                }
+                if(ret < 0)
+                {
+                    //accurate seeks need the keyframe before the target, not the nearest one
+                    int64_t startTime = mFormatContext->start_time != AV_NOPTS_VALUE ? mFormatContext->start_time : 0;
+                    int64_t pos = startTime + static_cast<int64_t>(seekToPosition * AV_TIME_BASE);
+                    ret = avformat_seek_file(mFormatContext, -1, INT64_MIN, pos, mSeekTarget >= 0 ? pos : INT64_MAX, 0);
+                    if(ret < 0)
+                        qWarning() << __FUNCTION__ << "avformat_seek_file" << "failure" << ret;
+                }
+                mKeyframeIndex.breakRun();
+            }
 
-            if(mSeekToPosition == seekToPosition)
+            if(trickSpeed != 0)
             {
-                mSeekToPosition = -1;
-                qDebug() << __FUNCTION__ << "seek complete";
+                trickBase = trickLast = seekToPosition;
+                trickBaseTime = av_gettime_relative();
+                trickStepTime = 0;
+                trickExpected = mTrickFramesShown;
             }
+            finishSeek(seekSerial);
+            qDebug() << __FUNCTION__ << "seek complete";
             continue;
         }
         //seek end --------------------------------------------
+
+        //trick play begin ------------------------------------
+        int requestedTrickSpeed = mSeekable ? mTrickSpeed.load() : 0;
+        if(requestedTrickSpeed != trickSpeed)
+        {
+            if(requestedTrickSpeed == 0)
+            {
+                //normal playback resumes at the last keyframe shown
+                qDebug() << __FUNCTION__ << "trick play end" << trickLast;
+                mVideoStream->discard = AVDISCARD_DEFAULT;
+                mAudioStream->discard = AVDISCARD_DEFAULT;
+                trickSpeed = 0;
+                mTrickActive = false;
+                seek(trickLast);
+                continue;
+            }
+            if(trickSpeed == 0)
+            {
+                qDebug() << __FUNCTION__ << "trick play start" << requestedTrickSpeed;
+                mSeekTarget = -1;
+                flushPacketQueues();
+                mAudioOutput->stop();
+                mSynced = false;
+                eof = false;
+                feof = false;
+                videoDrainQueued = false;
+                audioDrainQueued = false;
+                previewing = false;
+                clearClock();
+                trickLast = mPosition;
+                //demuxers that can skip packets by themselves do, audio stays muted
+                mVideoStream->discard = AVDISCARD_NONKEY;
+                mAudioStream->discard = AVDISCARD_ALL;
+                mTrickActive = true;
+            }
+            trickSpeed = requestedTrickSpeed;
+            trickBase = trickLast;
+            trickBaseTime = av_gettime_relative();
+            trickStepTime = 0;
+            trickExpected = mTrickFramesShown;
+        }
+
+        if(trickSpeed != 0)
+        {
+            setBuffering(false);
+            auto trickChanged = [&] { return mAbort || mSeekToPosition >= 0 || mTrickSpeed != trickSpeed; };
+
+            //one keyframe in flight, the next one is picked once it is on screen
+            int64_t now = av_gettime_relative();
+            if(mState == State::Paused)
+            {
+                //the content clock stands still while paused
+                trickBase = trickLast;
+                trickBaseTime = now;
+                mReadEvent.waitFor(MaxWaitTime, trickChanged);
+                continue;
+            }
+            if(mTrickFramesShown < trickExpected && now - trickStepTime < TrickFrameTimeout)
+            {
+                mReadEvent.waitFor(MaxWaitTime, [&] { return trickChanged() || mTrickFramesShown >= trickExpected; });
+                continue;
+            }
+            if(now - trickStepTime < TrickMinInterval)
+            {
+                mReadEvent.waitFor((TrickMinInterval - (now - trickStepTime)) / 1000 + 1, trickChanged);
+                continue;
+            }
+
+            //where the content would be at this speed, a keyframe is due once it moved past the last one
+            bool forward = trickSpeed > 0;
+            double target = trickBase + trickSpeed * (now - trickBaseTime) / 1000000.0;
+            if(forward ? target <= trickLast : target >= trickLast)
+            {
+                mReadEvent.waitFor(TrickMinInterval / 1000, trickChanged);
+                continue;
+            }
+
+            trickStepTime = now;
+            double keyframeTime = 0;
+            if(!queueTrickKeyframe(target, trickLast, forward, keyframeTime))
+            {
+                if(mAbort || mSeekToPosition >= 0)
+                    continue;
+                qDebug() << __FUNCTION__ << "trick play reached the" << (forward ? "end" : "start");
+                mTrickSpeed = 0;
+                continue;
+            }
+            trickLast = keyframeTime;
+            trickExpected = mTrickFramesShown + 1;
+            continue;
+        }
+        //trick play end --------------------------------------
+
+        //scrubbing: the first keyframe after the seek is decoded and shown, nothing else is read
+        if(previewing)
+        {
+            if(previewShown)
+            {
+                mReadEvent.waitFor(MaxWaitTime, [&] { return mAbort || mSeekToPosition >= 0; });
+                continue;
+            }
+            av_init_packet(&packet);
+            int ret = readPacket(packet);
+            if(ret < 0)
+            {
+                if(ret == AVERROR(EAGAIN))
+                    mReadEvent.waitFor(10, [&] { return mAbort || mSeekToPosition >= 0; });
+                else
+                    previewShown = true;
+                continue;
+            }
+            if(!mTimeshifting)
+                mTotalBytes += packet.size;
+            if(packet.stream_index == mVideoStream->index && (packet.flags & AV_PKT_FLAG_KEY))
+            {
+                //the drain gets the frame out of a frame threaded decoder right away
+                queuePacket(packet);
+                mVideoPacketQueue.appendDrainPacket();
+                previewShown = true;
+            }
+            av_packet_unref(&packet);
+            continue;
+        }
         int64_t packetBufferSize = mVideoPacketQueue.dataSize() + mAudioPacketQueue.dataSize();
 
-        if(packetBufferSize > mMaxPacketBufferSize || eof)
+        //the bitrate of what is queued stands in when the container does not tell
+        double queuedDuration = std::max(mVideoPacketQueue.duration(), mAudioPacketQueue.duration());
+        int64_t measuredBitrate = queuedDuration >= 1 ? static_cast<int64_t>(packetBufferSize * 8 / queuedDuration) : 0;
+        mBufferPolicy.update(mDownloadSpeed, measuredBitrate);
+        int64_t maxPacketBufferSize = mBufferPolicy.ceiling();
+
+        if(packetBufferSize > maxPacketBufferSize || eof ||
+                mVideoPacketQueue.isFull() || mAudioPacketQueue.isFull())
         {
             setBuffering(false);
+            if(eof)
+            {
+                //retried until the packet queues have room for the marker
+                if(!videoDrainQueued)
+                    videoDrainQueued = mVideoPacketQueue.appendDrainPacket();
+                if(!audioDrainQueued)
+                    audioDrainQueued = mAudioPacketQueue.appendDrainPacket();
+            }
+
+            bool drained = videoDrainQueued && audioDrainQueued && mVideoDrained && mAudioDrained;
             bool empty = mVideoPacketQueue.size() == 0 && mAudioPacketQueue.size() == 0 &&
                     mVideoFrameQueue.size() == 0 && mAudioFrameQueue.size() == 0;
 
-            if(empty && eof)
+            if(empty && eof && drained)
             {
-                mAbort = true;
-                if(mVideoDecodeThread.joinable())
-                    mVideoDecodeThread.join();
-                if(mAudioDecodeThread.joinable())
-                    mAudioDecodeThread.join();
-                if(mVideoRenderThread.joinable())
-                    mVideoRenderThread.join();
-                if(mAudioRenderThread.joinable())
-                    mAudioRenderThread.join();
-                if(mFormatContext) {
-                    avcodec_close(mVideoStream->codec);
-                    avcodec_close(mAudioStream->codec);
-                    avformat_close_input(&mFormatContext);
-                    mVideoStream = nullptr;
-                    mAudioStream = nullptr;
-                }
-                mAbort = false;
+                setAbort(true);
+                if(mVideoDecodeStage.joinable())
+                    mVideoDecodeStage.join();
+                if(mAudioDecodeStage.joinable())
+                    mAudioDecodeStage.join();
+                if(mVideoRenderStage.joinable())
+                    mVideoRenderStage.join();
+                if(mAudioRenderStage.joinable())
+                    mAudioRenderStage.join();
+                if(mTimeshiftThread.joinable())
+                    mTimeshiftThread.join();
+                closeInput();
+                setAbort(false);
                 if(mAudioInited)
                 {
                     mAudioInited = false;
@@ -391,33 +1056,79 @@ void MiniPlayer::readPacketThread()
                 clearClock();
                 mSeekable = false;
                 mSeekToPosition = -1;
+                mSeekPreview = false;
+                mTrickSpeed = 0;
+                mTrickActive = false;
                 mTotalBytes = 0;
                 mDownloadSpeed = 0;
                 mFps = 0;
                 mSynced = false;
                 setBuffering(false);
                 mEndReached = feof;
+                cpuTimer.update();
                 changeState(-1, State::Stopped);
                 break;
             }
 
-            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            mReadEvent.waitFor(MaxWaitTime, [&]
+            {
+                if(mAbort || mSeekToPosition >= 0)
+                    return true;
+                if(eof && !(videoDrainQueued && audioDrainQueued))
+                    return !mVideoPacketQueue.isFull() && !mAudioPacketQueue.isFull();
+                if(eof)
+                    return mVideoPacketQueue.size() == 0 && mAudioPacketQueue.size() == 0 &&
+                            mVideoFrameQueue.size() == 0 && mAudioFrameQueue.size() == 0 &&
+                            mVideoDrained && mAudioDrained;
+                return mVideoPacketQueue.dataSize() + mAudioPacketQueue.dataSize() <= maxPacketBufferSize &&
+                        !mVideoPacketQueue.isFull() && !mAudioPacketQueue.isFull();
+            });
             continue;
         }
 
-        if(!mBuffering && (mVideoPacketQueue.size() == 0 || mVideoFrameQueue.size() == 0))
+        //in free-run the renderers always drain the frame queue, that is not an underrun
+        if(!mBuffering && !mFreeRun && (mVideoPacketQueue.size() == 0 || mVideoFrameQueue.size() == 0))
+        {
+            mBufferPolicy.onRebuffer();
             setBuffering(true);
+        }
 
         av_init_packet(&packet);
-        int ret = av_read_frame(mFormatContext, &packet);
+        int64_t readStart = mMetrics.now();
+        int ret = readPacket(packet);
+        mMetrics.record(PipelineMetrics::DemuxRead, readStart);
         if (ret < 0)
         {
+            if(ret == AVERROR(EAGAIN) && mTimeshifting)
+            {
+                //caught up with the recording
+                mReadEvent.waitFor(MaxWaitTime, [&] { return mAbort || mSeekToPosition >= 0 || mTimeshift->readable(); });
+                continue;
+            }
             if(ret == AVERROR(EAGAIN))
             {
                 qWarning() << __FUNCTION__ << "av_read_frame" << "EAGAIN" << ret;
-                std::this_thread::sleep_for(std::chrono::milliseconds(200));
+                mReadEvent.waitFor(200, [&] { return mAbort || mSeekToPosition >= 0; });
                 continue;
             }
+            //interrupted for a newer seek, the input did not end
+            if(mSeekToPosition >= 0)
+                continue;
+            //the next playlist item follows right behind, through the same decoders and audio output
+            if(trickSpeed == 0 && !mTimeshifting && hasNextItem())
+            {
+                if(mRetiredFormatContext)
+                {
+                    //the decoders are still on the item before, one input is retired at a time
+                    mReadEvent.waitFor(MaxWaitTime, [&]
+                    {
+                        return mAbort || mSeekToPosition >= 0 || (!mNextVideoCodec && !mNextAudioCodec);
+                    });
+                    continue;
+                }
+                if(switchInput())
+                    continue;
+            }
             eof = true;
             //feof = ret == AVERROR_EOF || avio_feof(mFormatContext->pb);
             feof = ret == AVERROR_EOF;
@@ -425,357 +1136,980 @@ void MiniPlayer::readPacketThread()
             continue;
         }
 
-        mTotalBytes += packet.size;
+        //the timeshift thread accounted for it when it was read from the input
+        if(!mTimeshifting)
+            onPacketRead(packet);
 
-        if (packet.stream_index == mVideoStream->index)
-        {
-            av_dup_packet(&packet);
-            mVideoPacketQueue.append(packet);
-        }
-        else if (packet.stream_index == mAudioStream->index)
+        if(catchUpKeyframe)
         {
-            av_dup_packet(&packet);
-            mAudioPacketQueue.append(packet);
+            if(packet.stream_index != mVideoStream->index || !(packet.flags & AV_PKT_FLAG_KEY))
+            {
+                av_packet_unref(&packet);
+                continue;
+            }
+            catchUpKeyframe = false;
         }
 
+        //append() takes the packet's reference, whatever is left here was not queued
+        queuePacket(packet);
+        av_packet_unref(&packet);
+
         if(mBuffering)
         {
             auto bufferedDuration = mVideoPacketQueue.duration() + mVideoFrameQueue.duration();
-            if(bufferedDuration >= mMaxBufferDuration && mVideoFrameQueue.size() > 0)
+            auto startBufferDuration = mStartBufferDuration >= 0 ? mStartBufferDuration : mBufferPolicy.startThreshold();
+            if(bufferedDuration >= startBufferDuration && mVideoFrameQueue.size() > 0)
+            {
                 setBuffering(false);
+                mStartBufferDuration = -1;
+            }
+        }
+
+        //behind the recording's end by choice, nothing to catch up
+        if(mTimeshifting)
+        {
+            mLiveLatency = mPosition >= 0 ? std::max(mTimeshift->windowEnd() - mPosition, 0.0) : -1;
+            mCatchUpRate = 1;
+        }
+        //live latency: whatever is buffered is how far playback trails the live edge
+        else if(!mSeekable)
+        {
+            double latency = mVideoPacketQueue.duration() + mVideoFrameQueue.duration();
+            double latencyTarget = mLiveLatencyTarget;
+            mLiveLatency = latency;
+            double excess = latency - latencyTarget;
+            if(latencyTarget <= 0 || mBuffering)
+                mCatchUpRate = 1;
+            else if(excess > CatchUpJumpExcess)
+            {
+                //too far behind to play it off, start over at the next keyframe with the target buffered
+                qDebug() << __FUNCTION__ << "live latency" << latency << "jumping ahead";
+                mCatchUpJumps ++;
+                mCatchUpRate = 1;
+                mSeekTarget = -1;
+                flushPacketQueues();
+                mAudioOutput->stop();
+                mSynced = false;
+                clearClock();
+                catchUpKeyframe = true;
+                mStartBufferDuration = latencyTarget;
+                setBuffering(true);
+            }
+            else if(excess > (mCatchUpRate > 1 ? 0 : CatchUpBand))
+            {
+                if(mCatchUpRate == 1)
+                {
+                    qDebug() << __FUNCTION__ << "live latency" << latency << "catching up";
+                    mCatchUpSpeedUps ++;
+                }
+                mCatchUpRate = std::min(std::max(1 + excess * CatchUpGain, CatchUpMinRate), CatchUpMaxRate);
+            }
+            else
+                mCatchUpRate = 1;
         }
     }
 
     qDebug() << __FUNCTION__ << "end";
 }
 
-void MiniPlayer::videoDecodeThread()
+//the timeshift recording stands in for the input while there is one
+int MiniPlayer::readPacket(AVPacket & packet)
 {
-    qDebug() << __FUNCTION__ << "start";
-
-    AVPacket packet = {0}, packet2 = {0};
-    AVFrame * decodedFrame = av_frame_alloc();
+    if(mTimeshifting)
+        return mTimeshift->read(packet);
+    return av_read_frame(mFormatContext, &packet);
+}
 
-    auto freePacketFunc = [&](AVPacket * packet){ av_free_packet(packet); };
-    auto freeFrameFunc = [&](AVFrame * frame){ av_frame_free(&frame); };
+void MiniPlayer::onPacketRead(AVPacket & packet)
+{
+    mTotalBytes += packet.size;
+    mMetrics.count(PipelineMetrics::PacketsRead);
+    mMetrics.count(PipelineMetrics::BytesRead, packet.size);
+    mMetrics.markStartup(PipelineMetrics::FirstPacket);
+
+    //without probing nobody worked out the start time, the first timestamp read stands in for both streams
+    bool mediaPacket = packet.stream_index == mVideoStream->index || packet.stream_index == mAudioStream->index;
+    if(mediaPacket && packet.pts != AV_NOPTS_VALUE &&
+       (mVideoStream->start_time == AV_NOPTS_VALUE || mAudioStream->start_time == AV_NOPTS_VALUE))
+    {
+        auto timeBase = mFormatContext->streams[packet.stream_index]->time_base;
+        for(auto stream : { mVideoStream, mAudioStream })
+        {
+            if(stream->start_time == AV_NOPTS_VALUE)
+                stream->start_time = av_rescale_q(packet.pts, timeBase, stream->time_base);
+        }
+        //later playlist items are moved onto the first one's timeline
+        if(!mRebasing)
+        {
+            mVideoStartTime = mVideoStream->start_time;
+            mAudioStartTime = mAudioStream->start_time;
+        }
+    }
 
-    std::unique_ptr<AVFrame, decltype(freeFrameFunc)> freeFrame(decodedFrame, freeFrameFunc);
+    if(packet.stream_index == mVideoStream->index && (packet.flags & AV_PKT_FLAG_KEY) &&
+       packet.pos >= 0 && packet.pts != AV_NOPTS_VALUE)
+    {
+        int64_t startTime = mVideoStream->start_time != AV_NOPTS_VALUE ? mVideoStream->start_time : 0;
+        mKeyframeIndex.add(av_q2d(mVideoStream->time_base) * (packet.pts - startTime), packet.pos);
+    }
 
-    for(; !mAbort; )
+    //a recording starts here, this thread owns the input's streams
+    if(mRecordRequested)
     {
-        if(mVideoFrameQueue.size() > mMaxFrameQueueSize)
+        std::lock_guard<std::mutex> l(mRecordMutex);
+        if(mRecordRequested)
         {
-            std::this_thread::sleep_for(std::chrono::milliseconds(16));
-            continue;
+            mRecordRequested = false;
+            mRecorder.start(mRecordPath, mFormatContext, { mVideoStream->index, mAudioStream->index });
         }
+    }
+    mRecorder.push(packet);
+}
 
-        av_init_packet(&packet);
+//moves the packet onto the timeline (packets of the first input are on it already) and into its queue,
+//append() takes the packet's reference
+void MiniPlayer::queuePacket(AVPacket & packet)
+{
+    bool video = packet.stream_index == mVideoStream->index;
+    if(!video && packet.stream_index != mAudioStream->index)
+        return;
+    AVRational timeBase = video ? mVideoTimeBase : mAudioTimeBase;
+    int64_t origin = video ? mVideoStartTime : mAudioStartTime;
+    if(origin == AV_NOPTS_VALUE)
+        origin = 0;
+
+    if(mRebasing)
+    {
+        //both streams move by the same amount, whatever offset the input has between them stays
+        AVStream * stream = video ? mVideoStream : mAudioStream;
+        int64_t itemOrigin = 0;
+        if(mFormatContext->start_time != AV_NOPTS_VALUE)
+            itemOrigin = av_rescale_q(mFormatContext->start_time, MicrosecondTimeBase, stream->time_base);
+        else if(stream->start_time != AV_NOPTS_VALUE)
+            itemOrigin = stream->start_time;
+        int64_t offset = origin + static_cast<int64_t>(mItemStart / av_q2d(timeBase) + 0.5);
+        if(packet.pts != AV_NOPTS_VALUE)
+            packet.pts = av_rescale_q(packet.pts - itemOrigin, stream->time_base, timeBase) + offset;
+        if(packet.dts != AV_NOPTS_VALUE)
+            packet.dts = av_rescale_q(packet.dts - itemOrigin, stream->time_base, timeBase) + offset;
+        packet.duration = av_rescale_q(packet.duration, stream->time_base, timeBase);
+    }
+
+    int64_t pts = packet.pts != AV_NOPTS_VALUE ? packet.pts : packet.dts;
+    if(pts != AV_NOPTS_VALUE)
+    {
+        double & queuedEnd = video ? mVideoQueuedEnd : mAudioQueuedEnd;
+        queuedEnd = std::max(queuedEnd, av_q2d(timeBase) * (pts + packet.duration - origin));
+    }
+
+    if(video)
+        mVideoPacketQueue.append(packet);
+    else
+        mAudioPacketQueue.append(packet);
+}
 
-        bool ret = mVideoPacketQueue.acquire(packet);
-        if (!ret)
+//drops what is queued, the decoders flush once they get to the marker
+void MiniPlayer::flushPacketQueues()
+{
+    mVideoPacketQueue.appendFlushPacket();
+    mAudioPacketQueue.appendFlushPacket();
+    mVideoQueuedEnd = mAudioQueuedEnd = 0;
+}
+
+//records the live input into mTimeshift at its own pace, whatever playback is doing
+void MiniPlayer::timeshiftThread()
+{
+    qDebug() << __FUNCTION__ << "start";
+
+    TimeshiftStore * timeshift = mTimeshift.get();
+    AVPacket packet = { 0 };
+    for(; !mAbort; )
+    {
+        av_init_packet(&packet);
+        int ret = av_read_frame(mFormatContext, &packet);
+        if(ret < 0)
         {
-            std::this_thread::sleep_for(std::chrono::milliseconds(16));
-            continue;
+            if(ret == AVERROR(EAGAIN))
+            {
+                mReadEvent.waitFor(10, [&] { return mAbort.load(); });
+                continue;
+            }
+            if(mAbort)
+                break;
+            //playback goes on to the end of the recording
+            qWarning() << __FUNCTION__ << "av_read_frame" << ret;
+            timeshift->finish();
+            mReadEvent.notify();
+            break;
         }
 
-        if(mVideoPacketQueue.isFlushPacket(packet))
+        onPacketRead(packet);
+        bool video = packet.stream_index == mVideoStream->index;
+        if(video || packet.stream_index == mAudioStream->index)
         {
-            mVideoPacketQueue.clear();
-            mVideoFrameQueue.clear();
-            avcodec_flush_buffers(mVideoStream->codec);
-            continue;
+            AVStream * stream = mFormatContext->streams[packet.stream_index];
+            int64_t startTime = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+            int64_t pts = packet.pts != AV_NOPTS_VALUE ? packet.pts : packet.dts;
+            double time = pts != AV_NOPTS_VALUE ? av_q2d(stream->time_base) * (pts - startTime) : timeshift->windowEnd();
+            if(timeshift->append(packet, time, video && (packet.flags & AV_PKT_FLAG_KEY)))
+            {
+                mDuration = timeshift->windowEnd();
+                mReadEvent.notify();
+            }
         }
+        av_packet_unref(&packet);
+    }
 
-        std::unique_ptr<AVPacket, decltype(freePacketFunc)> freePacket(&packet, freePacketFunc);
+    qDebug() << __FUNCTION__ << "end";
+}
 
-        int gotFrame = 0;
+//trick play: queues the first video keyframe at or after target (forward) or the last one before last (rewind)
+//with a drain marker so it is decoded right away, false at either end of the input
+bool MiniPlayer::queueTrickKeyframe(double target, double last, bool forward, double & time)
+{
+    int64_t startTime = mVideoStream->start_time != AV_NOPTS_VALUE ? mVideoStream->start_time : 0;
+    double timeBase = av_q2d(mVideoStream->time_base);
 
-        packet2 = packet;
-        while (packet2.size > 0 && !mAbort)
+    //a little ahead it is cheaper to read on, the demuxer already drops what is not a keyframe
+    bool seekNeeded = !forward || target - last > TrickSeekDistance;
+    while(!mAbort && mSeekToPosition < 0)
+    {
+        if(seekNeeded)
         {
-            int ret = avcodec_decode_video2(mVideoStream->codec, decodedFrame, &gotFrame, &packet2);
-            if (ret < 0) {
-                qWarning() << __FUNCTION__ << "avcodec_decode_video2" << "failure" << ret;
-                break;
+            int ret = -1;
+            KeyframeIndex::Entry keyframe;
+            if(!(mFormatContext->iformat->flags & AVFMT_NO_BYTE_SEEK) && mKeyframeIndex.lookup(target, keyframe))
+                ret = av_seek_frame(mFormatContext, -1, keyframe.pos, AVSEEK_FLAG_BYTE);
+            if(ret < 0)
+            {
+                int64_t formatStartTime = mFormatContext->start_time != AV_NOPTS_VALUE ? mFormatContext->start_time : 0;
+                int64_t pos = formatStartTime + static_cast<int64_t>(target * AV_TIME_BASE);
+                ret = forward ? avformat_seek_file(mFormatContext, -1, pos, pos, INT64_MAX, 0) :
+                                avformat_seek_file(mFormatContext, -1, INT64_MIN, pos, pos, 0);
             }
+            mKeyframeIndex.breakRun();
+            if(ret < 0)
+                return false;
+            mRecorder.discontinuity();
+        }
 
-            if (gotFrame)
-                break;
-
-            packet2.size -= ret;
-            packet2.data += ret;
+        AVPacket packet = { 0 };
+        av_init_packet(&packet);
+        int ret = av_read_frame(mFormatContext, &packet);
+        if(ret < 0)
+        {
+            if(ret != AVERROR(EAGAIN))
+                return false;
+            seekNeeded = false;
+            mReadEvent.waitFor(10, [&] { return mAbort || mSeekToPosition >= 0; });
+            continue;
+        }
+        onPacketRead(packet);
 
-            if (packet2.size <= 0)
-                break;
+        if(packet.stream_index != mVideoStream->index || !(packet.flags & AV_PKT_FLAG_KEY) || packet.pts == AV_NOPTS_VALUE)
+        {
+            av_packet_unref(&packet);
+            seekNeeded = false;
+            continue;
         }
 
-        if (gotFrame && mSeekToPosition == -1)
+        time = timeBase * (packet.pts - startTime);
+        bool wanted = forward ? time >= target && time > last : time < last;
+        if(wanted)
         {
-            decodedFrame->pts = av_frame_get_best_effort_timestamp(decodedFrame);
-            mVideoFrameQueue.append(av_frame_clone(decodedFrame));
+            queuePacket(packet);
+            mVideoPacketQueue.appendDrainPacket();
         }
+        av_packet_unref(&packet);
+        if(wanted)
+            return true;
+        if(forward)
+        {
+            seekNeeded = false;
+            continue;
+        }
+
+        //rewinding landed on the last keyframe or after it, the target moves back until the start
+        if(target <= 0)
+            return false;
+        target = std::max(target - std::max(last - target, TrickSeekDistance), 0.0);
+        seekNeeded = true;
     }
+    return false;
+}
 
-    qDebug() << __FUNCTION__ << "end";
+//end of the frame in seconds from the timeline start, the playback position plus the item's start
+static double frameEnd(AVRational timeBase, int64_t startTime, const AVFrame * frame)
+{
+    if(startTime == AV_NOPTS_VALUE)
+        startTime = 0;
+    return av_q2d(timeBase) * (frame->pts + frame->pkt_duration - startTime);
 }
 
-void MiniPlayer::audioDecodeThread()
+int64_t MiniPlayer::videoDecodeStep()
 {
-    qDebug() << __FUNCTION__ << "start";
+    if(mAbort)
+    {
+        av_frame_unref(mVideoDecodeFrame);
+        return PipelineStage::Finished;
+    }
 
-    AVPacket packet = {0}, packet2 = {0};
-    AVFrame * decodedFrame = av_frame_alloc();
+    //frames left in the decoder go out before the next packet goes in
+    if(mVideoReceivePending && !mVideoPacketQueue.flushPending())
+        return receiveVideoFrames() ? PipelineStage::Continue : MaxWaitTime;
 
-    auto freePacketFunc = [&](AVPacket * packet){ av_free_packet(packet); };
-    auto freeFrameFunc = [&](AVFrame * frame){ av_frame_free(&frame); };
+    if(mVideoFrameQueue.size() > mMaxFrameQueueSize && !mVideoPacketQueue.flushPending())
+        return MaxWaitTime;
 
-    std::unique_ptr<AVFrame, decltype(freeFrameFunc)> freeFrame(decodedFrame, freeFrameFunc);
+    AVPacket * packet = nullptr;
+    int64_t enqueueTime = 0;
+    if(!mVideoPacketQueue.acquire(&packet, &enqueueTime))
+        return MaxWaitTime;
 
-    for(; !mAbort; )
+    //a switch marker flushed away with the packets around it, the next input's decoder takes over here
+    AVCodecContext * nextCodec = mVideoPacketQueue.isFlushPacket(packet) ? mNextVideoCodec.exchange(nullptr) : nullptr;
+    if(nextCodec)
+    {
+        mVideoCodec = nextCodec;
+        mVideoSwitching = false;
+        mReadEvent.notify();
+    }
+
+    AVCodecContext * codecContext = mVideoCodec;
+    if(mVideoPacketQueue.isFlushPacket(packet))
+    {
+        //also drops the frames held back by frame threading
+        mVideoFrameQueue.flush();
+        avcodec_flush_buffers(codecContext);
+        mVideoReceivePending = false;
+        mVideoDrained = false;
+        //frames before the target are decoded and dropped in queueVideoFrame
+        mVideoSkipUntil = mSeekTarget;
+        codecContext->skip_frame = AVDISCARD_DEFAULT;
+        return PipelineStage::Continue;
+    }
+
+    if(mVideoPacketQueue.isDrainPacket(packet) || mVideoPacketQueue.isSwitchPacket(packet))
     {
-        if(mAudioFrameQueue.size() > mMaxFrameQueueSize)
+        //frame threads and reordering keep frames until the decoder is told the stream ended
+        mVideoSwitching = mVideoPacketQueue.isSwitchPacket(packet);
+        avcodec_send_packet(codecContext, nullptr);
+        mVideoReceivePending = true;
+        receiveVideoFrames();
+        return PipelineStage::Continue;
+    }
+
+    auto recyclePacketFunc = [&](AVPacket * packet){ mVideoPacketQueue.recycle(packet); };
+    std::unique_ptr<AVPacket, decltype(recyclePacketFunc)> recyclePacket(packet, recyclePacketFunc);
+
+    mMetrics.record(PipelineMetrics::VideoPacketWait, enqueueTime);
+    int64_t decodeStart = mMetrics.now();
+
+    //only frames well before the target may go undecoded, the ones next to it can be non-reference frames
+    if(mVideoSkipUntil >= 0)
+    {
+        bool early = packet->pts != AV_NOPTS_VALUE && mVideoStartTime != AV_NOPTS_VALUE &&
+                av_q2d(mVideoTimeBase) * (packet->pts - mVideoStartTime) < mVideoSkipUntil - SkipNonRefDistance;
+        codecContext->skip_frame = early ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+    }
+
+    //all output was received before, so the decoder always accepts the packet
+    int ret = avcodec_send_packet(codecContext, packet);
+    if(ret < 0)
+        qWarning() << __FUNCTION__ << "avcodec_send_packet" << "failure" << ret;
+    else
+        mVideoReceivePending = true;
+    receiveVideoFrames();
+
+    mMetrics.record(PipelineMetrics::VideoDecode, decodeStart);
+    mMetrics.count(PipelineMetrics::VideoPacketsDecoded);
+    mMetrics.addDecodedBytes(true, packet->size);
+    return PipelineStage::Continue;
+}
+
+//false when the frame queue filled up before the decoder ran out of frames
+bool MiniPlayer::receiveVideoFrames()
+{
+    AVCodecContext * codecContext = mVideoCodec;
+    while(!mAbort)
+    {
+        if(mVideoFrameQueue.isFull())
+            return false;
+
+        int ret = avcodec_receive_frame(codecContext, mVideoDecodeFrame);
+        if(ret == 0)
         {
-            std::this_thread::sleep_for(std::chrono::milliseconds(16));
+            queueVideoFrame(mVideoDecodeFrame);
             continue;
         }
 
-        av_init_packet(&packet);
-
-        bool ret = mAudioPacketQueue.acquire(packet);
-        if (!ret)
+        if(ret == AVERROR_EOF && mVideoSwitching)
         {
-            std::this_thread::sleep_for(std::chrono::milliseconds(16));
-            continue;
+            //the current input is out, the next one continues without a gap
+            qDebug() << __FUNCTION__ << "switched";
+            mVideoCodec = mNextVideoCodec.exchange(nullptr);
+            mVideoSwitching = false;
+            mReadEvent.notify();
+        }
+        else if(ret == AVERROR_EOF && mTrickActive)
+        {
+            //trick play drains after every keyframe, the decoder takes the next one after a reset
+            avcodec_flush_buffers(codecContext);
         }
+        else if(ret == AVERROR_EOF)
+        {
+            qDebug() << __FUNCTION__ << "drained";
+            mVideoDrained = true;
+            mReadEvent.notify();
+        }
+        else if(ret != AVERROR(EAGAIN))
+            qWarning() << __FUNCTION__ << "avcodec_receive_frame" << "failure" << ret;
+        break;
+    }
+    mVideoReceivePending = false;
+    return true;
+}
 
-        if(mAudioPacketQueue.isFlushPacket(packet))
+void MiniPlayer::queueVideoFrame(AVFrame * decodedFrame)
+{
+    if(mSeekToPosition != -1)
+        return;
+    mMetrics.count(PipelineMetrics::VideoFramesDecoded);
+    mMetrics.markStartup(PipelineMetrics::FirstFrame);
+    decodedFrame->pts = av_frame_get_best_effort_timestamp(decodedFrame);
+    if(mVideoSkipUntil >= 0)
+    {
+        if(decodedFrame->pts != AV_NOPTS_VALUE && frameEnd(mVideoTimeBase, mVideoStartTime, decodedFrame) <= mVideoSkipUntil)
         {
-            mAudioPacketQueue.clear();
-            mAudioFrameQueue.clear();
-            avcodec_flush_buffers(mAudioStream->codec);
-            continue;
+            mMetrics.count(PipelineMetrics::SeekFramesSkipped);
+            return;
         }
+        mVideoSkipUntil = -1;
+        mVideoCodec->skip_frame = AVDISCARD_DEFAULT;
+    }
+    //the decoder's buffers move over, no copy and no new frame
+    AVFrame * frame = mVideoFramePool->acquire();
+    if(!frame)
+        return;
+    av_frame_move_ref(frame, decodedFrame);
+    if(!mVideoFrameQueue.append(frame))
+    {
+        mMetrics.count(PipelineMetrics::VideoFramesDropped);
+        mVideoFramePool->release(&frame);
+    }
+}
 
-        std::unique_ptr<AVPacket, decltype(freePacketFunc)> freePacket(&packet, freePacketFunc);
+int64_t MiniPlayer::audioDecodeStep()
+{
+    if(mAbort)
+    {
+        av_frame_unref(mAudioDecodeFrame);
+        return PipelineStage::Finished;
+    }
 
-        int gotFrame = 0;
-        packet2 = packet;
+    if(mAudioReceivePending && !mAudioPacketQueue.flushPending())
+        return receiveAudioFrames() ? PipelineStage::Continue : MaxWaitTime;
 
-        while(!mAbort)
-        {
-            int ret = avcodec_decode_audio4(mAudioStream->codec, decodedFrame, &gotFrame, &packet2);
-            if (ret < 0) {
-                qWarning() << __FUNCTION__ << "avcodec_decode_audio4" << "failure" << ret;
-                break;
-            }
+    if(mAudioFrameQueue.size() > mMaxFrameQueueSize && !mAudioPacketQueue.flushPending())
+        return MaxWaitTime;
 
-            if(gotFrame)
-                break;
+    AVPacket * packet = nullptr;
+    int64_t enqueueTime = 0;
+    if(!mAudioPacketQueue.acquire(&packet, &enqueueTime))
+        return MaxWaitTime;
 
-            packet2.size -= ret;
-            packet2.data += ret;
+    AVCodecContext * nextCodec = mAudioPacketQueue.isFlushPacket(packet) ? mNextAudioCodec.exchange(nullptr) : nullptr;
+    if(nextCodec)
+    {
+        mAudioCodec = nextCodec;
+        mAudioSwitching = false;
+        mReadEvent.notify();
+    }
 
-            if (packet2.size <= 0)
-                break;
+    AVCodecContext * codecContext = mAudioCodec;
+    if(mAudioPacketQueue.isFlushPacket(packet))
+    {
+        mAudioFrameQueue.flush();
+        avcodec_flush_buffers(codecContext);
+        mAudioReceivePending = false;
+        mAudioDrained = false;
+        mAudioSkipUntil = mSeekTarget;
+        return PipelineStage::Continue;
+    }
+
+    if(mAudioPacketQueue.isDrainPacket(packet) || mAudioPacketQueue.isSwitchPacket(packet))
+    {
+        mAudioSwitching = mAudioPacketQueue.isSwitchPacket(packet);
+        avcodec_send_packet(codecContext, nullptr);
+        mAudioReceivePending = true;
+        receiveAudioFrames();
+        return PipelineStage::Continue;
+    }
+
+    auto recyclePacketFunc = [&](AVPacket * packet){ mAudioPacketQueue.recycle(packet); };
+    std::unique_ptr<AVPacket, decltype(recyclePacketFunc)> recyclePacket(packet, recyclePacketFunc);
+
+    mMetrics.record(PipelineMetrics::AudioPacketWait, enqueueTime);
+    int64_t decodeStart = mMetrics.now();
+
+    //one packet may carry several frames, receiveAudioFrames() hands all of them out
+    int ret = avcodec_send_packet(codecContext, packet);
+    if(ret < 0)
+        qWarning() << __FUNCTION__ << "avcodec_send_packet" << "failure" << ret;
+    else
+        mAudioReceivePending = true;
+    receiveAudioFrames();
+
+    mMetrics.record(PipelineMetrics::AudioDecode, decodeStart);
+    mMetrics.count(PipelineMetrics::AudioPacketsDecoded);
+    mMetrics.addDecodedBytes(false, packet->size);
+    return PipelineStage::Continue;
+}
+
+bool MiniPlayer::receiveAudioFrames()
+{
+    AVCodecContext * codecContext = mAudioCodec;
+    while(!mAbort)
+    {
+        if(mAudioFrameQueue.isFull())
+            return false;
+
+        int ret = avcodec_receive_frame(codecContext, mAudioDecodeFrame);
+        if(ret == 0)
+        {
+            queueAudioFrame(mAudioDecodeFrame);
+            continue;
         }
 
-        if(gotFrame && mSeekToPosition == -1)
+        if(ret == AVERROR_EOF && mAudioSwitching)
         {
-            if(!mAudioInited)
-            {
-                mAudioInited = true;
-                mAudioOutput->open(decodedFrame);
-            }
-            decodedFrame->pts = av_frame_get_best_effort_timestamp(decodedFrame);
-            mAudioFrameQueue.append(av_frame_clone(decodedFrame));
+            qDebug() << __FUNCTION__ << "switched";
+            mAudioCodec = mNextAudioCodec.exchange(nullptr);
+            mAudioSwitching = false;
+            mReadEvent.notify();
         }
+        else if(ret == AVERROR_EOF)
+        {
+            qDebug() << __FUNCTION__ << "drained";
+            mAudioDrained = true;
+            mReadEvent.notify();
+        }
+        else if(ret != AVERROR(EAGAIN))
+            qWarning() << __FUNCTION__ << "avcodec_receive_frame" << "failure" << ret;
+        break;
     }
+    mAudioReceivePending = false;
+    return true;
+}
 
-    qDebug() << __FUNCTION__ << "end";
+void MiniPlayer::queueAudioFrame(AVFrame * decodedFrame)
+{
+    if(mSeekToPosition != -1)
+        return;
+    mMetrics.count(PipelineMetrics::AudioFramesDecoded);
+    if(!mAudioInited)
+    {
+        mAudioInited = true;
+        mAudioOutput->open(decodedFrame);
+    }
+    decodedFrame->pts = av_frame_get_best_effort_timestamp(decodedFrame);
+    if(mAudioSkipUntil >= 0)
+    {
+        if(decodedFrame->pts != AV_NOPTS_VALUE && frameEnd(mAudioTimeBase, mAudioStartTime, decodedFrame) <= mAudioSkipUntil)
+        {
+            mMetrics.count(PipelineMetrics::SeekFramesSkipped);
+            return;
+        }
+        mAudioSkipUntil = -1;
+    }
+    //the decoder's buffers move over, no copy and no new frame
+    AVFrame * frame = mAudioFramePool->acquire();
+    if(!frame)
+        return;
+    av_frame_move_ref(frame, decodedFrame);
+    if(!mAudioFrameQueue.append(frame))
+    {
+        mMetrics.count(PipelineMetrics::AudioFramesDropped);
+        mAudioFramePool->release(&frame);
+    }
 }
 
-void MiniPlayer::videoRenderThread()
+//video render: the frame on screen is the first of the next playlist item(s) read
+void MiniPlayer::enterItem(double clock, int64_t presentTime)
 {
-    qDebug() << __FUNCTION__ << "start";
+    std::lock_guard<std::mutex> l(mPendingItemsMutex);
+    bool entered = false;
+    while(!mPendingItems.empty() && mPendingItems.front().start <= clock + ItemStartTolerance)
+    {
+        mRenderItemStart = mPendingItems.front().start;
+        mDuration = mPendingItems.front().duration;
+        mPendingItems.pop_front();
+        entered = true;
+    }
+    mItemsPending = !mPendingItems.empty();
+    if(!entered)
+        return;
+
+    mItemSwitches ++;
+    //how much longer the last frame of the item before stayed up than it should have
+    if(mLastPresentTime > 0)
+    {
+        double held = (presentTime - mLastPresentTime) / 1000.0;
+        mItemSwitchGap = std::max(held - mLastFrameDuration * 1000 / playbackRate(), 0.0);
+    }
+    qDebug() << __FUNCTION__ << "start:" << mRenderItemStart << "duration:" << mDuration << "gap:" << mItemSwitchGap.load();
+}
 
-    int64_t baseTime = av_gettime_relative();
-    int64_t timeCount = 0;
-    int64_t totalFrame = 0;
+//ms left until wakeTime (us), rounded up so the stage does not spin on the last millisecond
+static int64_t remainingTime(int64_t wakeTime, int64_t now)
+{
+    return (wakeTime - now + 999) / 1000;
+}
 
-    for(; !mAbort; )
+int64_t MiniPlayer::videoRenderStep()
+{
+    if(mAbort)
+    {
+        if(mVideoRenderFrame)
+            mVideoFramePool->release(&mVideoRenderFrame);
+        return PipelineStage::Finished;
+    }
+
+    int64_t time = av_gettime_relative();
+    if((time - mRenderBaseTime) / 1000000.f >= mRenderTimeCount)
+    {
+        mRenderTimeCount ++;
+        //---------------------------------------------------------------------
+        if(mDownloadSpeed == 0)
+            mDownloadSpeed = static_cast<int64_t>(mTotalBytes);
+        else
+            mDownloadSpeed = ((mDownloadSpeed * 5) + (mTotalBytes * 3)) / 8.0f;
+        mTotalBytes = 0;
+        //---------------------------------------------------------------------
+        mFps = mRenderFrameCount;
+        mRenderFrameCount = 0;
+        mMetrics.tick();
+    }
+
+    //pacing after the previous frame, only seek/state changes cut it short
+    if(mVideoRenderWakeTime > 0)
+    {
+        if(time < mVideoRenderWakeTime && mSeekToPosition < 0 && mState == State::Playing)
+            return remainingTime(mVideoRenderWakeTime, time);
+        mVideoRenderWakeTime = 0;
+    }
+
+    //a frame held back for a/v sync is stale once a seek starts
+    if(mVideoRenderFrame && (mSeekToPosition >= 0 || mVideoFrameQueue.flushPending()))
+        mVideoFramePool->release(&mVideoRenderFrame);
+
+    //trick play: keyframes go out as they are decoded, the read thread paces them, pause holds the last one
+    if(!mVideoRenderFrame && mTrickActive && mSeekToPosition < 0)
     {
-        int64_t time = av_gettime_relative();
-        if((time - baseTime) / 1000000.f >= timeCount)
+        if(mState == State::Paused)
         {
-            timeCount ++;
-            //---------------------------------------------------------------------
-            if(mDownloadSpeed == 0)
-                mDownloadSpeed = static_cast<int64_t>(mTotalBytes);
-            else
-                mDownloadSpeed = ((mDownloadSpeed * 5) + (mTotalBytes * 3)) / 8.0f;
-            mTotalBytes = 0;
-            //---------------------------------------------------------------------
-            mFps = totalFrame;
-            totalFrame = 0;
+            mVideoFrameQueue.collect();
+            return MaxWaitTime;
         }
+        AVFrame * trickFrame = nullptr;
+        if(!mVideoFrameQueue.acquire(&trickFrame))
+            return MaxWaitTime;
+        int64_t startTime = mVideoStartTime != AV_NOPTS_VALUE ? mVideoStartTime.load() : 0;
+        mPosition = av_q2d(mVideoTimeBase) * (trickFrame->pts - startTime) - mItemStart;
+        mCallback->onVideoRender(trickFrame);
+        mMetrics.count(PipelineMetrics::VideoFramesRendered);
+        mTrickFramesShown ++;
+        mReadEvent.notify();
+        if(!mAbort)
+            mCallback->onPositionChanged(mPosition);
+        return PipelineStage::Continue;
+    }
+
+    //scrub preview: the keyframe goes out as soon as it is decoded, no clock, no sync, no buffering
+    if(!mVideoRenderFrame && mSeekPreview && mSeekToPosition < 0)
+    {
+        AVFrame * previewFrame = nullptr;
+        if(!mVideoFrameQueue.acquire(&previewFrame))
+            return MaxWaitTime;
+        mCallback->onVideoRender(previewFrame);
+        int64_t seekStartTime = mSeekStartTime.exchange(0);
+        if(seekStartTime > 0)
+            mMetrics.record(PipelineMetrics::Seek, seekStartTime);
+        return PipelineStage::Continue;
+    }
 
+    if(!mVideoRenderFrame)
+    {
         if(mBuffering || mState == State::Paused || mSeekToPosition >= 0)
         {
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
-            continue;
+            mVideoFrameQueue.collect();
+            return MaxWaitTime;
         }
 
-        AVFrame* renderFrame = nullptr;
-        bool ret = mVideoFrameQueue.acquire(&renderFrame);
-        if (!ret)
-        {
-            std::this_thread::sleep_for(std::chrono::milliseconds(16));
-            continue;
-        }
+        int64_t enqueueTime = 0;
+        if(!mVideoFrameQueue.acquire(&mVideoRenderFrame, &enqueueTime))
+            return MaxWaitTime;
+        mMetrics.record(PipelineMetrics::VideoFrameWait, enqueueTime);
 
         if (mClockBase < 0)
             mClockBase = systemClock();
 
         if (mVideoClockDrift < 0)
-            mVideoClockDrift = av_q2d(mVideoStream->time_base) * mVideoStream->start_time;
+            mVideoClockDrift = av_q2d(mVideoTimeBase) * mVideoStartTime;
 
-        setVideoClock(renderFrame->pts);
+        setVideoClock(mVideoRenderFrame->pts);
+    }
 
-        if(!mSynced)
+    if(!mSynced && !mFreeRun)
+    {
+        if(mState == State::Playing)
         {
-            while(!mAbort && mState == State::Playing && mAudioClock == -1)
-            {
-                std::this_thread::sleep_for(std::chrono::milliseconds(10));
-            }
-
-            while(!mAbort && !mSynced && mState == State::Playing)
-            {
-                auto diff = videoClock() - audioClock();
-                if(diff >= 0.3) //audio slowest waiting drop audio
-                {
-                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
-                    continue;
-                }
-                else if (diff < -0.3) //audio fastest drop video
-                {
-                    qDebug() << "drop video frame ----------" << videoClock();
-                    break;
-                }
-                else
-                {
-                    mSynced = true;
-                    qDebug() << __FUNCTION__ << "synced" << videoClock() << audioClock();
-                    break;
-                }
-            }
-
-            if(!mSynced)
+            //keep the frame until the audio clock shows up
+            if(mAudioClock == -1)
+                return MaxWaitTime;
+
+            auto diff = videoClock() - audioClock();
+            if(diff >= 0.3) //audio slowest waiting drop audio
+                return MaxWaitTime;
+            else if (diff < -0.3) //audio fastest drop video
+                qDebug() << "drop video frame ----------" << videoClock();
+            else
             {
-                av_frame_free(&renderFrame);
-                continue;
+                mSynced = true;
+                wakeAll();
+                qDebug() << __FUNCTION__ << "synced" << videoClock() << audioClock();
             }
         }
 
-        totalFrame ++;
-        mCallback->onVideoRender(renderFrame);
-
-        auto vClock = videoClock();
-        if(mSeekToPosition == -1 && abs(vClock - mPosition) > 0.3f)
+        if(!mSynced)
         {
-            //qDebug() << "pos:" << vClock << mPosition;
-            mPosition = vClock;
-            if(!mAbort)
-                mCallback->onPositionChanged(mPosition);
+            mMetrics.count(PipelineMetrics::VideoFramesDropped);
+            mVideoFramePool->release(&mVideoRenderFrame);
+            return PipelineStage::Continue;
         }
+    }
+
+    //above 1x not every frame can be shown in time, a late one makes way for the next
+    if(!mFreeRun && playbackRate() > 1 && mVideoFrameQueue.size() > 0 &&
+       videoClock() < masterClock() - av_q2d(mVideoTimeBase) * mVideoRenderFrame->pkt_duration)
+    {
+        mMetrics.count(PipelineMetrics::VideoFramesDropped);
+        mVideoFramePool->release(&mVideoRenderFrame);
+        return PipelineStage::Continue;
+    }
 
-        auto duration = av_q2d(mVideoStream->time_base) * renderFrame->pkt_duration;
-        auto delay = vClock - masterClock();
-        delay = std::min(delay, duration * 2);
-        if (delay > 0)
-            std::this_thread::sleep_for(std::chrono::milliseconds(static_cast<int64_t>(delay * 1000)));        
+    AVFrame * renderFrame = mVideoRenderFrame;
+    mVideoRenderFrame = nullptr;
+
+    mRenderFrameCount ++;
+    mMetrics.recordAVDrift(videoClock() - audioClock());
+    auto duration = av_q2d(mVideoTimeBase) * renderFrame->pkt_duration;
+    int64_t presentTime = av_gettime_relative();
+    int64_t presentStart = mMetrics.now();
+    mCallback->onVideoRender(renderFrame);
+    mMetrics.markStartup(PipelineMetrics::FirstRender);
+    int64_t seekStartTime = mSeekStartTime.exchange(0);
+    if(seekStartTime > 0)
+        mMetrics.record(PipelineMetrics::Seek, seekStartTime);
+    mMetrics.record(PipelineMetrics::VideoPresent, presentStart);
+    mMetrics.count(PipelineMetrics::VideoFramesRendered);
+
+    auto vClock = videoClock();
+    if(mItemsPending)
+        enterItem(vClock, presentTime);
+    mLastPresentTime = presentTime;
+    mLastFrameDuration = duration;
+
+    //the clock runs on across playlist items, the position starts over with each
+    double position = vClock - mRenderItemStart;
+    if(mSeekToPosition == -1 && abs(position - mPosition) > 0.3f)
+    {
+        //qDebug() << "pos:" << position << mPosition;
+        mPosition = position;
+        if(!mAbort)
+            mCallback->onPositionChanged(mPosition);
     }
-    qDebug() << __FUNCTION__ << "end";
+
+    if(mFreeRun)
+        return PipelineStage::Continue;
+
+    //the clocks count media seconds, rate of them pass per second
+    double rate = playbackRate();
+    auto delay = (vClock - masterClock()) / rate;
+    delay = std::min(delay, duration * 2 / rate);
+    int64_t delayMs = static_cast<int64_t>(delay * 1000);
+    if (delayMs > 0)
+    {
+        mVideoRenderWakeTime = av_gettime_relative() + delayMs * 1000;
+        return delayMs;
+    }
+    return PipelineStage::Continue;
 }
 
-void MiniPlayer::audioRenderThread()
+int64_t MiniPlayer::audioRenderStep()
 {
-    qDebug() << __FUNCTION__ << "start";
-    auto freeFrameFunc = [&](AVFrame * frame){ av_frame_free(&frame); };
+    if(mAbort)
+    {
+        if(mAudioRenderFrame)
+            mAudioFramePool->release(&mAudioRenderFrame);
+        return PipelineStage::Finished;
+    }
 
-    bool paused = false;
-    for(; !mAbort; )
+    int64_t time = av_gettime_relative();
+    if(mAudioRenderWakeTime > 0)
     {
-        //paused start -------------------------------------------------------------
-        if(!paused && mState == State::Paused)
-        {
-            mAudioOutput->stop();
-            paused = true;
-        }
-        else if(paused && mState == State::Playing)
-            paused = false;
+        if(time < mAudioRenderWakeTime && mSeekToPosition < 0 && mState == State::Playing)
+            return remainingTime(mAudioRenderWakeTime, time);
+        mAudioRenderWakeTime = 0;
+    }
 
-        if(paused || mSeekToPosition >= 0 || mBuffering)
-        {
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
-            continue;
-        }
-        //paused end -------------------------------------------------------------
+    //paused start -------------------------------------------------------------
+    if(!mAudioRenderPaused && mState == State::Paused)
+    {
+        freezeAudioClock();
+        mAudioOutput->stop();
+        mAudioRenderPaused = true;
+    }
+    else if(mAudioRenderPaused && mState == State::Playing)
+        mAudioRenderPaused = false;
+    //paused end -------------------------------------------------------------
 
-        AVFrame* renderFrame = nullptr;
-        bool ret = mAudioFrameQueue.acquire(&renderFrame);
+    if(mAudioRenderFrame && (mSeekToPosition >= 0 || mAudioFrameQueue.flushPending()))
+        mAudioFramePool->release(&mAudioRenderFrame);
 
-        if (!ret)
+    if(!mAudioRenderFrame)
+    {
+        if(mAudioRenderPaused || mSeekToPosition >= 0 || mBuffering)
         {
-            std::this_thread::sleep_for(std::chrono::milliseconds(16));
-            continue;
+            mAudioFrameQueue.collect();
+            return MaxWaitTime;
         }
 
-        std::unique_ptr<AVFrame, decltype(freeFrameFunc)> freeFrame(renderFrame, freeFrameFunc);
+        int64_t enqueueTime = 0;
+        if(!mAudioFrameQueue.acquire(&mAudioRenderFrame, &enqueueTime))
+            return MaxWaitTime;
+        mMetrics.record(PipelineMetrics::AudioFrameWait, enqueueTime);
 
         if (mClockBase < 0)
             mClockBase = systemClock();
 
         if (mAudioClockDrift < 0)
-            mAudioClockDrift = av_q2d(mAudioStream->time_base) * mAudioStream->start_time;
+            mAudioClockDrift = av_q2d(mAudioTimeBase) * mAudioStartTime;
 
-        setAudioClock(renderFrame->pts);
+        //a device clock keeps running until the frame is rendered
+        if(mAudioClockTime <= 0)
+            setAudioClock(mAudioRenderFrame->pts);
+    }
 
-        if(!mSynced)
+    if(!mSynced && !mFreeRun)
+    {
+        //what the stretcher holds is from before the seek or pause
+        mAudioStretching = false;
+        if(mState == State::Playing)
         {
-            while(!mAbort && mState == State::Playing && mVideoClock == -1)
+            //keep the frame until the video clock shows up
+            if(mVideoClock == -1)
+                return MaxWaitTime;
+
+            auto diff = videoClock() - audioClock();
+            if(diff >= 0.3) //audio slowest drop audio
+                qDebug() << "drop audio frame ++++++++++" << audioClock();
+            else if (diff < -0.3) //audio fastest waiting drop video
+                return MaxWaitTime;
+            else
             {
-                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                mSynced = true;
+                wakeAll();
+                qDebug() << __FUNCTION__ << "synced" << videoClock() << audioClock();
             }
+        }
 
-            while(!mAbort && !mSynced && mState == State::Playing)
-            {
-                auto diff = videoClock() - audioClock();
-                if(diff >= 0.3) //audio slowest drop audio
-                {
-                    qDebug() << "drop audio frame ++++++++++" << audioClock();
-                    break;
-                }
-                else if (diff < -0.3) //audio fastest waiting drop video
-                {
-                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
-                    continue;
-                }
-                else
-                {
-                    mSynced = true;
-                    qDebug() << __FUNCTION__ << "synced" << videoClock() << audioClock();
-                    break;
-                }
-            }
+        if(!mSynced)
+        {
+            mMetrics.count(PipelineMetrics::AudioFramesDropped);
+            mAudioFramePool->release(&mAudioRenderFrame);
+            return PipelineStage::Continue;
+        }
+    }
 
-            if(!mSynced)
-                continue;
+    //an output that buffers for its own device thread gets the frame once it has room, the stage does not block
+    double rate = playbackRate();
+    double space = mAudioOutput->getBufferSpace();
+    if(space >= 0 && mAudioRenderFrame->sample_rate > 0)
+    {
+        //stretched blocks can come out of the stretcher ahead of the frame's share
+        double needed = (double)mAudioRenderFrame->nb_samples / mAudioRenderFrame->sample_rate / rate * (rate != 1 ? 2 : 1);
+        //back at 1 the stretcher's leftovers go out first
+        if(rate == 1 && mAudioStretching)
+            needed += mTimeStretch.getBufferedDuration();
+        if(space < needed)
+        {
+            int64_t waitMs = std::min<int64_t>(std::max<int64_t>(static_cast<int64_t>((needed - space) * 1000), 1), MaxWaitTime);
+            mAudioRenderWakeTime = av_gettime_relative() + waitMs * 1000;
+            return waitMs;
         }
+    }
+
+    auto freeFrameFunc = [&](AVFrame * frame){ mAudioFramePool->release(&frame); };
+    std::unique_ptr<AVFrame, decltype(freeFrameFunc)> freeFrame(mAudioRenderFrame, freeFrameFunc);
+    AVFrame * renderFrame = mAudioRenderFrame;
+    mAudioRenderFrame = nullptr;
 
-        bool worked = mAudioOutput->render(renderFrame);
-        auto delay = av_q2d(mAudioStream->time_base) * renderFrame->pkt_duration;
-        if (delay > 0)
-            std::this_thread::sleep_for(std::chrono::milliseconds(static_cast<int64_t>(delay * 1000 - (worked ? 10 : 0))));
+    int64_t queueStart = mMetrics.now();
+    bool worked = false;
+    if(rate != 1 && !mAudioStretching)
+        mTimeStretch.reset();
+    else if(rate == 1 && mAudioStretching)
+    {
+        //the tail of the stretched audio plays out before the frame goes the direct way
+        for(AVFrame * block = mTimeStretch.drain(); block; block = mTimeStretch.drain())
+            worked = mAudioOutput->render(block) || worked;
     }
-    qDebug() << __FUNCTION__ << "end";
+    mAudioStretching = rate != 1;
+    if(mAudioStretching)
+    {
+        //the stretcher writes its blocks straight into one reused frame, each goes out before the next is made
+        mTimeStretch.setRate(rate);
+        int64_t stretchStart = mMetrics.now();
+        bool stretched = mTimeStretch.push(renderFrame);
+        AVFrame * block = stretched ? mTimeStretch.pull() : nullptr;
+        int64_t stretchTime = stretchStart > 0 ? av_gettime_relative() - stretchStart : 0;
+        if(!stretched)
+            worked = mAudioOutput->render(renderFrame);
+        while(block)
+        {
+            worked = mAudioOutput->render(block) || worked;
+            stretchStart = mMetrics.now();
+            block = mTimeStretch.pull();
+            if(stretchStart > 0)
+                stretchTime += av_gettime_relative() - stretchStart;
+        }
+        mMetrics.recordDuration(PipelineMetrics::AudioStretch, stretchTime);
+    }
+    else
+        worked = mAudioOutput->render(renderFrame);
+    mMetrics.record(PipelineMetrics::AudioQueue, queueStart);
+    mMetrics.markStartup(PipelineMetrics::FirstAudio);
+    mMetrics.count(PipelineMetrics::AudioFramesRendered);
+
+    //the device position replaces the frame's timestamp as the master clock, behind it is what the stretcher still holds
+    double latency = worked ? mAudioOutput->getLatency() : -1;
+    if(latency >= 0)
+        setAudioClock(renderFrame->pts + renderFrame->pkt_duration,
+                      latency * rate + (mAudioStretching ? mTimeStretch.getBufferedDuration() : 0));
+
+    if(mFreeRun)
+        return PipelineStage::Continue;
+
+    auto delay = av_q2d(mAudioTimeBase) * renderFrame->pkt_duration / rate;
+    int64_t delayMs = static_cast<int64_t>(delay * 1000 - (worked ? 10 : 0));
+    //sleep only while the device has more than MinAudioLatency left to play
+    if(latency >= 0)
+        delayMs = static_cast<int64_t>(std::min(delay, latency - MinAudioLatency) * 1000);
+    if (delay > 0 && delayMs > 0)
+    {
+        mAudioRenderWakeTime = av_gettime_relative() + delayMs * 1000;
+        return delayMs;
+    }
+    return PipelineStage::Continue;
 }
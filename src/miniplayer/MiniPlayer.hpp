@@ -13,10 +13,26 @@ extern "C"
 #include <chrono>
 #include <atomic>
 #include <memory>
+#include <mutex>
+#include <deque>
+#include <vector>
 
 #include <QDebug>
 
 #include "Queue.hpp"
+#include "FramePool.hpp"
+#include "WaitEvent.hpp"
+#include "Metrics.hpp"
+#include "Executor.hpp"
+#include "PipelineStage.hpp"
+#include "InputPrefetcher.hpp"
+#include "StreamInfoCache.hpp"
+#include "BufferPolicy.hpp"
+#include "KeyframeIndex.hpp"
+#include "TimeStretch.hpp"
+#include "ReadAheadIO.hpp"
+#include "TimeshiftStore.hpp"
+#include "PacketRecorder.hpp"
 #include "Command.hpp"
 #include "output/audio/AudioOutput.hpp"
 
@@ -29,7 +45,15 @@ public:
 
     typedef struct {
         int64_t packetBufferSize;
-        int64_t maxPacketBufferSize;
+        int64_t maxPacketBufferSize;   //current packet buffer ceiling, adaptive unless overridden
+        double startBufferDuration;     //current start/restart threshold in seconds
+        int rebufferCount;              //recent underruns still raising the threshold
+        size_t keyframeIndexSize;       //video keyframes indexed for byte seeks
+        double liveLatency;             //s buffered behind the live edge, -1 for seekable inputs
+        double liveLatencyTarget;       //0 when catch-up is off
+        double catchUpRate;             //speed-up applied on top of the playback rate, 1 when on target
+        uint64_t catchUpSpeedUps;       //times the player started speeding up
+        uint64_t catchUpJumps;          //times it dropped the buffer for the next keyframe
         size_t maxFrameQueueSize;
         size_t videoPacketQueueSize;
         size_t audioPacketQueueSize;
@@ -41,6 +65,20 @@ public:
         double audioFrameQueueDuration;
         double videoClock;
         double audioClock;
+        int videoDecoderThreads;
+        int videoDecoderThreadType;     //FF_THREAD_FRAME/FF_THREAD_SLICE actually in use, 0 when single threaded
+        int64_t packetShellsAllocated;  //AVPacket shells allocated by both packet queues
+        bool warmStart;                 //the input came opened and probed from the standby set
+        bool streamInfoCached;          //probing was skipped, decoder parameters came from StreamInfoCache
+        AVFramePool::Info videoFramePool;
+        AVFramePool::Info audioFramePool;
+        ReadAheadIO::Info readAhead;    //all 0 when the input is read directly
+        TimeshiftStore::Info timeshift; //all 0 without a timeshift recording
+        PacketRecorder::Info recording; //counters of the current or last recording
+        AudioOutput::Info audioOutput;
+        uint64_t itemSwitches;          //playlist items entered without reopening
+        double itemSwitchGap;           //ms the last item switch held the picture beyond its frame duration
+        PipelineMetrics::Info metrics;
     } DumpInfo;
 
     typedef enum {
@@ -51,6 +89,12 @@ public:
         Paused
     } State;
 
+    typedef enum {
+        DecoderThreadAuto = 0,  //frame threading when the codec supports it, slice threading otherwise
+        DecoderThreadFrame,
+        DecoderThreadSlice
+    } DecoderThreadType;
+
     class Callback
     {
     public:
@@ -61,23 +105,31 @@ public:
     };
 
 private:
+    typedef struct {
+        double start;       //s on the timeline
+        double duration;    //s, -1 when unknown
+    } PlaylistItem;
+
     std::string mMediaPath;
     AVFormatContext* mFormatContext;
     std::thread mOpenThread;
     std::thread mStopThread;
     std::thread mReadPacketThread;
-    std::thread mVideoDecodeThread;
-    std::thread mAudioDecodeThread;
-    std::thread mVideoRenderThread;
-    std::thread mAudioRenderThread;
     AVStream * mVideoStream;
     AVStream * mAudioStream;
+    WaitEvent mReadEvent;
+    WaitEvent mVideoDecodeEvent;
+    WaitEvent mAudioDecodeEvent;
+    WaitEvent mVideoRenderEvent;
+    WaitEvent mAudioRenderEvent;
     AVPacketQueue mVideoPacketQueue;
     AVPacketQueue mAudioPacketQueue;
     AVFrameQueue mVideoFrameQueue;
     AVFrameQueue mAudioFrameQueue;
-    int64_t mMaxPacketBufferSize;
-    double mMaxBufferDuration;
+    std::shared_ptr<AVFramePool> mVideoFramePool;
+    std::shared_ptr<AVFramePool> mAudioFramePool;
+    BufferPolicy mBufferPolicy;
+    double mStartBufferDuration;    //overrides mBufferPolicy for the first buffering, 0 for a warm start, -1 when unset
     size_t mMaxFrameQueueSize;
     std::atomic_int mVideoWidth;
     std::atomic_int mVideoHeight;
@@ -90,6 +142,13 @@ private:
     std::atomic_bool mSynced;
     std::atomic_bool mBuffering;
     std::atomic_bool mEndReached;
+    std::atomic_bool mFreeRun;
+    std::atomic_bool mVideoDrained;
+    std::atomic_bool mAudioDrained;
+    std::atomic_int mDecoderThreads;
+    std::atomic_int mDecoderThreadType;
+    std::atomic_int mVideoDecoderThreads;
+    std::atomic_int mVideoDecoderThreadType;
     std::atomic_int64_t mTotalBytes;
     std::atomic_int64_t mDownloadSpeed;
     std::atomic_int mFps;
@@ -100,8 +159,105 @@ private:
     double mPosition;
     double mDuration;
     double mSeekToPosition;
+    std::atomic_bool mSeekPreview;
+    std::atomic<uint64_t> mSeekSerial;      //bumped by every seek command, under mCommandMutex
+    std::atomic<uint64_t> mReadSeekSerial;  //seek the read thread works on, I/O is interrupted once they differ
+    PipelineMetrics mMetrics;
+    std::atomic<Executor *> mExecutor;
+    Executor::Group mExecutorGroup;
+    std::atomic<InputPrefetcher *> mPrefetcher;
+    std::unique_ptr<PrefetchedInput> mPrefetchedInput;  //outlives mFormatContext, its I/O interrupts through it
+    std::atomic_bool mWarmStart;
+    std::atomic_bool mFastOpen;
+    std::atomic<int64_t> mReadAheadSize;
+    std::atomic_int mReadAheadConnections;
+    std::unique_ptr<ReadAheadIO> mReadAhead;    //AVIOContext of a cold-opened mFormatContext, outlives it
+    mutable std::mutex mReadAheadMutex;         //guards mReadAhead against dump()
+    std::string mTimeshiftPath;
+    std::atomic<int64_t> mTimeshiftBudget;
+    std::unique_ptr<TimeshiftStore> mTimeshift;
+    std::atomic_bool mTimeshifting;             //mTimeshift records a live input and playback reads from it
+    std::thread mTimeshiftThread;
+    mutable std::mutex mTimeshiftMutex;         //guards mTimeshiftPath, and mTimeshift against dump()
+    PacketRecorder mRecorder;
+    std::string mRecordPath;
+    std::atomic_bool mRecordRequested;          //started by the thread reading the input with its next packet
+    std::mutex mRecordMutex;                    //guards mRecordPath, and starting mRecorder against stopRecording()
+    std::deque<std::string> mPlaylist;
+    bool mPlaylistLoop;
+    mutable std::mutex mPlaylistMutex;          //guards mPlaylist and mPlaylistLoop
+    InputPrefetcher mPlaylistPrefetcher;        //keeps the next playlist item opened and probed
+    std::string mItemPath;                      //read thread: input being read, mMediaPath or a playlist item
+    AVFormatContext * mRetiredFormatContext;    //previous item, closed once both decoders moved past it
+    AVStream * mRetiredVideoStream;
+    AVStream * mRetiredAudioStream;
+    std::unique_ptr<PrefetchedInput> mRetiredInput;
+    std::atomic<AVCodecContext *> mNextVideoCodec;  //taken over by the decoders at the switch marker
+    std::atomic<AVCodecContext *> mNextAudioCodec;
+    bool mRebasing;                             //read thread: packets are moved onto the first input's timeline
+    double mVideoQueuedEnd;                     //read thread: s on the timeline queued up to since the last flush
+    double mAudioQueuedEnd;
+    std::atomic<double> mItemStart;             //s on the timeline where the input being read starts
+    std::deque<PlaylistItem> mPendingItems;     //read but not rendered yet
+    std::atomic_bool mItemsPending;
+    std::mutex mPendingItemsMutex;
+    std::atomic<uint64_t> mItemSwitches;
+    std::atomic<double> mItemSwitchGap;
+    std::atomic_bool mStreamInfoCached;
+    std::atomic<int64_t> mOpenTime;
+    KeyframeIndex mKeyframeIndex;
+    std::atomic_bool mAccurateSeek;
+    std::atomic<double> mSeekTarget;    //position the decoders skip up to after an accurate seek, -1 otherwise
+    std::atomic<int64_t> mSeekStartTime;
+    std::atomic_int mTrickSpeed;                //requested, applied by the read thread
+    std::atomic_bool mTrickActive;              //set by the read thread while it feeds keyframes only
+    std::atomic<uint64_t> mTrickFramesShown;
+    std::atomic<double> mPlaybackRate;
+    std::atomic<double> mLiveLatencyTarget;
+    std::atomic<double> mLiveLatency;
+    std::atomic<double> mCatchUpRate;
+    std::atomic<uint64_t> mCatchUpSpeedUps;
+    std::atomic<uint64_t> mCatchUpJumps;
+
+    //timeline of a playlist run, the time bases and start times of its first input
+    AVRational mVideoTimeBase;
+    AVRational mAudioTimeBase;
+    std::atomic<int64_t> mVideoStartTime;
+    std::atomic<int64_t> mAudioStartTime;
+
+    //stage state kept between steps
+    AVCodecContext * mVideoCodec;   //the input's decoder until a playlist switch hands over the next one
+    AVCodecContext * mAudioCodec;
+    bool mVideoSwitching;           //drained for the switch marker, the next decoder takes over at its end
+    bool mAudioSwitching;
+    AVFrame * mVideoDecodeFrame;
+    AVFrame * mAudioDecodeFrame;
+    bool mVideoReceivePending;
+    bool mAudioReceivePending;
+    double mVideoSkipUntil;
+    double mAudioSkipUntil;
+    AVFrame * mVideoRenderFrame;
+    AVFrame * mAudioRenderFrame;
+    int64_t mVideoRenderWakeTime;
+    int64_t mAudioRenderWakeTime;
+    bool mAudioRenderPaused;
+    TimeStretch mTimeStretch;
+    bool mAudioStretching;
+    int64_t mRenderBaseTime;
+    int64_t mRenderTimeCount;
+    int64_t mRenderFrameCount;
+    double mRenderItemStart;        //s on the timeline where the item on screen starts
+    int64_t mLastPresentTime;
+    double mLastFrameDuration;
+
+    PipelineStage mVideoDecodeStage;
+    PipelineStage mAudioDecodeStage;
+    PipelineStage mVideoRenderStage;
+    PipelineStage mAudioRenderStage;
 
     double mAudioClock;
+    double mAudioClockEnd;          //s, end of what the output was given, the clock never runs past it
+    double mAudioClockTime;         //system s mAudioClock was taken at, 0 while it stands still
     double mAudioClockDrift;
     double mVideoClock;
     double mVideoClockDrift;
@@ -115,6 +271,7 @@ public:
     void open(const std::string & mediaPath)
     {
         qDebug() << __FUNCTION__ << mediaPath.c_str();
+        mOpenTime = av_gettime_relative();
         std::shared_ptr<Command> cmd(new OpenCommand(mediaPath));
         submitCommand(cmd);
     }
@@ -144,17 +301,18 @@ public:
             pause();
     }
 
-    void seek(double pos)
+    //preview seeks are for scrubbing: only the keyframe nearest to pos is shown until a normal seek ends it
+    void seek(double pos, bool preview = false)
     {
-        if(!mSeekable)
+        if(!mSeekable && !mTimeshifting)
             return;
         if(pos < 0)
             pos = 0;
         else if(pos > mDuration)
             pos = mDuration;
-        qDebug() << __FUNCTION__ << pos;
-        mSeekToPosition = pos;
-        mPosition = pos;
+        qDebug() << __FUNCTION__ << pos << preview;
+        std::shared_ptr<Command> cmd(new SeekCommand(pos, preview));
+        submitCommand(cmd);
     }
 
     bool getMute() { return mAudioOutput->getMute(); }
@@ -178,6 +336,9 @@ public:
     bool isBuffering() const { return mBuffering; }
     int64_t getDownloadSpeed() const { return mDownloadSpeed; }
     int getFps() const { return mFps; }
+
+    //frames passed to Callback::onVideoRender() belong to this pool, release them here when done
+    std::shared_ptr<AVFramePool> getVideoFramePool() const { return mVideoFramePool; }
     bool isEndReached() const { return mEndReached; }
 
     void dump(DumpInfo & info) const
@@ -187,7 +348,15 @@ public:
         info.audioPacketQueueSize = mAudioPacketQueue.size();
         info.audioFrameQueueSize = mAudioFrameQueue.size();
         info.packetBufferSize = mVideoPacketQueue.dataSize() + mAudioPacketQueue.dataSize();
-        info.maxPacketBufferSize = mMaxPacketBufferSize;
+        info.maxPacketBufferSize = mBufferPolicy.ceiling();
+        info.startBufferDuration = mBufferPolicy.startThreshold();
+        info.rebufferCount = mBufferPolicy.rebuffers();
+        info.keyframeIndexSize = mKeyframeIndex.size();
+        info.liveLatency = mLiveLatency;
+        info.liveLatencyTarget = mLiveLatencyTarget;
+        info.catchUpRate = mCatchUpRate;
+        info.catchUpSpeedUps = mCatchUpSpeedUps;
+        info.catchUpJumps = mCatchUpJumps;
         info.maxFrameQueueSize = mMaxFrameQueueSize;
         info.videoPacketQueueDuration = mVideoPacketQueue.duration();
         info.audioPacketQueueDuration = mAudioPacketQueue.duration();
@@ -195,16 +364,233 @@ public:
         info.audioFrameQueueDuration = mAudioFrameQueue.duration();
         info.videoClock = videoClock();
         info.audioClock = audioClock();
+        info.videoDecoderThreads = mVideoDecoderThreads;
+        info.videoDecoderThreadType = mVideoDecoderThreadType;
+        info.packetShellsAllocated = mVideoPacketQueue.shellsAllocated() + mAudioPacketQueue.shellsAllocated();
+        info.warmStart = mWarmStart;
+        info.streamInfoCached = mStreamInfoCached;
+        mVideoFramePool->dump(info.videoFramePool);
+        mAudioFramePool->dump(info.audioFramePool);
+        {
+            std::lock_guard<std::mutex> l(mReadAheadMutex);
+            if(mReadAhead)
+                mReadAhead->dump(info.readAhead);
+            else
+                info.readAhead = ReadAheadIO::Info();
+        }
+        {
+            std::lock_guard<std::mutex> l(mTimeshiftMutex);
+            if(mTimeshift)
+                mTimeshift->dump(info.timeshift);
+            else
+                info.timeshift = TimeshiftStore::Info();
+        }
+        mRecorder.dump(info.recording);
+        mAudioOutput->dump(info.audioOutput);
+        info.itemSwitches = mItemSwitches;
+        info.itemSwitchGap = mItemSwitchGap;
+        mMetrics.dump(info.metrics);
+    }
+
+    //per-stage latency/throughput instrumentation, off by default
+    void setMetricsEnabled(bool enabled)
+    {
+        mMetrics.setEnabled(enabled);
+        mVideoPacketQueue.setTimestamping(enabled);
+        mAudioPacketQueue.setTimestamping(enabled);
+        mVideoFrameQueue.setTimestamping(enabled);
+        mAudioFrameQueue.setTimestamping(enabled);
+    }
+
+    bool isMetricsEnabled() const { return mMetrics.isEnabled(); }
+    void resetMetrics() { mMetrics.reset(); }
+    bool dumpMetrics(const std::string & path) const { return mMetrics.dumpToFile(path); }
+
+    //renders every frame as soon as it is decoded, without a/v sync or clock pacing (benchmarking)
+    void setFreeRun(bool freeRun) { mFreeRun = freeRun; wakeAll(); }
+    bool isFreeRun() const { return mFreeRun; }
+
+    //video decoder threading, applied on the next open(); 0 threads picks one per core
+    void setDecoderThreads(int count) { mDecoderThreads = count; }
+    int getDecoderThreads() const { return mDecoderThreads; }
+    void setDecoderThreadType(int type) { mDecoderThreadType = type; }
+    int getDecoderThreadType() const { return mDecoderThreadType; }
+
+    //runs the decode/render stages on a shared pool instead of 4 threads, applied on the next open()
+    void setExecutor(Executor * executor) { mExecutor = executor; }
+    Executor * getExecutor() const { return mExecutor; }
+
+    //caps probesize/analyzeduration and reuses StreamInfoCache::shared() to skip probing, applied on the next open()
+    void setFastOpen(bool fastOpen) { mFastOpen = fastOpen; }
+    bool isFastOpen() const { return mFastOpen; }
+
+    //reads cold-opened inputs through a ring of this many bytes filled by its own I/O thread, 0 reads
+    //directly; applied on the next open()
+    void setReadAheadSize(int64_t bytes) { mReadAheadSize = std::max<int64_t>(bytes, 0); }
+    int64_t getReadAheadSize() const { return mReadAheadSize; }
+
+    //parallel range requests for seekable inputs of known size read through the ring, applied on the next open()
+    void setReadAheadConnections(int count) { mReadAheadConnections = count; }
+    int getReadAheadConnections() const { return mReadAheadConnections; }
+
+    //live inputs are recorded into a ring file at path of budget bytes, so they can be paused and seeked back
+    //within it; an empty path turns it off, applied on the next open()
+    void setTimeshift(const std::string & path, int64_t budget)
+    {
+        std::lock_guard<std::mutex> l(mTimeshiftMutex);
+        mTimeshiftPath = path;
+        mTimeshiftBudget = budget;
+    }
+    std::string getTimeshiftPath() const
+    {
+        std::lock_guard<std::mutex> l(mTimeshiftMutex);
+        return mTimeshiftPath;
     }
+    int64_t getTimeshiftBudget() const { return mTimeshiftBudget; }
+    bool isTimeshifting() const { return mTimeshifting; }
+
+    //oldest position seek() can reach in the recording, the newest one is getDuration(); -1 without timeshift
+    double getTimeshiftStart() const
+    {
+        std::lock_guard<std::mutex> l(mTimeshiftMutex);
+        return mTimeshift ? mTimeshift->windowStart() : -1;
+    }
+
+    //remuxes the input as it is read into path (format from the extension) from the next video keyframe on, without
+    //decoding; a slow disk drops packets instead of holding up playback. Ends with stopRecording() or the input
+    void startRecording(const std::string & path)
+    {
+        std::lock_guard<std::mutex> l(mRecordMutex);
+        mRecordPath = path;
+        mRecordRequested = true;
+    }
+    void stopRecording()
+    {
+        std::lock_guard<std::mutex> l(mRecordMutex);
+        mRecordRequested = false;
+        mRecorder.stop();
+    }
+    bool isRecording() const { return mRecordRequested || mRecorder.isRecording(); }
+
+    //inputs played after the current one without stopping: the next one is kept opened and probed in the
+    //background and its packets follow the current input's through the same decoders, audio output and surface
+    void setPlaylist(const std::vector<std::string> & mediaPaths)
+    {
+        {
+            std::lock_guard<std::mutex> l(mPlaylistMutex);
+            mPlaylist.assign(mediaPaths.begin(), mediaPaths.end());
+        }
+        prefetchNextItem();
+    }
+    std::vector<std::string> getPlaylist() const
+    {
+        std::lock_guard<std::mutex> l(mPlaylistMutex);
+        return std::vector<std::string>(mPlaylist.begin(), mPlaylist.end());
+    }
+    //inputs played to the end go back to the end of the playlist
+    void setPlaylistLoop(bool loop)
+    {
+        std::lock_guard<std::mutex> l(mPlaylistMutex);
+        mPlaylistLoop = loop;
+    }
+    bool isPlaylistLoop() const
+    {
+        std::lock_guard<std::mutex> l(mPlaylistMutex);
+        return mPlaylistLoop;
+    }
+
+    //open() takes the input from this standby set when it was prefetched there, applied on the next open()
+    void setPrefetcher(InputPrefetcher * prefetcher) { mPrefetcher = prefetcher; }
+    InputPrefetcher * getPrefetcher() const { return mPrefetcher; }
+
+    //seeks land exactly on the position instead of the keyframe before it, the frames in between are decoded but not shown
+    void setAccurateSeek(bool accurate) { mAccurateSeek = accurate; }
+    bool isAccurateSeek() const { return mAccurateSeek; }
+
+    //0.5..2, scales both clocks, audio keeps its pitch
+    void setPlaybackRate(double rate) { mPlaybackRate = std::min(std::max(rate, 0.5), 2.0); }
+    double getPlaybackRate() const { return mPlaybackRate; }
+
+    //live inputs only: seconds of buffer to hold at most, more is caught up by playing faster, 0 turns it off
+    void setLiveLatency(double seconds) { mLiveLatencyTarget = std::max(seconds, 0.0); }
+    double getLiveLatency() const { return mLiveLatencyTarget; }
+
+    //keyframe-only fast forward (2..32) or rewind (-2..-32) on seekable inputs, 0 resumes normal playback
+    void setTrickSpeed(int speed)
+    {
+        if(speed > -2 && speed < 2)
+            speed = 0;
+        if(speed != 0 && !mSeekable)
+        {
+            qWarning() << __FUNCTION__ << "input is not seekable";
+            return;
+        }
+        mTrickSpeed = std::min(std::max(speed, -32), 32);
+        wakeAll();
+    }
+    int getTrickSpeed() const { return mTrickSpeed; }
+
+    //fixed buffering instead of the adaptive policy, 0 goes back to adaptive
+    void setStartBufferDuration(double seconds) { mBufferPolicy.setStartOverride(seconds); }
+    double getStartBufferDuration() const { return mBufferPolicy.getStartOverride(); }
+    void setMaxPacketBufferSize(int64_t bytes) { mBufferPolicy.setCeilingOverride(bytes); }
+    int64_t getMaxPacketBufferSize() const { return mBufferPolicy.getCeilingOverride(); }
+
+    //stages of a boosted player are scheduled first on the executor (focused/audible player)
+    void setBoosted(bool boosted) { mExecutorGroup.setBoosted(boosted); }
+    bool isBoosted() const { return mExecutorGroup.isBoosted(); }
 
 private:
     void openThread();
     void stopThread();
+    void closeInput();
+    void closeReadAhead();
+    void closeTimeshift();
+    void closeRetiredInput();
+    void prefetchNextItem();
+    bool hasNextItem() const;
+    std::unique_ptr<PrefetchedInput> openItem(const std::string & path, AVStream *& videoStream, AVStream *& audioStream);
+    bool switchInput();
+    void enterItem(double clock, int64_t presentTime);
+    void timeshiftThread();
+    int readPacket(AVPacket & packet);
+    void onPacketRead(AVPacket & packet);
+    void queuePacket(AVPacket & packet);
+    void flushPacketQueues();
     void readPacketThread();
-    void videoDecodeThread();
-    void audioDecodeThread();
-    void videoRenderThread();
-    void audioRenderThread();
+    int64_t videoDecodeStep();
+    int64_t audioDecodeStep();
+    int64_t videoRenderStep();
+    int64_t audioRenderStep();
+    bool receiveVideoFrames();
+    bool receiveAudioFrames();
+    void queueVideoFrame(AVFrame * decodedFrame);
+    void queueAudioFrame(AVFrame * decodedFrame);
+    bool queueTrickKeyframe(double target, double last, bool forward, double & time);
+
+    //what the clocks run at: the requested rate plus live catch-up
+    double playbackRate() const
+    {
+        return std::min(mPlaybackRate * mCatchUpRate, 2.0);
+    }
+
+    int decoderThreadCount() const
+    {
+        if(mDecoderThreads > 0)
+            return mDecoderThreads;
+        //libavcodec caps automatic threading at 16 as well
+        int cores = static_cast<int>(std::thread::hardware_concurrency());
+        return std::min(std::max(cores, 1), 16);
+    }
+
+    int decoderThreadType() const
+    {
+        if(mDecoderThreadType == DecoderThreadType::DecoderThreadFrame)
+            return FF_THREAD_FRAME;
+        if(mDecoderThreadType == DecoderThreadType::DecoderThreadSlice)
+            return FF_THREAD_SLICE;
+        return FF_THREAD_FRAME | FF_THREAD_SLICE;
+    }
 
     void changeState(int from,int to)
     {
@@ -222,6 +608,7 @@ private:
         int oldState = mState;
         mState = to;
         qDebug() << __FUNCTION__ << oldState << "->" << mState;
+        wakeAll();
         mCallback->onStateChanged(mState);
     }
 
@@ -231,13 +618,39 @@ private:
             return;
         mBuffering = val;
         qDebug() << __FUNCTION__ << mBuffering;
+        wakeAll();
         mCallback->onBufferingChanged(mBuffering);
     }
 
+    void setAbort(bool val)
+    {
+        mAbort = val;
+        for(auto queue : std::initializer_list<QueueEvents *>{&mVideoPacketQueue, &mAudioPacketQueue,
+                                                               &mVideoFrameQueue, &mAudioFrameQueue})
+        {
+            if(val)
+                queue->abort();
+            else
+                queue->reset();
+        }
+        wakeAll();
+    }
+
+    //wakes every pipeline stage so it re-evaluates state, seek, buffering and abort
+    void wakeAll()
+    {
+        mReadEvent.notify();
+        mVideoDecodeEvent.notify();
+        mAudioDecodeEvent.notify();
+        mVideoRenderEvent.notify();
+        mAudioRenderEvent.notify();
+    }
+
     void submitCommand(std::shared_ptr<Command> cmd)
     {
         std::lock_guard<std::mutex> l(mCommandMutex);
-        if(mBusy)
+        //seeks never wait for open/stop, they coalesce on the read thread instead (or are dropped, see doCommand)
+        if(mBusy && cmd->type != CommandType::Seek)
             mPendingCommand = cmd;
         else
             doCommand(cmd);
@@ -251,8 +664,8 @@ private:
 
     void onCommandFinished()
     {
-        mBusy = false;
         std::lock_guard<std::mutex> l(mCommandMutex);
+        mBusy = false;
         auto command = mPendingCommand;
         if(command)
             doCommand(command);
@@ -280,19 +693,78 @@ private:
                 mStopThread.detach();
             mStopThread = std::thread(&MiniPlayer::stopThread, this);
         }
+        else if(cmd->type == CommandType::Seek)
+        {
+            //open/stop reset the seek state and the read thread is not running yet, the input the seek was meant for is gone;
+            //the same goes for a playlist item that is read but not rendered yet, the position is still the item before
+            if(mBusy || mItemsPending || (!mSeekable && !mTimeshifting))
+            {
+                qDebug() << __FUNCTION__ << "seek dropped";
+                return;
+            }
+            //only the latest target survives, the read thread drops the I/O it is blocked in
+            auto seekCmd = std::dynamic_pointer_cast<SeekCommand>(cmd);
+            mSeekStartTime = mMetrics.now();
+            mSeekPreview = seekCmd->preview;
+            mSeekToPosition = seekCmd->position;
+            mPosition = seekCmd->position;
+            mSeekSerial ++;
+            wakeAll();
+        }
+    }
+
+    //read thread: picks up the pending seek, false when there is none
+    bool takeSeek(double & position, bool & preview, uint64_t & serial)
+    {
+        std::lock_guard<std::mutex> l(mCommandMutex);
+        if(mSeekToPosition < 0)
+            return false;
+        if(mItemsPending || (!mSeekable && !mTimeshifting))
+        {
+            //came in while the read thread switched to the next item, see doCommand
+            qDebug() << __FUNCTION__ << "seek dropped";
+            mSeekToPosition = -1;
+            mReadSeekSerial = mSeekSerial.load();
+            wakeAll();
+            return false;
+        }
+        position = mSeekToPosition;
+        preview = mSeekPreview;
+        serial = mSeekSerial;
+        mReadSeekSerial = serial;
+        return true;
+    }
+
+    //read thread: the seek is done unless another one came in meanwhile
+    void finishSeek(uint64_t serial)
+    {
+        std::lock_guard<std::mutex> l(mCommandMutex);
+        if(mSeekSerial != serial)
+            return;
+        mSeekToPosition = -1;
+        wakeAll();
+    }
+
+    static int onAbortCallback(void * ctx)
+    {
+        MiniPlayer * player = (MiniPlayer *)ctx;
+        return player->mAbort;
     }
 
     static int onInterruptCallback(void * ctx)
     {
         //qDebug() << __FUNCTION__;
         MiniPlayer * player = (MiniPlayer *)ctx;
-        return player->mAbort;
+        //the timeshift thread reads the input, seeks are served from the recording without interrupting it
+        return player->mAbort || (!player->mTimeshifting && player->mSeekSerial != player->mReadSeekSerial);
     }
 
     //clock
     void clearClock()
     {
         mAudioClock = -1;
+        mAudioClockEnd = -1;
+        mAudioClockTime = 0;
         mAudioClockDrift = -1;
         mVideoClock = -1;
         mVideoClockDrift = -1;
@@ -309,9 +781,13 @@ private:
         return mVideoClock - mVideoClockDrift;
     }
 
+    //with the output's latency known the clock follows the device between renders
     double audioClock() const
     {
-        return mAudioClock - mAudioClockDrift;
+        double clock = mAudioClock;
+        if(mAudioClockTime > 0)
+            clock = std::min(clock + (systemClock() - mAudioClockTime) * playbackRate(), mAudioClockEnd);
+        return clock - mAudioClockDrift;
     }
 
     double masterClock() const
@@ -319,14 +795,29 @@ private:
         return audioClock();
     }
 
-    void setAudioClock(const int64_t& pts)
+    //latency: s of media still ahead of the device at pts, -1 when the output cannot tell
+    void setAudioClock(const int64_t& pts, double latency = -1)
+    {
+        double clock = av_q2d(mAudioTimeBase) * pts;
+        mAudioClockEnd = clock;
+        mAudioClockTime = latency >= 0 ? systemClock() : 0;
+        mAudioClock = clock - std::max(latency, 0.0);
+        mVideoRenderEvent.notify();
+    }
+
+    //stops the extrapolation where the device is now
+    void freezeAudioClock()
     {
-        mAudioClock = av_q2d(mAudioStream->time_base) * pts;
+        if(mAudioClockTime <= 0)
+            return;
+        mAudioClock = audioClock() + mAudioClockDrift;
+        mAudioClockTime = 0;
     }
 
     void setVideoClock(const int64_t& pts)
     {
-        mVideoClock = av_q2d(mVideoStream->time_base) * pts;
+        mVideoClock = av_q2d(mVideoTimeBase) * pts;
+        mAudioRenderEvent.notify();
     }
 };
 
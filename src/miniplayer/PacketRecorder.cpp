@@ -0,0 +1,341 @@
+#include "PacketRecorder.hpp"
+#include "TimeBase.hpp"
+#include <QDebug>
+#include <algorithm>
+
+using namespace miniplayer;
+
+//what the writer may fall behind by before packets are dropped
+static const size_t QueueCapacity = 4096;
+static const int64_t MaxQueuedBytes = 32 * 1024 * 1024;
+//writer wakeup when nothing is pushed, stop() notifies anyway
+static const int64_t WriterWaitTime = 250;
+
+static void freePacket(AVPacket *& packet)
+{
+    av_packet_free(&packet);
+}
+
+PacketRecorder::PacketRecorder() :
+    mQueue(QueueCapacity),
+    mRecording(false),
+    mWriterDone(true),
+    mStarted(false),
+    mWaitKeyframe(true),
+    mSplice(false),
+    mOutput(nullptr),
+    mStartTime(AV_NOPTS_VALUE),
+    mOutputEnd(0),
+    mSpliceTime(0),
+    mRebase(false),
+    mQueuedBytes(0),
+    mPacketsWritten(0),
+    mPacketsDropped(0),
+    mBytesWritten(0),
+    mDuration(0)
+{
+}
+
+PacketRecorder::~PacketRecorder()
+{
+    stop();
+    if(mThread.joinable())
+        mThread.join();
+    clearStreams();
+}
+
+void PacketRecorder::clearStreams()
+{
+    for(auto & stream : mStreams)
+        avcodec_parameters_free(&stream.parameters);
+    mStreams.clear();
+}
+
+bool PacketRecorder::start(const std::string & path, const AVFormatContext * input, const std::vector<int> & streams)
+{
+    std::lock_guard<std::mutex> l(mMutex);
+    if(mRecording)
+        return false;
+    //joining a writer that is still writing the trailer would hold up the caller
+    if(!mWriterDone)
+    {
+        qWarning() << __FUNCTION__ << "previous recording still closing";
+        return false;
+    }
+    if(mThread.joinable())
+        mThread.join();
+
+    //the input may be closed before the writer opens the output, keep what it needs
+    clearStreams();
+    for(int index : streams)
+    {
+        if(index < 0 || index >= static_cast<int>(input->nb_streams))
+            continue;
+        const AVStream * stream = input->streams[index];
+        Stream entry = { index, stream->time_base, avcodec_parameters_alloc(), nullptr };
+        if(!entry.parameters || avcodec_parameters_copy(entry.parameters, stream->codecpar) < 0)
+        {
+            avcodec_parameters_free(&entry.parameters);
+            continue;
+        }
+        mStreams.push_back(entry);
+    }
+    if(mStreams.empty())
+        return false;
+
+    mPath = path;
+    mStarted = false;
+    mWaitKeyframe = true;
+    mSplice = false;
+    mStartTime = AV_NOPTS_VALUE;
+    mOutputEnd = 0;
+    mSpliceTime = 0;
+    mRebase = false;
+    mQueuedBytes = 0;
+    mPacketsWritten = 0;
+    mPacketsDropped = 0;
+    mBytesWritten = 0;
+    mDuration = 0;
+    mWriterDone = false;
+    mRecording = true;
+    mThread = std::thread(&PacketRecorder::writerThread, this);
+    qDebug() << __FUNCTION__ << path.c_str() << "streams:" << mStreams.size();
+    return true;
+}
+
+void PacketRecorder::stop()
+{
+    {
+        std::lock_guard<std::mutex> l(mMutex);
+        if(!mRecording)
+            return;
+        mRecording = false;
+    }
+    mEvent.notify();
+}
+
+PacketRecorder::Stream * PacketRecorder::findStream(int inputIndex)
+{
+    for(auto & stream : mStreams)
+    {
+        if(stream.inputIndex == inputIndex)
+            return &stream;
+    }
+    return nullptr;
+}
+
+void PacketRecorder::push(const AVPacket & packet)
+{
+    if(!mRecording)
+        return;
+    std::lock_guard<std::mutex> l(mMutex);
+    if(!mRecording || !findStream(packet.stream_index))
+        return;
+
+    //the first stream is video, a GOP only goes out complete
+    bool keyframe = packet.stream_index == mStreams.front().inputIndex && (packet.flags & AV_PKT_FLAG_KEY);
+    if(mWaitKeyframe)
+    {
+        if(!keyframe)
+        {
+            if(mStarted)
+                mPacketsDropped ++;
+            return;
+        }
+        //a null entry tells the writer where the jump is
+        if(mSplice)
+        {
+            if(mQueue.full())
+            {
+                mPacketsDropped ++;
+                return;
+            }
+            mQueue.push(nullptr);
+            mSplice = false;
+        }
+        mWaitKeyframe = false;
+        mStarted = true;
+    }
+
+    AVPacket * ref = nullptr;
+    if(mQueuedBytes + packet.size <= MaxQueuedBytes && !mQueue.full())
+    {
+        ref = av_packet_alloc();
+        if(ref && av_packet_ref(ref, &packet) < 0)
+            av_packet_free(&ref);
+    }
+    if(!ref)
+    {
+        mPacketsDropped ++;
+        mWaitKeyframe = true;
+        return;
+    }
+    mQueuedBytes += ref->size;
+    mQueue.push(ref);
+    mEvent.notify();
+}
+
+void PacketRecorder::discontinuity()
+{
+    if(!mRecording)
+        return;
+    std::lock_guard<std::mutex> l(mMutex);
+    //before the first keyframe there is nothing to carry on from
+    if(!mRecording || !mStarted)
+        return;
+    mWaitKeyframe = true;
+    mSplice = true;
+}
+
+bool PacketRecorder::openOutput()
+{
+    int ret = avformat_alloc_output_context2(&mOutput, nullptr, nullptr, mPath.c_str());
+    if(ret < 0 || !mOutput)
+        ret = avformat_alloc_output_context2(&mOutput, nullptr, "mpegts", mPath.c_str());
+    if(ret < 0 || !mOutput)
+    {
+        qWarning() << __FUNCTION__ << "avformat_alloc_output_context2" << "failure" << ret;
+        return false;
+    }
+
+    for(auto & stream : mStreams)
+    {
+        stream.output = avformat_new_stream(mOutput, nullptr);
+        if(!stream.output || avcodec_parameters_copy(stream.output->codecpar, stream.parameters) < 0)
+        {
+            qWarning() << __FUNCTION__ << "avformat_new_stream" << "failure";
+            return false;
+        }
+        //the input's tag may mean nothing in the output container
+        stream.output->codecpar->codec_tag = 0;
+        stream.output->time_base = stream.inputTimeBase;
+    }
+
+    if(!(mOutput->oformat->flags & AVFMT_NOFILE))
+    {
+        ret = avio_open(&mOutput->pb, mPath.c_str(), AVIO_FLAG_WRITE);
+        if(ret < 0)
+        {
+            qWarning() << __FUNCTION__ << "avio_open" << "failure" << mPath.c_str();
+            return false;
+        }
+    }
+    ret = avformat_write_header(mOutput, nullptr);
+    if(ret < 0)
+    {
+        qWarning() << __FUNCTION__ << "avformat_write_header" << "failure" << ret;
+        return false;
+    }
+    return true;
+}
+
+void PacketRecorder::closeOutput()
+{
+    if(!mOutput)
+        return;
+    if(mOutput->pb && !(mOutput->oformat->flags & AVFMT_NOFILE))
+        avio_closep(&mOutput->pb);
+    avformat_free_context(mOutput);
+    mOutput = nullptr;
+    for(auto & stream : mStreams)
+        stream.output = nullptr;
+}
+
+void PacketRecorder::write(AVPacket * packet)
+{
+    Stream * stream = findStream(packet->stream_index);
+    int64_t ts = packet->dts != AV_NOPTS_VALUE ? packet->dts : packet->pts;
+    //the recording starts at 0 with the first keyframe, after a seek it goes on where it stopped
+    if(mStartTime == AV_NOPTS_VALUE || mRebase)
+    {
+        if(ts == AV_NOPTS_VALUE)
+            return;
+        mStartTime = av_rescale_q(ts, stream->inputTimeBase, MicrosecondTimeBase) - mOutputEnd;
+        mSpliceTime = mOutputEnd;
+        mRebase = false;
+    }
+
+    AVRational timeBase = stream->output->time_base;
+    int64_t offset = av_rescale_q(mStartTime, MicrosecondTimeBase, timeBase);
+    av_packet_rescale_ts(packet, stream->inputTimeBase, timeBase);
+    if(packet->pts != AV_NOPTS_VALUE)
+        packet->pts -= offset;
+    if(packet->dts != AV_NOPTS_VALUE)
+        packet->dts -= offset;
+    //audio demuxed before the keyframe it was muxed next to
+    int64_t outputTs = packet->dts != AV_NOPTS_VALUE ? packet->dts : packet->pts;
+    if(outputTs < av_rescale_q(mSpliceTime, MicrosecondTimeBase, timeBase))
+        return;
+
+    int size = packet->size;
+    double time = av_q2d(timeBase) * outputTs;
+    int64_t end = av_rescale_q(outputTs + std::max<int64_t>(packet->duration, 0), timeBase, MicrosecondTimeBase);
+    packet->stream_index = stream->output->index;
+    packet->pos = -1;
+    //takes over the packet's reference
+    int ret = av_interleaved_write_frame(mOutput, packet);
+    if(ret < 0)
+    {
+        qWarning() << __FUNCTION__ << "av_interleaved_write_frame" << ret;
+        return;
+    }
+    mPacketsWritten ++;
+    mBytesWritten += size;
+    if(time > mDuration)
+        mDuration = time;
+    if(end > mOutputEnd)
+        mOutputEnd = end;
+}
+
+void PacketRecorder::writerThread()
+{
+    qDebug() << __FUNCTION__ << "start";
+
+    bool opened = openOutput();
+    if(!opened)
+        stop();
+
+    AVPacket * packet = nullptr;
+    for(;;)
+    {
+        //taken before the queue is looked at, so whatever was pushed before stop() still goes out
+        bool stopping = !mRecording;
+        auto result = mQueue.pop(packet, freePacket);
+        if(result == SPSCRing<AVPacket *>::Item && !packet)
+        {
+            mRebase = true;
+            continue;
+        }
+        if(result == SPSCRing<AVPacket *>::Item)
+        {
+            mQueuedBytes -= packet->size;
+            if(opened)
+                write(packet);
+            av_packet_free(&packet);
+            continue;
+        }
+        if(stopping)
+            break;
+        mEvent.waitFor(WriterWaitTime, [&] { return !mRecording || mQueue.size() > 0; });
+    }
+
+    if(opened)
+    {
+        int ret = av_write_trailer(mOutput);
+        if(ret < 0)
+            qWarning() << __FUNCTION__ << "av_write_trailer" << ret;
+    }
+    closeOutput();
+    qDebug() << __FUNCTION__ << "end" << "written:" << mPacketsWritten.load() << "dropped:" << mPacketsDropped.load();
+    mWriterDone = true;
+}
+
+void PacketRecorder::dump(Info & info) const
+{
+    info.recording = mRecording;
+    info.packetsWritten = mPacketsWritten;
+    info.packetsDropped = mPacketsDropped;
+    info.bytesWritten = mBytesWritten;
+    info.queued = static_cast<int64_t>(mQueue.size());
+    info.duration = mDuration;
+}
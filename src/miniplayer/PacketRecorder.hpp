@@ -0,0 +1,113 @@
+#ifndef PACKETRECORDER_HPP
+#define PACKETRECORDER_HPP
+
+extern "C"
+{
+#include <libavformat/avformat.h>
+}
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "RingBuffer.hpp"
+#include "WaitEvent.hpp"
+
+namespace miniplayer
+{
+
+/*
+ * Remuxes demuxed packets into a file while they are played, without decoding them.
+ * push() takes a new reference on the packet's buffer (no copy) and hands it to a writer
+ * thread, which muxes it into the output; the file format follows the path's extension,
+ * mpegts when it has none the muxer knows.
+ *
+ * A recording starts at the next video keyframe. The queue to the writer is bounded: when
+ * the disk falls behind, push() drops the packet instead of waiting, counts it, and drops
+ * everything up to the next keyframe so the file continues with a decodable GOP.
+ *
+ * After a seek of the input discontinuity() makes the recording wait for the next keyframe
+ * again; the file carries on from where it stopped, without the jump in the timestamps.
+ *
+ * push() and discontinuity() belong to the thread reading the input, start()/stop() may be called from any
+ * thread. stop() returns right away, the writer finishes what is queued and closes the file.
+ */
+class PacketRecorder
+{
+public:
+    typedef struct {
+        bool recording;
+        int64_t packetsWritten;
+        int64_t packetsDropped;     //the writer fell behind, including the rest of their GOP
+        int64_t bytesWritten;
+        int64_t queued;             //packets waiting for the writer
+        double duration;            //s recorded
+    } Info;
+
+    PacketRecorder();
+    ~PacketRecorder();
+
+    PacketRecorder(const PacketRecorder&) = delete;
+    PacketRecorder& operator=(const PacketRecorder&) = delete;
+
+    //records streams of input (the first one video) to path, false while the previous file is still being closed
+    bool start(const std::string & path, const AVFormatContext * input, const std::vector<int> & streams);
+    void stop();
+    void push(const AVPacket & packet);
+    void discontinuity();
+
+    bool isRecording() const { return mRecording; }
+    void dump(Info & info) const;
+
+private:
+    typedef struct {
+        int inputIndex;
+        AVRational inputTimeBase;
+        AVCodecParameters * parameters;
+        AVStream * output;
+    } Stream;
+
+    void writerThread();
+    bool openOutput();
+    void closeOutput();
+    void write(AVPacket * packet);
+    Stream * findStream(int inputIndex);
+    void clearStreams();
+
+private:
+    SPSCRing<AVPacket *> mQueue;
+    WaitEvent mEvent;
+    std::thread mThread;
+    std::atomic_bool mRecording;
+    std::atomic_bool mWriterDone;
+    std::mutex mMutex;              //producer side of mQueue against start()/stop()
+
+    //fixed while a recording runs
+    std::string mPath;
+    std::vector<Stream> mStreams;
+
+    //producer
+    bool mStarted;                  //the first keyframe went out
+    bool mWaitKeyframe;             //dropping until the next keyframe
+    bool mSplice;                   //a seek happened, the writer rebases at the next keyframe
+
+    //writer
+    AVFormatContext * mOutput;
+    int64_t mStartTime;             //us, input timestamp written as 0
+    int64_t mOutputEnd;             //us, end of the last packet written
+    int64_t mSpliceTime;            //us, packets ending up before it are dropped
+    bool mRebase;                   //the next packet starts at mOutputEnd
+
+    std::atomic<int64_t> mQueuedBytes;
+    std::atomic<int64_t> mPacketsWritten;
+    std::atomic<int64_t> mPacketsDropped;
+    std::atomic<int64_t> mBytesWritten;
+    std::atomic<double> mDuration;
+};
+
+}
+
+#endif // PACKETRECORDER_HPP
@@ -0,0 +1,171 @@
+#include "PipelineStage.hpp"
+#include <QDebug>
+
+extern "C"
+{
+#include <libavutil/time.h>
+}
+
+using namespace miniplayer;
+
+PipelineStage::PipelineStage(const char * name, WaitEvent & event, PipelineMetrics & metrics,
+                             PipelineMetrics::Thread slot, Step step) :
+    mName(name),
+    mEvent(event),
+    mMetrics(metrics),
+    mSlot(slot),
+    mStep(step),
+    mExecutor(nullptr),
+    mStarted(false),
+    mState(Done),
+    mCpuTime(0)
+{
+}
+
+PipelineStage::~PipelineStage()
+{
+    if(joinable())
+        join();
+}
+
+void PipelineStage::start(Executor * executor, Executor::Group * group)
+{
+    mExecutor = executor;
+    mGroup = group;
+    mStarted = true;
+
+    if(!mExecutor)
+    {
+        mState = Running;
+        mThread = std::thread(&PipelineStage::threadLoop, this);
+        return;
+    }
+
+    qDebug() << mName << "start on executor";
+    mState = Queued;
+    mEvent.setListener(this);
+    mExecutor->schedule(this);
+}
+
+void PipelineStage::join()
+{
+    if(!mStarted)
+        return;
+
+    if(mThread.joinable())
+        mThread.join();
+    else
+    {
+        std::unique_lock<std::mutex> l(mDoneMutex);
+        mDoneCond.wait(l, [this] { return mState == Done; });
+    }
+    mStarted = false;
+}
+
+void PipelineStage::threadLoop()
+{
+    qDebug() << mName << "start";
+    ThreadCpuTimer cpuTimer(mMetrics, mSlot);
+
+    for(;;)
+    {
+        uint64_t serial = mEvent.serial();
+        int64_t result = mStep();
+        if(result == Finished)
+            break;
+        if(result > 0)
+            mEvent.waitChanged(serial, result);
+    }
+
+    mState = Done;
+    qDebug() << mName << "end";
+}
+
+void PipelineStage::wake()
+{
+    int state = mState.load();
+    for(;;)
+    {
+        if(state == Idle)
+        {
+            if(mState.compare_exchange_weak(state, Queued))
+            {
+                mExecutor->schedule(this);
+                return;
+            }
+        }
+        else if(state == Running)
+        {
+            if(mState.compare_exchange_weak(state, Rerun))
+                return;
+        }
+        else
+            return;
+    }
+}
+
+void PipelineStage::accountCpu()
+{
+    int64_t now = PipelineMetrics::currentThreadCpuTime();
+    mMetrics.addThreadCpuTime(mSlot, now - mCpuTime);
+    mCpuTime = now;
+}
+
+void PipelineStage::finish()
+{
+    accountCpu();
+    mEvent.setListener(nullptr);
+    mExecutor->cancelTimer(this);
+    qDebug() << mName << "end";
+
+    std::lock_guard<std::mutex> l(mDoneMutex);
+    mState = Done;
+    mDoneCond.notify_all();
+}
+
+void PipelineStage::run()
+{
+    mState = Running;
+    mEvent.disarm();
+    mExecutor->cancelTimer(this);
+    mCpuTime = PipelineMetrics::currentThreadCpuTime();
+    int64_t sliceEnd = av_gettime_relative() + Executor::SliceTime;
+
+    for(;;)
+    {
+        uint64_t serial = mEvent.serial();
+        int64_t result = mStep();
+        if(result == Finished)
+        {
+            finish();
+            return;
+        }
+
+        if(result == Continue)
+        {
+            if(av_gettime_relative() < sliceEnd)
+                continue;
+            //slice used up, let the other stages have a go
+            accountCpu();
+            mState = Queued;
+            mExecutor->schedule(this);
+            return;
+        }
+
+        //a notify raced with the step, just run it again
+        if(!mEvent.arm(serial))
+            continue;
+        mExecutor->scheduleAt(this, av_gettime_relative() + result * 1000);
+
+        //the stage may run on another worker as soon as it is Idle, so touch nothing after the exchange
+        accountCpu();
+        int expected = Running;
+        if(mState.compare_exchange_strong(expected, Idle))
+            return;
+
+        //woken while parking
+        mState = Running;
+        mEvent.disarm();
+        mExecutor->cancelTimer(this);
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef PIPELINESTAGE_HPP
+#define PIPELINESTAGE_HPP
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+
+#include "Executor.hpp"
+#include "WaitEvent.hpp"
+#include "Metrics.hpp"
+
+namespace miniplayer
+{
+
+/*
+ * One decode/render stage of the pipeline, written as a step function that does a
+ * bounded amount of work and returns:
+ *   Continue  - call again right away
+ *   Finished  - the stage is done (aborted)
+ *   > 0       - nothing to do, call again after that many ms or when the event fires
+ *
+ * The stage runs either on a dedicated thread or, when started with an executor, as
+ * an executor task that parks on its event instead of blocking a pool thread.
+ */
+class PipelineStage : public Executor::Task, private WaitEvent::Listener
+{
+public:
+    typedef std::function<int64_t ()> Step;
+
+    enum { Continue = 0, Finished = -1 };
+
+    PipelineStage(const char * name, WaitEvent & event, PipelineMetrics & metrics,
+                  PipelineMetrics::Thread slot, Step step);
+    ~PipelineStage();
+
+    PipelineStage(const PipelineStage&) = delete;
+    PipelineStage& operator=(const PipelineStage&) = delete;
+
+    //executor == nullptr runs the stage on its own thread
+    void start(Executor * executor = nullptr, Executor::Group * group = nullptr);
+    bool joinable() const { return mStarted; }
+    void join();
+
+private:
+    typedef enum {
+        Idle = 0,   //parked on the event or a timer
+        Queued,
+        Running,
+        Rerun,      //woken while running
+        Done
+    } State;
+
+    void threadLoop();
+    void run() override;
+    void onTimer() override { wake(); }
+    void onNotify() override { wake(); }
+    void wake();
+    void accountCpu();
+    void finish();
+
+private:
+    const char * mName;
+    WaitEvent & mEvent;
+    PipelineMetrics & mMetrics;
+    PipelineMetrics::Thread mSlot;
+    Step mStep;
+    Executor * mExecutor;
+    std::thread mThread;
+    bool mStarted;
+    std::atomic_int mState;
+    int64_t mCpuTime;
+    std::mutex mDoneMutex;
+    std::condition_variable mDoneCond;
+};
+
+}
+
+#endif // PIPELINESTAGE_HPP
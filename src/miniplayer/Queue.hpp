@@ -4,22 +4,103 @@
 extern "C"
 {
 #include <libavformat/avformat.h>
+#include <libavutil/time.h>
 }
 
-#include <list>
-#include <mutex>
-#include <thread>
+#include <atomic>
+#include <memory>
+#include <algorithm>
 #include <QDebug>
 
+#include "RingBuffer.hpp"
+#include "WaitEvent.hpp"
+#include "FramePool.hpp"
+
 namespace miniplayer
 {
 
-class AVFrameQueue
+/*
+ * Both queues are single-producer/single-consumer: append() and flush() belong to the
+ * producer thread, acquire() and collect() to the consumer thread. clear() may only be
+ * called while the producer is not running (or by the consumer itself).
+ *
+ * Appending wakes the consumer event, consuming wakes the producer event. The events
+ * default to ones owned by the queue and can be shared with other queues through
+ * setEvents() so that a stage waiting on several queues sleeps on a single event.
+ *
+ * With timestamping enabled every entry remembers when it was appended (monotonic us)
+ * and acquire() hands that time back, so callers can measure the time spent queued.
+ */
+
+class QueueEvents
 {
 public:
-    AVFrameQueue() :
+    QueueEvents() :
+        mConsumerEvent(&mOwnConsumerEvent),
+        mProducerEvent(&mOwnProducerEvent),
+        mAborted(false),
+        mTimestamping(false)
+    {}
+
+    void setEvents(WaitEvent * consumerEvent, WaitEvent * producerEvent)
+    {
+        mConsumerEvent = consumerEvent ? consumerEvent : &mOwnConsumerEvent;
+        mProducerEvent = producerEvent ? producerEvent : &mOwnProducerEvent;
+    }
+
+    void abort()
+    {
+        mAborted = true;
+        mConsumerEvent->notify();
+        mProducerEvent->notify();
+    }
+
+    void reset()
+    {
+        mAborted = false;
+    }
+
+    bool isAborted() const
+    {
+        return mAborted;
+    }
+
+    void setTimestamping(bool val)
+    {
+        mTimestamping = val;
+    }
+
+protected:
+    int64_t timestamp() const
+    {
+        return mTimestamping.load(std::memory_order_relaxed) ? av_gettime_relative() : 0;
+    }
+
+protected:
+    WaitEvent * mConsumerEvent;
+    WaitEvent * mProducerEvent;
+    std::atomic_bool mAborted;
+    std::atomic_bool mTimestamping;
+
+private:
+    WaitEvent mOwnConsumerEvent;
+    WaitEvent mOwnProducerEvent;
+};
+
+class AVFrameQueue : public QueueEvents
+{
+public:
+    typedef struct {
+        AVFrame * frame;
+        int64_t time;
+    } Entry;
+
+    AVFrameQueue(size_t capacity = 128) :
+        mRing(capacity),
         mTimeBase(0),
-        mDuration(0)
+        mAppendedDuration(0),
+        mAcquiredDuration(0),
+        mFlushedDuration(0)
     {}
 
     ~AVFrameQueue()
@@ -27,41 +108,80 @@ public:
         clear();
     }
 
-    void append(AVFrame* frame)
+    bool append(AVFrame* frame)
     {
         //qDebug() << __FUNCTION__;
-        std::lock_guard<std::mutex> l(mMutex);
-        mDatas.push_back(frame);
-        mDuration += static_cast<int64_t>(frame->pkt_duration * mTimeBase * 1000);
+        auto duration = frameDuration(frame);
+        mAppendedDuration.store(mAppendedDuration.load(std::memory_order_relaxed) + duration, std::memory_order_relaxed);
+        Entry entry = { frame, timestamp() };
+        if(mRing.push(entry))
+        {
+            mConsumerEvent->notify();
+            return true;
+        }
+        mAppendedDuration.store(mAppendedDuration.load(std::memory_order_relaxed) - duration, std::memory_order_relaxed);
+        return false;
     }
 
-    bool acquire(AVFrame** frame)
+    void flush()
     {
-        std::lock_guard<std::mutex> l(mMutex);
-        if (mDatas.size() == 0)
-            return false;
-        *frame = mDatas.front();
-        mDatas.pop_front();
-        mDuration -= static_cast<int64_t>((*frame)->pkt_duration * mTimeBase * 1000);
-        return true;
+        mFlushedDuration.store(mAppendedDuration.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        mRing.flush();
+        mConsumerEvent->notify();
     }
 
-    void clear()
+    bool acquire(AVFrame** frame, int64_t * enqueueTime = nullptr)
     {
-        std::lock_guard<std::mutex> l(mMutex);
-        if(mDatas.size() > 0)
+        auto discard = [this](Entry& entry) { release(entry.frame); };
+        for(;;)
         {
-            mDuration = 0;
-            for (auto& data : mDatas)
-                av_frame_free(&data);
-            mDatas.clear();
+            Entry entry;
+            auto result = mRing.pop(entry, discard);
+            if(result == SPSCRing<Entry>::Flushed)
+                continue;
+            if(result == SPSCRing<Entry>::Empty)
+                return false;
+            *frame = entry.frame;
+            if(enqueueTime)
+                *enqueueTime = entry.time;
+            mAcquiredDuration.fetch_add(frameDuration(*frame), std::memory_order_relaxed);
+            mProducerEvent->notify();
+            return true;
         }
     }
 
+    bool flushPending() const
+    {
+        return mRing.flushPending();
+    }
+
+    void collect()
+    {
+        if(!mRing.flushPending())
+            return;
+        mRing.collect([this](Entry& entry) { release(entry.frame); });
+        mProducerEvent->notify();
+    }
+
+    void clear()
+    {
+        mRing.clear([this](Entry& entry) { release(entry.frame); });
+    }
+
     std::size_t size() const
     {
-        std::lock_guard<std::mutex> l(mMutex);
-        return mDatas.size();
+        return mRing.size();
+    }
+
+    bool isFull() const
+    {
+        return mRing.full();
+    }
+
+    //discarded frames go back to the pool instead of being freed
+    void setPool(const std::shared_ptr<AVFramePool> & pool)
+    {
+        mPool = pool;
     }
 
     void setTimeBase(double timeBase)
@@ -71,97 +191,226 @@ public:
 
     double duration() const
     {
-        return mDuration / 1000.f;
+        int64_t consumed = std::max(mAcquiredDuration.load(std::memory_order_relaxed),
+                                    mFlushedDuration.load(std::memory_order_relaxed));
+        return (mAppendedDuration.load(std::memory_order_relaxed) - consumed) / 1000.f;
+    }
+
+private:
+    int64_t frameDuration(AVFrame* frame) const
+    {
+        return static_cast<int64_t>(frame->pkt_duration * mTimeBase * 1000);
+    }
+
+    void release(AVFrame*& frame)
+    {
+        mAcquiredDuration.fetch_add(frameDuration(frame), std::memory_order_relaxed);
+        if(mPool)
+            mPool->release(&frame);
+        else
+            av_frame_free(&frame);
     }
 
 private:
-    mutable std::mutex mMutex;
-    std::list<AVFrame *> mDatas;
+    SPSCRing<Entry> mRing;
+    std::shared_ptr<AVFramePool> mPool;
     double mTimeBase;
-    int64_t mDuration;
+    std::atomic<int64_t> mAppendedDuration;
+    std::atomic<int64_t> mAcquiredDuration;
+    std::atomic<int64_t> mFlushedDuration;
 };
 
-class AVPacketQueue
+/*
+ * Packets travel by reference: append() moves the demuxer's buffer reference into a
+ * pooled AVPacket shell and the decoder gets that shell back from acquire(). Payloads
+ * are only copied when the demuxer hands out a packet without a buffer reference.
+ * The consumer returns shells through recycle(), they flow back to the producer on a
+ * second ring so neither side allocates in steady state.
+ */
+class AVPacketQueue : public QueueEvents
 {
 public:
-    AVPacketQueue() :
-        mDataSize(0),
+    typedef struct {
+        AVPacket * packet;
+        int64_t time;
+    } Entry;
+
+    AVPacketQueue(size_t capacity = 4096) :
+        mRing(capacity),
+        mFreeShells(capacity + 2),
         mTimeBase(0),
-        mDuration(0)
+        mShellsAllocated(0),
+        mAppendedDataSize(0),
+        mAcquiredDataSize(0),
+        mFlushedDataSize(0),
+        mAppendedDuration(0),
+        mAcquiredDuration(0),
+        mFlushedDuration(0)
     {
         av_init_packet(&mFlushPacket);
-        mFlushPacket.data = (uint8_t *)&mFlushPacket;
+        mFlushPacket.data = nullptr;
         mFlushPacket.size = 0;
+        av_init_packet(&mDrainPacket);
+        mDrainPacket.data = nullptr;
+        mDrainPacket.size = 0;
+        av_init_packet(&mSwitchPacket);
+        mSwitchPacket.data = nullptr;
+        mSwitchPacket.size = 0;
     }
 
     ~AVPacketQueue()
     {
         clear();
+        AVPacket * shell = nullptr;
+        while(mFreeShells.pop(shell, [](AVPacket *&) {}) == SPSCRing<AVPacket *>::Item)
+            av_packet_free(&shell);
     }
 
-    void append(const AVPacket& pkt)
+    //takes over the packet's reference on success, leaves it untouched otherwise
+    bool append(AVPacket& pkt)
     {
         //qDebug() << __FUNCTION__;
-        std::lock_guard<std::mutex> l(mMutex);
-        mDatas.push_back(pkt);
-        mDataSize += pkt.size;
-        mDuration += static_cast<int64_t>(pkt.duration * mTimeBase * 1000);
+        //only we push, so a ring that is not full now still has room below
+        if(mRing.full())
+            return false;
+
+        AVPacket * shell = takeShell();
+        if(!shell)
+            return false;
+        if(pkt.buf)
+            av_packet_move_ref(shell, &pkt);
+        else if(av_packet_ref(shell, &pkt) == 0)   //the demuxer owns the data, the only copy left
+            av_packet_unref(&pkt);
+        else
+        {
+            av_packet_free(&shell);
+            return false;
+        }
+
+        mAppendedDataSize.store(mAppendedDataSize.load(std::memory_order_relaxed) + shell->size, std::memory_order_relaxed);
+        mAppendedDuration.store(mAppendedDuration.load(std::memory_order_relaxed) + packetDuration(shell), std::memory_order_relaxed);
+        Entry entry = { shell, timestamp() };
+        mRing.push(entry);
+        mConsumerEvent->notify();
+        return true;
     }
 
+    //drops everything queued so far, the consumer then acquires the flush packet first
     void appendFlushPacket()
     {
         //qDebug() << __FUNCTION__;
-        std::lock_guard<std::mutex> l(mMutex);
-        mDatas.push_back(mFlushPacket);
+        mFlushedDataSize.store(mAppendedDataSize.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        mFlushedDuration.store(mAppendedDuration.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        mRing.flush();
+        mConsumerEvent->notify();
     }
 
-    bool acquire(AVPacket& pkt)
+    //end of stream marker, queued in order so the decoder drains its delayed frames after the last packet
+    bool appendDrainPacket()
     {
-        std::lock_guard<std::mutex> l(mMutex);
-        if (mDatas.size() == 0)
+        Entry entry = { &mDrainPacket, timestamp() };
+        if(!mRing.push(entry))
             return false;
-        pkt = mDatas.front();
-        mDatas.pop_front();
-        mDataSize -= pkt.size;
-        mDuration -= static_cast<int64_t>(pkt.duration * mTimeBase * 1000);
+        mConsumerEvent->notify();
         return true;
     }
 
-    void clear()
+    //next input marker, the decoder drains what it holds of the current input and moves on to the next one's codec
+    bool appendSwitchPacket()
     {
-        std::lock_guard<std::mutex> l(mMutex);
-        if(mDatas.size() > 0)
+        Entry entry = { &mSwitchPacket, timestamp() };
+        if(!mRing.push(entry))
+            return false;
+        mConsumerEvent->notify();
+        return true;
+    }
+
+    //the packet stays owned by the queue, hand it back through recycle()
+    bool acquire(AVPacket** pkt, int64_t * enqueueTime = nullptr)
+    {
+        Entry entry;
+        auto result = mRing.pop(entry, [this](Entry& data) { release(data.packet); });
+        if(result == SPSCRing<Entry>::Empty)
+            return false;
+        mProducerEvent->notify();
+        if(result == SPSCRing<Entry>::Flushed)
         {
-            mDataSize = 0;
-            mDuration = 0;
-            for (auto& pkt : mDatas)
-            {
-                if(!isFlushPacket(pkt))
-                    av_free_packet(&pkt);
-            }
-            mDatas.clear();
+            *pkt = &mFlushPacket;
+            if(enqueueTime)
+                *enqueueTime = 0;
+            return true;
         }
+        *pkt = entry.packet;
+        if(enqueueTime)
+            *enqueueTime = entry.time;
+        mAcquiredDataSize.fetch_add((*pkt)->size, std::memory_order_relaxed);
+        mAcquiredDuration.fetch_add(packetDuration(*pkt), std::memory_order_relaxed);
+        return true;
+    }
+
+    //consumer side, drops the reference and returns the shell to the producer
+    void recycle(AVPacket * pkt)
+    {
+        if(isFlushPacket(pkt) || isDrainPacket(pkt) || isSwitchPacket(pkt))
+            return;
+        av_packet_unref(pkt);
+        if(!mFreeShells.push(pkt))
+            av_packet_free(&pkt);
+    }
+
+    bool flushPending() const
+    {
+        return mRing.flushPending();
+    }
+
+    void clear()
+    {
+        mRing.clear([this](Entry& data) { release(data.packet); });
     }
 
     std::size_t size() const
     {
-        std::lock_guard<std::mutex> l(mMutex);
-        return mDatas.size();
+        return mRing.size();
+    }
+
+    bool isFull() const
+    {
+        return mRing.full();
     }
 
     int64_t dataSize() const
     {
-        return mDataSize;
+        int64_t consumed = std::max(mAcquiredDataSize.load(std::memory_order_relaxed),
+                                    mFlushedDataSize.load(std::memory_order_relaxed));
+        return mAppendedDataSize.load(std::memory_order_relaxed) - consumed;
     }
 
     double duration() const
     {
-        return mDuration / 1000.f;
+        int64_t consumed = std::max(mAcquiredDuration.load(std::memory_order_relaxed),
+                                    mFlushedDuration.load(std::memory_order_relaxed));
+        return (mAppendedDuration.load(std::memory_order_relaxed) - consumed) / 1000.f;
+    }
+
+    //shells ever allocated, stays flat once the pool is warm
+    int64_t shellsAllocated() const
+    {
+        return mShellsAllocated.load(std::memory_order_relaxed);
+    }
+
+    bool isFlushPacket(const AVPacket * pkt) const
+    {
+        return pkt == &mFlushPacket;
     }
 
-    bool isFlushPacket(AVPacket & pkt) const
+    bool isDrainPacket(const AVPacket * pkt) const
     {
-        return pkt.data == (uint8_t *)&mFlushPacket;
+        return pkt == &mDrainPacket;
+    }
+
+    bool isSwitchPacket(const AVPacket * pkt) const
+    {
+        return pkt == &mSwitchPacket;
     }
 
     void setTimeBase(double timeBase)
@@ -170,12 +419,43 @@ public:
     }
 
 private:
-    mutable std::mutex mMutex;
-    std::list<AVPacket> mDatas;
+    int64_t packetDuration(const AVPacket * pkt) const
+    {
+        return static_cast<int64_t>(pkt->duration * mTimeBase * 1000);
+    }
+
+    AVPacket * takeShell()
+    {
+        AVPacket * shell = nullptr;
+        if(mFreeShells.pop(shell, [](AVPacket *&) {}) == SPSCRing<AVPacket *>::Item)
+            return shell;
+        mShellsAllocated.fetch_add(1, std::memory_order_relaxed);
+        return av_packet_alloc();
+    }
+
+    void release(AVPacket * pkt)
+    {
+        if(isDrainPacket(pkt) || isSwitchPacket(pkt))
+            return;
+        mAcquiredDataSize.fetch_add(pkt->size, std::memory_order_relaxed);
+        mAcquiredDuration.fetch_add(packetDuration(pkt), std::memory_order_relaxed);
+        recycle(pkt);
+    }
+
+private:
+    SPSCRing<Entry> mRing;
+    SPSCRing<AVPacket *> mFreeShells;   //consumer -> producer
     AVPacket mFlushPacket;
-    int64_t mDataSize;
+    AVPacket mDrainPacket;
+    AVPacket mSwitchPacket;
     double mTimeBase;
-    int64_t mDuration;
+    std::atomic<int64_t> mShellsAllocated;
+    std::atomic<int64_t> mAppendedDataSize;
+    std::atomic<int64_t> mAcquiredDataSize;
+    std::atomic<int64_t> mFlushedDataSize;
+    std::atomic<int64_t> mAppendedDuration;
+    std::atomic<int64_t> mAcquiredDuration;
+    std::atomic<int64_t> mFlushedDuration;
 };
 
 }
@@ -0,0 +1,386 @@
+#include "ReadAheadIO.hpp"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <functional>
+#include <QDebug>
+
+extern "C"
+{
+#include <libavutil/time.h>
+}
+
+using namespace miniplayer;
+
+static const int64_t MinCapacity = 1024 * 1024;
+static const int IOBufferSize = 32 * 1024;          //the demuxer's AVIOContext buffer
+static const int ChunkSize = 64 * 1024;             //read from the input at a time, and the range size of one connection
+static const int64_t ParallelRangeSize = 2 * 1024 * 1024;  //range size with several connections, each one is a new request
+static const int MaxConnections = 8;
+static const int PollInterval = 10;                 //ms between interrupt checks while waiting
+static const int RetryInterval = 10;                //ms before the input is read again after EAGAIN
+
+ReadAheadIO::ReadAheadIO(int64_t capacity, int connections) :
+    mRing(static_cast<size_t>(std::max(capacity, MinCapacity))),
+    mBackReserve(static_cast<int64_t>(mRing.size()) / 4),
+    mInput(nullptr),
+    mContext(nullptr),
+    mSize(-1),
+    mMaxConnections(std::min(std::max(connections, 1), MaxConnections)),
+    mRangeSize(ChunkSize),
+    mOpening(false),
+    mStop(false),
+    mStart(0),
+    mEnd(0),
+    mReadPos(0),
+    mClaimEnd(0),
+    mGeneration(0),
+    mEof(false),
+    mError(0),
+    mStalls(0),
+    mStallTime(0),
+    mWindowSeeks(0),
+    mInputSeeks(0),
+    mConnections(0),
+    mBytesRead(0)
+{
+    mInterrupt.callback = nullptr;
+    mInterrupt.opaque = nullptr;
+}
+
+ReadAheadIO::~ReadAheadIO()
+{
+    {
+        std::lock_guard<std::mutex> l(mMutex);
+        mStop = true;
+    }
+    mIOCond.notify_all();
+    mReadCond.notify_all();
+    for(auto & thread : mThreads)
+        thread.join();
+
+    if(mContext)
+    {
+        av_freep(&mContext->buffer);
+        av_freep(&mContext);
+    }
+    avio_closep(&mInput);
+}
+
+bool ReadAheadIO::open(const std::string & url, const AVIOInterruptCB & interrupt)
+{
+    mInterrupt = interrupt;
+
+    //the player may abort the open, afterwards the input only stops with this object
+    AVIOInterruptCB inputInterrupt = { &ReadAheadIO::onInputInterrupt, this };
+    mOpening = true;
+    int ret = avio_open2(&mInput, url.c_str(), AVIO_FLAG_READ, &inputInterrupt, nullptr);
+    mOpening = false;
+    if(ret < 0)
+    {
+        qWarning() << __FUNCTION__ << "avio_open2" << "failure" << ret;
+        return false;
+    }
+    mSize = avio_size(mInput);
+
+    uint8_t * buffer = static_cast<uint8_t *>(av_malloc(IOBufferSize));
+    mContext = avio_alloc_context(buffer, IOBufferSize, 0, this, &ReadAheadIO::onRead, nullptr, &ReadAheadIO::onSeek);
+    if(!mContext)
+    {
+        qWarning() << __FUNCTION__ << "avio_alloc_context" << "failure";
+        av_free(buffer);
+        return false;
+    }
+    mContext->seekable = mInput->seekable;
+
+    //ranges in parallel only where the input can be seeked and its end is known
+    int connections = 1;
+    if(mMaxConnections > 1 && mSize > 0 && (mInput->seekable & AVIO_SEEKABLE_NORMAL))
+    {
+        connections = mMaxConnections;
+        mRangeSize = ParallelRangeSize;
+    }
+
+    qDebug() << __FUNCTION__ << "capacity:" << mRing.size() << "size:" << mSize << "seekable:" << mInput->seekable
+             << "connections:" << connections;
+    mUrl = url;
+    mConnections = 1;
+    for(int i = 0; i < connections; i++)
+        mThreads.push_back(std::thread(&ReadAheadIO::ioThread, this, i));
+    return true;
+}
+
+void ReadAheadIO::dump(Info & info) const
+{
+    std::lock_guard<std::mutex> l(mMutex);
+    info.capacity = static_cast<int64_t>(mRing.size());
+    info.fill = mEnd - mReadPos;
+    info.stalls = mStalls;
+    info.stallTime = mStallTime / 1000.0;
+    info.windowSeeks = mWindowSeeks;
+    info.inputSeeks = mInputSeeks;
+    info.connections = mConnections;
+    info.bytesRead = mBytesRead;
+}
+
+//the next range fits into the read-ahead part of the ring, a quarter stays behind the read position
+bool ReadAheadIO::canClaim() const
+{
+    int64_t capacity = static_cast<int64_t>(mRing.size());
+    if(mError != 0 || mEof || (mSize >= 0 && mClaimEnd >= mSize))
+        return false;
+    //without a known end there is only one range at a time, it may be cut short
+    if(mSize < 0 && !mRanges.empty())
+        return false;
+    return mClaimEnd - mReadPos + mRangeSize <= capacity - mBackReserve;
+}
+
+//publishes the complete ranges at the front and the filled part of the first incomplete one
+void ReadAheadIO::advanceEnd()
+{
+    int64_t end = mEnd;
+    while(!mRanges.empty())
+    {
+        const Range & range = mRanges.front();
+        end = range.start + range.filled;
+        if(range.filled < range.size)
+            break;
+        mRanges.pop_front();
+    }
+    if(mRanges.empty())
+        end = mClaimEnd;
+    if(end == mEnd)
+        return;
+    mEnd = end;
+    if(mSize >= 0 && mEnd >= mSize)
+        mEof = true;
+    mReadCond.notify_all();
+}
+
+void ReadAheadIO::ioThread(int index)
+{
+    qDebug() << __FUNCTION__ << index << "start";
+
+    //the first connection is the one opened by open(), the others open their own on first use
+    AVIOContext * input = index == 0 ? mInput : nullptr;
+    int64_t inputPos = 0;
+    std::unique_ptr<int, std::function<void (int *)>> scope((int *)1, [&](void*)
+    {
+        if(input != mInput)
+            avio_closep(&input);
+    });
+
+    std::vector<uint8_t> chunk(ChunkSize);
+    int64_t capacity = static_cast<int64_t>(mRing.size());
+    std::unique_lock<std::mutex> l(mMutex);
+    for(; !mStop; )
+    {
+        mIOCond.wait(l, [&] { return mStop || canClaim(); });
+        if(mStop)
+            break;
+
+        if(!input)
+        {
+            l.unlock();
+            AVIOInterruptCB inputInterrupt = { &ReadAheadIO::onInputInterrupt, this };
+            int ret = avio_open2(&input, mUrl.c_str(), AVIO_FLAG_READ, &inputInterrupt, nullptr);
+            l.lock();
+            if(ret < 0)
+            {
+                //the others carry on without this connection
+                qWarning() << __FUNCTION__ << index << "avio_open2" << "failure" << ret;
+                break;
+            }
+            inputPos = 0;
+            mConnections ++;
+            continue;
+        }
+
+        //claiming overwrites the oldest part of the ring, the window shrinks accordingly
+        uint64_t generation = mGeneration;
+        int64_t rangeStart = mClaimEnd;
+        int64_t rangeSize = mSize >= 0 ? std::min(mRangeSize, mSize - rangeStart) : mRangeSize;
+        mClaimEnd += rangeSize;
+        mStart = std::max(mStart, mClaimEnd - capacity);
+        mRanges.push_back(Range{rangeStart, rangeSize, 0});
+        Range & range = mRanges.back();
+
+        if(inputPos != rangeStart)
+        {
+            l.unlock();
+            int64_t ret = avio_seek(input, rangeStart, SEEK_SET);
+            l.lock();
+            inputPos = ret >= 0 ? rangeStart : -1;
+            if(ret < 0)
+            {
+                if(generation == mGeneration)
+                {
+                    qWarning() << __FUNCTION__ << index << "avio_seek" << rangeStart << "failure" << ret;
+                    mError = static_cast<int>(ret);
+                    mReadCond.notify_all();
+                }
+                continue;
+            }
+        }
+
+        //the range goes into the ring chunk by chunk, so the demuxer can start on it before it is complete
+        while(!mStop && generation == mGeneration)
+        {
+            int size = static_cast<int>(std::min<int64_t>(ChunkSize, range.size - range.filled));
+            l.unlock();
+            int ret = avio_read(input, chunk.data(), size);
+            l.lock();
+            if(ret > 0)
+            {
+                inputPos += ret;
+                mBytesRead += ret;
+            }
+
+            //a seek restarted the ring while we were reading, the range is gone
+            if(generation != mGeneration)
+                break;
+
+            if(ret > 0)
+            {
+                int64_t offset = (range.start + range.filled) % capacity;
+                int64_t first = std::min<int64_t>(ret, capacity - offset);
+                memcpy(mRing.data() + offset, chunk.data(), first);
+                memcpy(mRing.data(), chunk.data() + first, ret - first);
+                range.filled += ret;
+                //a complete range may be published and dropped right away
+                bool complete = range.filled == range.size;
+                advanceEnd();
+                if(complete)
+                    break;
+            }
+            else if(ret == AVERROR_EOF || (ret == 0 && avio_feof(input)))
+            {
+                if(mSize >= 0)
+                {
+                    qWarning() << __FUNCTION__ << index << "input ended early at" << inputPos;
+                    mError = AVERROR_EOF;
+                    mReadCond.notify_all();
+                    break;
+                }
+                qDebug() << __FUNCTION__ << "end of input at" << range.start + range.filled;
+                range.size = range.filled;
+                mClaimEnd = range.start + range.filled;
+                advanceEnd();
+                mEof = true;
+                mReadCond.notify_all();
+                break;
+            }
+            else if(ret == AVERROR(EAGAIN) || ret == 0)
+                mIOCond.wait_for(l, std::chrono::milliseconds(RetryInterval));
+            else if(!mStop)
+            {
+                qWarning() << __FUNCTION__ << index << "avio_read" << "failure" << ret;
+                mError = ret;
+                mReadCond.notify_all();
+                break;
+            }
+        }
+    }
+    if(input && input != mInput)
+        mConnections --;
+
+    qDebug() << __FUNCTION__ << index << "end";
+}
+
+int ReadAheadIO::read(uint8_t * buf, int size)
+{
+    std::unique_lock<std::mutex> l(mMutex);
+    if(mReadPos == mEnd && !mEof && mError == 0)
+    {
+        int64_t stallStart = av_gettime_relative();
+        mStalls ++;
+        while(mReadPos == mEnd && !mEof && mError == 0 && !mStop)
+        {
+            if(interrupted())
+                break;
+            mReadCond.wait_for(l, std::chrono::milliseconds(PollInterval));
+        }
+        mStallTime += av_gettime_relative() - stallStart;
+    }
+
+    if(mReadPos < mEnd)
+    {
+        int64_t capacity = static_cast<int64_t>(mRing.size());
+        int count = static_cast<int>(std::min<int64_t>(size, mEnd - mReadPos));
+        int64_t offset = mReadPos % capacity;
+        int first = static_cast<int>(std::min<int64_t>(count, capacity - offset));
+        memcpy(buf, mRing.data() + offset, first);
+        memcpy(buf + first, mRing.data(), count - first);
+        mReadPos += count;
+        mIOCond.notify_all();
+        return count;
+    }
+    if(mError != 0)
+        return mError;
+    if(mEof)
+        return AVERROR_EOF;
+    return AVERROR_EXIT;
+}
+
+int64_t ReadAheadIO::seek(int64_t offset, int whence)
+{
+    whence &= ~AVSEEK_FORCE;
+    if(whence == AVSEEK_SIZE)
+        return mSize >= 0 ? mSize : AVERROR(ENOSYS);
+
+    std::lock_guard<std::mutex> l(mMutex);
+    int64_t target = offset;
+    if(whence == SEEK_CUR)
+        target += mReadPos;
+    else if(whence == SEEK_END)
+    {
+        if(mSize < 0)
+            return AVERROR(ENOSYS);
+        target += mSize;
+    }
+    else if(whence != SEEK_SET)
+        return AVERROR(EINVAL);
+    if(target < 0)
+        return AVERROR(EINVAL);
+
+    if(target >= mStart && target <= mEnd)
+    {
+        mReadPos = target;
+        mWindowSeeks ++;
+        mIOCond.notify_all();
+        return target;
+    }
+    if(!(mContext->seekable & AVIO_SEEKABLE_NORMAL))
+        return AVERROR(EPIPE);
+
+    //the ring starts over at the target, the I/O threads claim from there
+    mStart = mEnd = mReadPos = mClaimEnd = target;
+    mRanges.clear();
+    mGeneration ++;
+    mEof = false;
+    mError = 0;
+    mInputSeeks ++;
+    mIOCond.notify_all();
+    return target;
+}
+
+bool ReadAheadIO::interrupted() const
+{
+    return mInterrupt.callback && mInterrupt.callback(mInterrupt.opaque);
+}
+
+int ReadAheadIO::onRead(void * opaque, uint8_t * buf, int size)
+{
+    return static_cast<ReadAheadIO *>(opaque)->read(buf, size);
+}
+
+int64_t ReadAheadIO::onSeek(void * opaque, int64_t offset, int whence)
+{
+    return static_cast<ReadAheadIO *>(opaque)->seek(offset, whence);
+}
+
+int ReadAheadIO::onInputInterrupt(void * opaque)
+{
+    ReadAheadIO * io = static_cast<ReadAheadIO *>(opaque);
+    return io->mStop || (io->mOpening && io->interrupted());
+}
@@ -0,0 +1,125 @@
+#ifndef READAHEADIO_HPP
+#define READAHEADIO_HPP
+
+extern "C"
+{
+#include <libavformat/avformat.h>
+}
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <deque>
+#include <string>
+#include <cstdint>
+
+namespace miniplayer
+{
+
+/*
+ * Custom AVIOContext in front of the real input: an I/O thread keeps reading the input
+ * into a byte ring, the demuxer reads from the ring. A network stall then only empties
+ * the ring instead of blocking av_read_frame(), and a slow read no longer holds up the
+ * read thread's seek/trick handling.
+ *
+ * The ring keeps up to a quarter of its size behind the read position, so seeks inside
+ * [start, end) of what was read are served from memory without a new request. A seek
+ * outside of it restarts the ring at the target and the I/O threads continue from there,
+ * the demuxer's next read waits for the data.
+ *
+ * Seekable inputs of known size (VOD over HTTP) can be fetched over several connections:
+ * every I/O thread claims the next byte range ahead of the demuxer, seeks its own
+ * connection there (a new range request) and fills its part of the ring, the demuxer sees
+ * the ranges in order as the oldest one fills. A single connection claims small ranges
+ * one after the other and never seeks.
+ *
+ * The demuxer side (read/seek callbacks) belongs to the player's read thread and gives up
+ * waiting when the player's interrupt callback fires, the I/O threads are only stopped by
+ * the destructor.
+ */
+class ReadAheadIO
+{
+public:
+    typedef struct {
+        int64_t capacity;       //bytes
+        int64_t fill;           //bytes read ahead of the demuxer
+        int64_t stalls;         //demuxer reads that found the ring empty
+        double stallTime;       //ms the demuxer spent waiting on an empty ring
+        int64_t windowSeeks;    //seeks served from the ring
+        int64_t inputSeeks;     //seeks that went to the input
+        int connections;        //input connections reading
+        int64_t bytesRead;      //from the input, including ranges dropped by seeks
+    } Info;
+
+    //connections only apply to seekable inputs of known size
+    ReadAheadIO(int64_t capacity, int connections);
+    ~ReadAheadIO();
+
+    ReadAheadIO(const ReadAheadIO&) = delete;
+    ReadAheadIO& operator=(const ReadAheadIO&) = delete;
+
+    //opens url and starts the I/O threads, interrupt is the player's and only aborts the open and demuxer waits
+    bool open(const std::string & url, const AVIOInterruptCB & interrupt);
+
+    //to be set as AVFormatContext::pb, owned by this object
+    AVIOContext * context() const { return mContext; }
+
+    void dump(Info & info) const;
+
+private:
+    typedef struct {
+        int64_t start;
+        int64_t size;
+        int64_t filled;
+    } Range;
+
+    void ioThread(int index);
+    bool canClaim() const;
+    void advanceEnd();
+    int read(uint8_t * buf, int size);
+    int64_t seek(int64_t offset, int whence);
+    bool interrupted() const;
+
+    static int onRead(void * opaque, uint8_t * buf, int size);
+    static int64_t onSeek(void * opaque, int64_t offset, int whence);
+    static int onInputInterrupt(void * opaque);
+
+private:
+    std::vector<uint8_t> mRing;
+    int64_t mBackReserve;           //bytes kept behind the read position for backward seeks
+    AVIOContext * mInput;
+    AVIOContext * mContext;
+    AVIOInterruptCB mInterrupt;
+    std::string mUrl;
+    int64_t mSize;                  //input size, -1 when unknown
+    int mMaxConnections;
+    int64_t mRangeSize;             //bytes claimed at a time
+    std::vector<std::thread> mThreads;
+    std::atomic_bool mOpening;
+    std::atomic_bool mStop;
+
+    mutable std::mutex mMutex;
+    std::condition_variable mIOCond;        //I/O threads: room in the ring, a seek, stop
+    std::condition_variable mReadCond;      //demuxer: data, end of input, error
+    int64_t mStart;                 //input offset of the oldest byte in the ring
+    int64_t mEnd;                   //input offset after the newest byte
+    int64_t mReadPos;               //demuxer position, start <= pos <= end
+    int64_t mClaimEnd;              //input offset after the newest claimed range
+    std::deque<Range> mRanges;      //claimed and not complete yet, in input order; elements never move
+    uint64_t mGeneration;           //bumped when a seek restarts the ring, drops the claimed ranges
+    bool mEof;
+    int mError;
+
+    int64_t mStalls;
+    int64_t mStallTime;             //us
+    int64_t mWindowSeeks;
+    int64_t mInputSeeks;
+    int mConnections;
+    int64_t mBytesRead;
+};
+
+}
+
+#endif // READAHEADIO_HPP
@@ -0,0 +1,284 @@
+#ifndef RINGBUFFER_HPP
+#define RINGBUFFER_HPP
+
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+
+namespace miniplayer
+{
+
+#define MINIPLAYER_CACHE_LINE_SIZE 64
+
+/*
+ * Bounded lock-free ring for exactly one producer thread and one consumer thread.
+ *
+ * Besides push/pop the producer may flush() the ring: every entry written so far
+ * becomes stale and the consumer discards it on its next pop, which then reports
+ * PopResult::Flushed once before handing out the entries written after the flush.
+ * Consecutive flushes that the consumer has not seen yet collapse into one.
+ */
+template<typename T>
+class SPSCRing
+{
+public:
+    typedef enum {
+        Empty = 0,
+        Item,
+        Flushed
+    } PopResult;
+
+    explicit SPSCRing(size_t capacity) :
+        mMask(roundUpPowerOfTwo(capacity) - 1),
+        mSlots(mMask + 1),
+        mHead(0),
+        mCachedTail(0),
+        mSeenFlushSerial(0),
+        mTail(0),
+        mCachedHead(0),
+        mFlushIndex(0),
+        mFlushSerial(0)
+    {}
+
+    SPSCRing(const SPSCRing&) = delete;
+    SPSCRing& operator=(const SPSCRing&) = delete;
+
+    //producer ------------------------------------------------------------------
+
+    bool push(const T& value)
+    {
+        uint64_t tail = mTail.load(std::memory_order_relaxed);
+        if(tail - mCachedHead > mMask)
+        {
+            mCachedHead = mHead.load(std::memory_order_acquire);
+            if(tail - mCachedHead > mMask)
+                return false;
+        }
+        mSlots[tail & mMask] = value;
+        mTail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool full() const
+    {
+        return mTail.load(std::memory_order_relaxed) - mHead.load(std::memory_order_acquire) > mMask;
+    }
+
+    void flush()
+    {
+        mFlushIndex.store(mTail.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        mFlushSerial.fetch_add(1, std::memory_order_release);
+    }
+
+    //consumer ------------------------------------------------------------------
+
+    template<typename Discard>
+    PopResult pop(T& value, Discard&& discard)
+    {
+        for(;;)
+        {
+            uint64_t serial = mFlushSerial.load(std::memory_order_acquire);
+            if(serial != mSeenFlushSerial)
+            {
+                discardTo(mFlushIndex.load(std::memory_order_relaxed), discard);
+                mSeenFlushSerial = serial;
+                return PopResult::Flushed;
+            }
+
+            uint64_t head = mHead.load(std::memory_order_relaxed);
+            if(head == mCachedTail)
+            {
+                mCachedTail = mTail.load(std::memory_order_acquire);
+                if(head == mCachedTail)
+                    return PopResult::Empty;
+            }
+
+            //the entry may have been written after a flush we have not observed yet
+            if(mFlushSerial.load(std::memory_order_acquire) != serial)
+                continue;
+
+            value = mSlots[head & mMask];
+            mSlots[head & mMask] = T();
+            mHead.store(head + 1, std::memory_order_release);
+            return PopResult::Item;
+        }
+    }
+
+    bool flushPending() const
+    {
+        return mFlushSerial.load(std::memory_order_acquire) != mSeenFlushSerial;
+    }
+
+    //drops entries made stale by a flush without consuming the flush itself
+    template<typename Discard>
+    void collect(Discard&& discard)
+    {
+        if(mFlushSerial.load(std::memory_order_acquire) != mSeenFlushSerial)
+            discardTo(mFlushIndex.load(std::memory_order_relaxed), discard);
+    }
+
+    //drops every entry, only valid on the consumer side or while the producer is idle
+    template<typename Discard>
+    void clear(Discard&& discard)
+    {
+        mSeenFlushSerial = mFlushSerial.load(std::memory_order_acquire);
+        discardTo(mTail.load(std::memory_order_acquire), discard);
+    }
+
+    //any thread --------------------------------------------------------------
+
+    std::size_t size() const
+    {
+        uint64_t head = mHead.load(std::memory_order_acquire);
+        uint64_t tail = mTail.load(std::memory_order_acquire);
+        uint64_t flushIndex = mFlushIndex.load(std::memory_order_relaxed);
+        if(flushIndex > head)
+            head = flushIndex;
+        return tail > head ? static_cast<std::size_t>(tail - head) : 0;
+    }
+
+    std::size_t capacity() const
+    {
+        return static_cast<std::size_t>(mMask + 1);
+    }
+
+private:
+    template<typename Discard>
+    void discardTo(uint64_t index, Discard& discard)
+    {
+        uint64_t head = mHead.load(std::memory_order_relaxed);
+        for(; head < index; head ++)
+        {
+            discard(mSlots[head & mMask]);
+            mSlots[head & mMask] = T();
+        }
+        mHead.store(head, std::memory_order_release);
+        if(mCachedTail < head)
+            mCachedTail = head;
+    }
+
+    static uint64_t roundUpPowerOfTwo(size_t value)
+    {
+        uint64_t result = 2;
+        while(result < value)
+            result <<= 1;
+        return result;
+    }
+
+private:
+    const uint64_t mMask;
+    std::vector<T> mSlots;
+
+    char mPad0[MINIPLAYER_CACHE_LINE_SIZE];
+    //consumer side
+    std::atomic<uint64_t> mHead;
+    uint64_t mCachedTail;
+    uint64_t mSeenFlushSerial;
+
+    char mPad1[MINIPLAYER_CACHE_LINE_SIZE];
+    //producer side
+    std::atomic<uint64_t> mTail;
+    uint64_t mCachedHead;
+
+    char mPad2[MINIPLAYER_CACHE_LINE_SIZE];
+    //written by the producer on flush only, polled by the consumer
+    std::atomic<uint64_t> mFlushIndex;
+    std::atomic<uint64_t> mFlushSerial;
+
+    char mPad3[MINIPLAYER_CACHE_LINE_SIZE];
+};
+
+/*
+ * Bounded lock-free byte ring for one producer thread and one consumer thread, for
+ * streams (PCM) where SPSCRing's one slot per entry does not fit. write() and read()
+ * move as much as fits or is there and return the byte count.
+ */
+class SPSCByteRing
+{
+public:
+    explicit SPSCByteRing(size_t capacity) :
+        mMask(roundUpPowerOfTwo(capacity) - 1),
+        mData(mMask + 1),
+        mHead(0),
+        mTail(0)
+    {}
+
+    SPSCByteRing(const SPSCByteRing&) = delete;
+    SPSCByteRing& operator=(const SPSCByteRing&) = delete;
+
+    //producer ------------------------------------------------------------------
+
+    size_t write(const uint8_t * data, size_t size)
+    {
+        uint64_t tail = mTail.load(std::memory_order_relaxed);
+        uint64_t head = mHead.load(std::memory_order_acquire);
+        size = std::min<size_t>(size, static_cast<size_t>(mMask + 1 - (tail - head)));
+        size_t offset = static_cast<size_t>(tail & mMask);
+        size_t first = std::min<size_t>(size, mData.size() - offset);
+        memcpy(&mData[offset], data, first);
+        memcpy(&mData[0], data + first, size - first);
+        mTail.store(tail + size, std::memory_order_release);
+        return size;
+    }
+
+    //consumer ------------------------------------------------------------------
+
+    size_t read(uint8_t * data, size_t size)
+    {
+        uint64_t head = mHead.load(std::memory_order_relaxed);
+        uint64_t tail = mTail.load(std::memory_order_acquire);
+        size = std::min<size_t>(size, static_cast<size_t>(tail - head));
+        size_t offset = static_cast<size_t>(head & mMask);
+        size_t first = std::min<size_t>(size, mData.size() - offset);
+        memcpy(data, &mData[offset], first);
+        memcpy(data + first, &mData[0], size - first);
+        mHead.store(head + size, std::memory_order_release);
+        return size;
+    }
+
+    //drops everything, only valid while neither side is inside write()/read()
+    void clear()
+    {
+        mHead.store(mTail.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+    //any thread --------------------------------------------------------------
+
+    std::size_t size() const
+    {
+        uint64_t head = mHead.load(std::memory_order_acquire);
+        uint64_t tail = mTail.load(std::memory_order_acquire);
+        return tail > head ? static_cast<std::size_t>(tail - head) : 0;
+    }
+
+    std::size_t capacity() const
+    {
+        return static_cast<std::size_t>(mMask + 1);
+    }
+
+private:
+    static uint64_t roundUpPowerOfTwo(size_t value)
+    {
+        uint64_t result = 2;
+        while(result < value)
+            result <<= 1;
+        return result;
+    }
+
+private:
+    const uint64_t mMask;
+    std::vector<uint8_t> mData;
+
+    char mPad0[MINIPLAYER_CACHE_LINE_SIZE];
+    std::atomic<uint64_t> mHead;    //consumer
+    char mPad1[MINIPLAYER_CACHE_LINE_SIZE];
+    std::atomic<uint64_t> mTail;    //producer
+    char mPad2[MINIPLAYER_CACHE_LINE_SIZE];
+};
+
+}
+
+#endif // RINGBUFFER_HPP
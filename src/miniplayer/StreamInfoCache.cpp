@@ -0,0 +1,217 @@
+#include "StreamInfoCache.hpp"
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cstdlib>
+#include <QDebug>
+
+using namespace miniplayer;
+
+StreamInfoCache * StreamInfoCache::shared()
+{
+    static StreamInfoCache cache;
+    return &cache;
+}
+
+void StreamInfoCache::setPath(const std::string & path)
+{
+    std::lock_guard<std::mutex> l(mMutex);
+    mPath = path;
+    mEntries.clear();
+    mOrder.clear();
+    if(!mPath.empty())
+        load();
+}
+
+std::string StreamInfoCache::getPath() const
+{
+    std::lock_guard<std::mutex> l(mMutex);
+    return mPath;
+}
+
+void StreamInfoCache::clear()
+{
+    std::lock_guard<std::mutex> l(mMutex);
+    mEntries.clear();
+    mOrder.clear();
+    if(!mPath.empty())
+        save();
+}
+
+bool StreamInfoCache::apply(const std::string & url, AVFormatContext * formatContext) const
+{
+    std::lock_guard<std::mutex> l(mMutex);
+    auto iter = mEntries.find(url);
+    if(iter == mEntries.end())
+        return false;
+
+    //the input must still look the way it did when it was probed
+    for(const auto & params : iter->second)
+    {
+        if(params.index < 0 || params.index >= static_cast<int>(formatContext->nb_streams))
+            return false;
+        AVCodecContext * codec = formatContext->streams[params.index]->codec;
+        if(codec->codec_type != params.codecType)
+            return false;
+        if(codec->codec_id != AV_CODEC_ID_NONE && codec->codec_id != params.codecId)
+            return false;
+    }
+
+    int videoStream = -1;
+    int audioStream = -1;
+    for (uint i = 0; i < formatContext->nb_streams; i++)
+    {
+        auto codecType = formatContext->streams[i]->codec->codec_type;
+        if (codecType == AVMediaType::AVMEDIA_TYPE_VIDEO && videoStream < 0)
+            videoStream = i;
+        else if(codecType == AVMediaType::AVMEDIA_TYPE_AUDIO && audioStream < 0)
+            audioStream = i;
+    }
+
+    bool videoFound = false;
+    bool audioFound = false;
+    for(const auto & params : iter->second)
+    {
+        AVCodecContext * codec = formatContext->streams[params.index]->codec;
+        codec->codec_id = static_cast<AVCodecID>(params.codecId);
+        if(codec->width == 0 && codec->height == 0)
+        {
+            codec->width = params.width;
+            codec->height = params.height;
+        }
+        if(codec->pix_fmt == AV_PIX_FMT_NONE)
+            codec->pix_fmt = static_cast<AVPixelFormat>(params.pixelFormat);
+        if(codec->sample_rate == 0)
+            codec->sample_rate = params.sampleRate;
+        if(codec->channels == 0)
+            codec->channels = params.channels;
+        if(codec->channel_layout == 0)
+            codec->channel_layout = params.channelLayout;
+        if(codec->sample_fmt == AV_SAMPLE_FMT_NONE)
+            codec->sample_fmt = static_cast<AVSampleFormat>(params.sampleFormat);
+        if(!codec->extradata && !params.extradata.empty())
+        {
+            codec->extradata = (uint8_t *)av_mallocz(params.extradata.size() + AV_INPUT_BUFFER_PADDING_SIZE);
+            if(codec->extradata)
+            {
+                std::copy(params.extradata.begin(), params.extradata.end(), codec->extradata);
+                codec->extradata_size = static_cast<int>(params.extradata.size());
+            }
+        }
+        //readers of codecpar (the recorder, the muxer behind it) must see the same parameters
+        AVStream * stream = formatContext->streams[params.index];
+        if(avcodec_parameters_from_context(stream->codecpar, codec) < 0)
+            qWarning() << __FUNCTION__ << "avcodec_parameters_from_context" << "failure" << params.index;
+        videoFound = videoFound || params.index == videoStream;
+        audioFound = audioFound || params.index == audioStream;
+    }
+    return videoFound && audioFound;
+}
+
+void StreamInfoCache::store(const std::string & url, const AVFormatContext * formatContext)
+{
+    std::vector<StreamParams> streams;
+    for (uint i = 0; i < formatContext->nb_streams; i++)
+    {
+        const AVCodecContext * codec = formatContext->streams[i]->codec;
+        if (codec->codec_type != AVMediaType::AVMEDIA_TYPE_VIDEO && codec->codec_type != AVMediaType::AVMEDIA_TYPE_AUDIO)
+            continue;
+        StreamParams params;
+        params.index = i;
+        params.codecType = codec->codec_type;
+        params.codecId = codec->codec_id;
+        params.width = codec->width;
+        params.height = codec->height;
+        params.pixelFormat = codec->pix_fmt;
+        params.sampleRate = codec->sample_rate;
+        params.channels = codec->channels;
+        params.channelLayout = codec->channel_layout;
+        params.sampleFormat = codec->sample_fmt;
+        if(codec->extradata && codec->extradata_size > 0)
+            params.extradata.assign(codec->extradata, codec->extradata + codec->extradata_size);
+        streams.push_back(params);
+    }
+
+    std::lock_guard<std::mutex> l(mMutex);
+    auto order = std::find(mOrder.begin(), mOrder.end(), url);
+    if(order != mOrder.end())
+        mOrder.erase(order);
+    mOrder.push_back(url);
+    mEntries[url] = streams;
+    while(mOrder.size() > MaxEntries)
+    {
+        mEntries.erase(mOrder.front());
+        mOrder.pop_front();
+    }
+    if(!mPath.empty())
+        save();
+}
+
+bool StreamInfoCache::load()
+{
+    std::ifstream in(mPath.c_str());
+    if(!in)
+        return false;
+
+    std::string line;
+    std::vector<StreamParams> * streams = nullptr;
+    while(std::getline(in, line))
+    {
+        if(line.compare(0, 4, "url ") == 0)
+        {
+            std::string url = line.substr(4);
+            if(!mEntries.count(url))
+                mOrder.push_back(url);
+            streams = &mEntries[url];
+            streams->clear();
+            continue;
+        }
+        if(line.compare(0, 7, "stream ") != 0 || !streams)
+            continue;
+
+        std::istringstream fields(line.substr(7));
+        StreamParams params;
+        std::string extradata;
+        fields >> params.index >> params.codecType >> params.codecId >> params.width >> params.height
+               >> params.pixelFormat >> params.sampleRate >> params.channels >> params.channelLayout
+               >> params.sampleFormat >> extradata;
+        if(fields.fail())
+            continue;
+        for(size_t i = 0; extradata != "-" && i + 1 < extradata.size(); i += 2)
+            params.extradata.push_back(static_cast<uint8_t>(strtol(extradata.substr(i, 2).c_str(), nullptr, 16)));
+        streams->push_back(params);
+    }
+    qDebug() << __FUNCTION__ << mPath.c_str() << "entries:" << mEntries.size();
+    return true;
+}
+
+bool StreamInfoCache::save() const
+{
+    std::ofstream out(mPath.c_str(), std::ios::out | std::ios::trunc);
+    if(!out)
+    {
+        qWarning() << __FUNCTION__ << "failed to open" << mPath.c_str();
+        return false;
+    }
+
+    static const char * digits = "0123456789abcdef";
+    out << "# miniplayer stream info cache\n";
+    for(const auto & url : mOrder)
+    {
+        out << "url " << url << "\n";
+        for(const auto & params : mEntries.at(url))
+        {
+            std::string extradata;
+            for(auto byte : params.extradata)
+            {
+                extradata += digits[byte >> 4];
+                extradata += digits[byte & 0xf];
+            }
+            out << "stream " << params.index << " " << params.codecType << " " << params.codecId << " "
+                << params.width << " " << params.height << " " << params.pixelFormat << " "
+                << params.sampleRate << " " << params.channels << " " << params.channelLayout << " "
+                << params.sampleFormat << " " << (extradata.empty() ? "-" : extradata) << "\n";
+        }
+    }
+    return true;
+}
@@ -0,0 +1,68 @@
+#ifndef STREAMINFOCACHE_HPP
+#define STREAMINFOCACHE_HPP
+
+extern "C"
+{
+#include <libavformat/avformat.h>
+}
+
+#include <mutex>
+#include <map>
+#include <deque>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+namespace miniplayer
+{
+
+/*
+ * Remembers the decoder parameters avformat_find_stream_info() worked out for an input,
+ * keyed by URL, so that opening a channel seen before can skip probing altogether.
+ * With a path set the cache is loaded from and written back to a small text file.
+ */
+class StreamInfoCache
+{
+public:
+    typedef struct {
+        int index;
+        int codecType;
+        int codecId;
+        int width;
+        int height;
+        int pixelFormat;
+        int sampleRate;
+        int channels;
+        uint64_t channelLayout;
+        int sampleFormat;
+        std::vector<uint8_t> extradata;
+    } StreamParams;
+
+    enum { MaxEntries = 256 };
+
+    static StreamInfoCache * shared();
+
+    //loads the file, later store() calls write it back
+    void setPath(const std::string & path);
+    std::string getPath() const;
+
+    //fills the missing codec parameters of a freshly opened input, true when both the
+    //first video and the first audio stream are complete and probing can be skipped
+    bool apply(const std::string & url, AVFormatContext * formatContext) const;
+    void store(const std::string & url, const AVFormatContext * formatContext);
+    void clear();
+
+private:
+    bool load();
+    bool save() const;
+
+private:
+    mutable std::mutex mMutex;
+    std::string mPath;
+    std::map<std::string, std::vector<StreamParams>> mEntries;
+    std::deque<std::string> mOrder;     //oldest first, trimmed to MaxEntries
+};
+
+}
+
+#endif // STREAMINFOCACHE_HPP
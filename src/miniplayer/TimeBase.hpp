@@ -0,0 +1,17 @@
+#ifndef TIMEBASE_HPP
+#define TIMEBASE_HPP
+
+extern "C"
+{
+#include <libavutil/avutil.h>
+}
+
+namespace miniplayer
+{
+
+//AV_TIME_BASE_Q is a compound literal, not valid C++
+static const AVRational MicrosecondTimeBase = { 1, AV_TIME_BASE };
+
+}
+
+#endif // TIMEBASE_HPP
@@ -0,0 +1,307 @@
+#include "TimeStretch.hpp"
+#include <algorithm>
+#include <cmath>
+#include <QDebug>
+
+extern "C"
+{
+#include <libavutil/channel_layout.h>
+}
+
+using namespace miniplayer;
+
+//drop consumed input in batches, erasing the front of a vector is not free
+static const int TrimThreshold = 8192;
+
+TimeStretch::TimeStretch() :
+    mRate(1),
+    mSampleRate(0),
+    mChannels(0),
+    mChannelLayout(0),
+    mHop(0),
+    mTolerance(0),
+    mBlockHops(3),
+    mInputPos(0),
+    mPrevSegment(-1),
+    mOutput(nullptr),
+    mOutputFill(0)
+{
+}
+
+TimeStretch::~TimeStretch()
+{
+    av_frame_free(&mOutput);
+}
+
+void TimeStretch::setRate(double rate)
+{
+    mRate = std::min(std::max(rate, 0.5), 2.0);
+}
+
+void TimeStretch::reset()
+{
+    for(auto & channel : mInput)
+        channel.clear();
+    mMix.clear();
+    mInputPos = 0;
+    mPrevSegment = -1;
+    mOutputFill = 0;
+}
+
+double TimeStretch::getBufferedDuration() const
+{
+    if(mSampleRate <= 0)
+        return 0;
+    //hops of a block that did not go out yet were taken from the input already
+    double pending = static_cast<double>(mInput.empty() ? 0 : mInput[0].size()) - mInputPos;
+    if(mOutputFill < mBlockHops)
+        pending += mOutputFill * mHop * mRate;
+    return std::max(pending, 0.0) / mSampleRate;
+}
+
+bool TimeStretch::configure(const AVFrame * frame)
+{
+    if(mOutput && frame->sample_rate == mSampleRate && frame->channels == mChannels)
+        return true;
+
+    av_frame_free(&mOutput);
+    mSampleRate = frame->sample_rate;
+    mChannels = frame->channels;
+    mChannelLayout = frame->channel_layout ? frame->channel_layout : av_get_default_channel_layout(mChannels);
+    if(mSampleRate <= 0 || mChannels <= 0)
+        return false;
+
+    mHop = std::max(mSampleRate / 100, 16);
+    mTolerance = std::max(mSampleRate / 200, 8);
+    mInput.assign(mChannels, std::vector<float>());
+    mTail.assign(mChannels, std::vector<float>(mHop));
+    mFadeIn.resize(mHop);
+    for(int i = 0; i < mHop; i++)
+        mFadeIn[i] = static_cast<float>(0.5 - 0.5 * cos(M_PI * (i + 0.5) / mHop));
+
+    mOutput = av_frame_alloc();
+    mOutput->format = AV_SAMPLE_FMT_FLTP;
+    mOutput->channels = mChannels;
+    mOutput->channel_layout = mChannelLayout;
+    mOutput->sample_rate = mSampleRate;
+    mOutput->nb_samples = mHop * mBlockHops;
+    if(av_frame_get_buffer(mOutput, 0) < 0)
+    {
+        qWarning() << __FUNCTION__ << "av_frame_get_buffer" << "failure";
+        av_frame_free(&mOutput);
+        return false;
+    }
+    qDebug() << __FUNCTION__ << "rate:" << mSampleRate << "channels:" << mChannels << "hop:" << mHop;
+    reset();
+    return true;
+}
+
+template<typename T>
+static void readSamples(const AVFrame * frame, int channel, bool planar, float scale, float * dst)
+{
+    int channels = frame->channels;
+    if(planar)
+    {
+        const T * src = reinterpret_cast<const T *>(frame->extended_data[channel]);
+        for(int i = 0; i < frame->nb_samples; i++)
+            dst[i] = src[i] * scale;
+    }
+    else
+    {
+        const T * src = reinterpret_cast<const T *>(frame->extended_data[0]) + channel;
+        for(int i = 0; i < frame->nb_samples; i++)
+            dst[i] = src[i * channels] * scale;
+    }
+}
+
+bool TimeStretch::appendSamples(const AVFrame * frame)
+{
+    AVSampleFormat format = static_cast<AVSampleFormat>(frame->format);
+    bool planar = av_sample_fmt_is_planar(format) != 0;
+    AVSampleFormat packed = av_get_packed_sample_fmt(format);
+    if(packed != AV_SAMPLE_FMT_FLT && packed != AV_SAMPLE_FMT_S16 && packed != AV_SAMPLE_FMT_S32)
+        return false;
+
+    size_t offset = mMix.size();
+    size_t count = static_cast<size_t>(frame->nb_samples);
+    mMix.resize(offset + count, 0.0f);
+    float weight = 1.0f / mChannels;
+    for(int c = 0; c < mChannels; c++)
+    {
+        auto & channel = mInput[c];
+        channel.resize(offset + count);
+        float * dst = channel.data() + offset;
+        if(packed == AV_SAMPLE_FMT_FLT)
+            readSamples<float>(frame, c, planar, 1.0f, dst);
+        else if(packed == AV_SAMPLE_FMT_S16)
+            readSamples<int16_t>(frame, c, planar, 1.0f / 32768, dst);
+        else
+            readSamples<int32_t>(frame, c, planar, 1.0f / 2147483648.0f, dst);
+
+        float * mix = mMix.data() + offset;
+        for(size_t i = 0; i < count; i++)
+            mix[i] += dst[i] * weight;
+    }
+    return true;
+}
+
+bool TimeStretch::push(const AVFrame * frame)
+{
+    if(!configure(frame))
+        return false;
+    return appendSamples(frame);
+}
+
+//four independent sums, which compilers turn into SIMD lanes
+static void correlate(const float * a, const float * b, int count, float & dot, float & energy)
+{
+    float d[4] = { 0, 0, 0, 0 };
+    float e[4] = { 0, 0, 0, 0 };
+    int i = 0;
+    for(; i + 4 <= count; i += 4)
+    {
+        for(int k = 0; k < 4; k++)
+        {
+            d[k] += a[i + k] * b[i + k];
+            e[k] += b[i + k] * b[i + k];
+        }
+    }
+    for(; i < count; i++)
+    {
+        d[0] += a[i] * b[i];
+        e[0] += b[i] * b[i];
+    }
+    dot = d[0] + d[1] + d[2] + d[3];
+    energy = e[0] + e[1] + e[2] + e[3];
+}
+
+//coarse search every 4 samples, then refined around the best match
+int TimeStretch::bestOffset(int templateStart, int from, int to) const
+{
+    const float * reference = mMix.data() + templateStart;
+    int best = from;
+    float bestScore = -1e30f;
+    auto score = [&](int offset)
+    {
+        float dot = 0;
+        float energy = 0;
+        correlate(reference, mMix.data() + offset, mHop, dot, energy);
+        float value = dot / std::sqrt(energy + 1e-9f);
+        if(value > bestScore)
+        {
+            bestScore = value;
+            best = offset;
+        }
+    };
+
+    for(int offset = from; offset <= to; offset += 4)
+        score(offset);
+    int center = best;
+    for(int offset = std::max(from, center - 3); offset <= std::min(to, center + 3); offset++)
+    {
+        if(offset != center)
+            score(offset);
+    }
+    return best;
+}
+
+void TimeStretch::trim()
+{
+    int consumed = std::min(mPrevSegment + mHop, static_cast<int>(mInputPos) - mTolerance);
+    if(consumed < TrimThreshold)
+        return;
+    for(auto & channel : mInput)
+        channel.erase(channel.begin(), channel.begin() + consumed);
+    mMix.erase(mMix.begin(), mMix.begin() + consumed);
+    mPrevSegment -= consumed;
+    mInputPos -= consumed;
+}
+
+AVFrame * TimeStretch::pull()
+{
+    if(!mOutput)
+        return nullptr;
+    if(mOutputFill == mBlockHops)
+        mOutputFill = 0;
+
+    int available = static_cast<int>(mMix.size());
+    while(mOutputFill < mBlockHops)
+    {
+        int segment = static_cast<int>(mInputPos + 0.5);
+        if(mPrevSegment >= 0)
+        {
+            int from = std::max(segment - mTolerance, 0);
+            int to = segment + mTolerance;
+            if(to + 2 * mHop > available)
+                return nullptr;
+            segment = bestOffset(mPrevSegment + mHop, from, to);
+        }
+        else if(segment + 2 * mHop > available)
+            return nullptr;
+
+        //the first segment after a reset starts as it is, later ones fade in over the previous tail
+        for(int c = 0; c < mChannels; c++)
+        {
+            const float * input = mInput[c].data() + segment;
+            float * tail = mTail[c].data();
+            float * output = reinterpret_cast<float *>(mOutput->extended_data[c]) + mOutputFill * mHop;
+            if(mPrevSegment >= 0)
+            {
+                for(int i = 0; i < mHop; i++)
+                    output[i] = tail[i] + (input[i] - tail[i]) * mFadeIn[i];
+            }
+            else
+                std::copy(input, input + mHop, output);
+            std::copy(input + mHop, input + 2 * mHop, tail);
+        }
+
+        mPrevSegment = segment;
+        mInputPos += mHop * mRate;
+        mOutputFill ++;
+        trim();
+        available = static_cast<int>(mMix.size());
+    }
+    mOutput->nb_samples = mHop * mBlockHops;
+    return mOutput;
+}
+
+AVFrame * TimeStretch::drain()
+{
+    if(!mOutput || mInput.empty())
+        return nullptr;
+    if(mOutputFill == mBlockHops)
+        mOutputFill = 0;
+
+    //the previous segment's tail and the input after it continue each other, so they are played back to back
+    if(mPrevSegment >= 0)
+    {
+        int from = std::min(mPrevSegment + 2 * mHop, static_cast<int>(mInput[0].size()));
+        for(int c = 0; c < mChannels; c++)
+        {
+            auto & channel = mInput[c];
+            channel.erase(channel.begin(), channel.begin() + from);
+            channel.insert(channel.begin(), mTail[c].begin(), mTail[c].end());
+        }
+        mMix.clear();
+        mPrevSegment = -1;
+        mInputPos = 0;
+    }
+
+    int filled = mOutputFill * mHop;
+    int cursor = static_cast<int>(mInputPos);
+    int count = std::max(std::min(mHop * mBlockHops - filled, static_cast<int>(mInput[0].size()) - cursor), 0);
+    if(filled + count == 0)
+    {
+        reset();
+        return nullptr;
+    }
+    for(int c = 0; c < mChannels; c++)
+    {
+        const float * input = mInput[c].data() + cursor;
+        std::copy(input, input + count, reinterpret_cast<float *>(mOutput->extended_data[c]) + filled);
+    }
+    mInputPos = cursor + count;
+    mOutputFill = mBlockHops;
+    mOutput->nb_samples = filled + count;
+    return mOutput;
+}
@@ -0,0 +1,79 @@
+#ifndef TIMESTRETCH_HPP
+#define TIMESTRETCH_HPP
+
+extern "C"
+{
+#include <libavutil/frame.h>
+#include <libavutil/samplefmt.h>
+}
+
+#include <atomic>
+#include <vector>
+#include <cstdint>
+
+namespace miniplayer
+{
+
+/*
+ * Pitch-preserving time stretch (WSOLA). Input is taken at rate x the speed it is played
+ * out: every synthesis hop (10 ms) takes a 20 ms segment from around the nominal input
+ * position, picks the offset (within +-5 ms) whose start best continues the previous
+ * segment and cross-fades the two.
+ *
+ * push() keeps a float planar copy of the input, the history the segment search needs.
+ * pull() runs the hops straight into one reused FLTP output frame of a fixed size, so
+ * the audio output does not see the frame size change from one block to the next.
+ * Both belong to the audio render stage.
+ */
+class TimeStretch
+{
+public:
+    TimeStretch();
+    ~TimeStretch();
+
+    //0.5..2, takes effect on the next hop
+    void setRate(double rate);
+    double getRate() const { return mRate; }
+
+    //drops all buffered audio (seek, rate switching back on)
+    void reset();
+
+    //false for sample formats it cannot read, the frame should be played unstretched then
+    bool push(const AVFrame * frame);
+
+    //next output block, valid until the next pull(), nullptr until enough input is buffered
+    AVFrame * pull();
+
+    //rate back at 1: what is buffered goes out unstretched, the last block is shorter, nullptr once it is all out
+    AVFrame * drain();
+
+    //s of input pushed but not in a block pulled yet
+    double getBufferedDuration() const;
+
+private:
+    bool configure(const AVFrame * frame);
+    bool appendSamples(const AVFrame * frame);
+    int bestOffset(int templateStart, int from, int to) const;
+    void trim();
+
+private:
+    std::atomic<double> mRate;
+    int mSampleRate;
+    int mChannels;
+    uint64_t mChannelLayout;
+    int mHop;                       //synthesis hop, half a segment
+    int mTolerance;                 //search range around the nominal input position
+    int mBlockHops;                 //hops per output block
+    std::vector<std::vector<float>> mInput;     //per channel, from the oldest sample still needed
+    std::vector<float> mMix;                    //channel average, what the search correlates
+    std::vector<std::vector<float>> mTail;      //second half of the previous segment
+    std::vector<float> mFadeIn;
+    double mInputPos;               //nominal input position of the next segment
+    int mPrevSegment;               //start of the previous segment, -1 before the first one
+    AVFrame * mOutput;
+    int mOutputFill;                //hops written into mOutput
+};
+
+}
+
+#endif // TIMESTRETCH_HPP
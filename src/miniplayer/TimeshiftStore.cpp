@@ -0,0 +1,353 @@
+#include "TimeshiftStore.hpp"
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <QDebug>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace miniplayer;
+
+//segments shrink for small budgets down to MinSegmentSize, a budget below MinSegments of those is refused
+static const int64_t MaxSegmentSize = 8 * 1024 * 1024;
+static const int64_t MinSegmentSize = 256 * 1024;
+static const int MinSegments = 4;
+static const int64_t RecordAlignment = 8;
+
+TimeshiftStore::TimeshiftStore() :
+    mData(nullptr),
+    mSize(0),
+    mSegmentSize(MaxSegmentSize),
+#ifdef _WIN32
+    mFile(nullptr),
+    mMapping(nullptr),
+#endif
+    mWriteSegment(0),
+    mEmpty(true),
+    mFinished(false),
+    mReadSegment(0),
+    mReadOffset(0),
+    mWindowEnd(-1),
+    mPacketsWritten(0),
+    mPacketsRead(0),
+    mOverruns(0)
+{
+}
+
+TimeshiftStore::~TimeshiftStore()
+{
+    close();
+}
+
+bool TimeshiftStore::open(const std::string & path, int64_t budget)
+{
+    close();
+
+    std::lock_guard<std::mutex> l(mMutex);
+    int64_t segmentSize = std::min(MaxSegmentSize, budget / MinSegments) / RecordAlignment * RecordAlignment;
+    if(segmentSize < MinSegmentSize)
+    {
+        qWarning() << __FUNCTION__ << "budget" << budget << "below the minimum of" << MinSegments * MinSegmentSize;
+        return false;
+    }
+    int64_t count = budget / segmentSize;
+    if(count * segmentSize != budget)
+        qDebug() << __FUNCTION__ << "budget" << budget << "rounded down to" << count * segmentSize;
+    if(!map(path, count * segmentSize))
+        return false;
+    mPath = path;
+    mSegmentSize = segmentSize;
+    mSegments.assign(static_cast<size_t>(count), Segment{0, {}});
+    mWriteSegment = 0;
+    mEmpty = true;
+    mFinished = false;
+    mReadSegment = 0;
+    mReadOffset = 0;
+    mWindowEnd = -1;
+    mPacketsWritten = 0;
+    mPacketsRead = 0;
+    mOverruns = 0;
+    qDebug() << __FUNCTION__ << path.c_str() << "segments:" << count << "of" << segmentSize;
+    return true;
+}
+
+void TimeshiftStore::close()
+{
+    std::lock_guard<std::mutex> l(mMutex);
+    if(!mData)
+        return;
+    unmap();
+    mSegments.clear();
+#ifndef _WIN32
+    unlink(mPath.c_str());
+#endif
+    mPath.clear();
+}
+
+bool TimeshiftStore::map(const std::string & path, int64_t size)
+{
+#ifdef _WIN32
+    //deleted by the system once the last handle is closed
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+    if(file == INVALID_HANDLE_VALUE)
+    {
+        qWarning() << __FUNCTION__ << "CreateFile" << "failure" << path.c_str();
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, static_cast<DWORD>(size >> 32),
+                                        static_cast<DWORD>(size & 0xffffffff), NULL);
+    void * data = mapping ? MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, static_cast<SIZE_T>(size)) : nullptr;
+    if(!data)
+    {
+        qWarning() << __FUNCTION__ << "MapViewOfFile" << "failure" << size;
+        if(mapping)
+            CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+    mFile = file;
+    mMapping = mapping;
+#else
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if(fd < 0)
+    {
+        qWarning() << __FUNCTION__ << "open" << "failure" << path.c_str();
+        return false;
+    }
+    //a sparse file would only run out of disk when the mapping is written, with SIGBUS
+#ifdef __APPLE__
+    fstore_t store = { F_ALLOCATEALL, F_PEOFPOSMODE, 0, size, 0 };
+    int err = fcntl(fd, F_PREALLOCATE, &store) != -1 && ftruncate(fd, size) == 0 ? 0 : errno;
+#else
+    int err = posix_fallocate(fd, 0, size);
+#endif
+    if(err != 0)
+    {
+        qWarning() << __FUNCTION__ << "reserving" << size << "bytes" << "failure" << strerror(err);
+        ::close(fd);
+        unlink(path.c_str());
+        return false;
+    }
+    void * data = mmap(nullptr, static_cast<size_t>(size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    //the mapping keeps the file open
+    ::close(fd);
+    if(data == MAP_FAILED)
+    {
+        qWarning() << __FUNCTION__ << "mmap" << "failure" << size;
+        unlink(path.c_str());
+        return false;
+    }
+#endif
+    mData = static_cast<uint8_t *>(data);
+    mSize = size;
+    return true;
+}
+
+void TimeshiftStore::unmap()
+{
+#ifdef _WIN32
+    UnmapViewOfFile(mData);
+    CloseHandle(mMapping);
+    CloseHandle(mFile);
+    mMapping = nullptr;
+    mFile = nullptr;
+#else
+    munmap(mData, static_cast<size_t>(mSize));
+#endif
+    mData = nullptr;
+    mSize = 0;
+}
+
+int64_t TimeshiftStore::recordSize(int64_t dataSize)
+{
+    int64_t size = static_cast<int64_t>(sizeof(RecordHeader)) + dataSize;
+    return (size + RecordAlignment - 1) / RecordAlignment * RecordAlignment;
+}
+
+uint8_t * TimeshiftStore::segmentData(uint64_t number) const
+{
+    return mData + static_cast<int64_t>(number % mSegments.size()) * mSegmentSize;
+}
+
+uint64_t TimeshiftStore::oldestSegment() const
+{
+    uint64_t count = mSegments.size();
+    return mWriteSegment >= count ? mWriteSegment - count + 1 : 0;
+}
+
+bool TimeshiftStore::append(const AVPacket & packet, double time, bool seekPoint)
+{
+    int64_t size = recordSize(packet.size);
+    std::lock_guard<std::mutex> l(mMutex);
+    if(!mData || size > mSegmentSize)
+        return false;
+
+    //a record never spans segments, the next one replaces the oldest of the ring
+    if(segment(mWriteSegment).used + size > mSegmentSize)
+    {
+        mWriteSegment ++;
+        Segment & next = segment(mWriteSegment);
+        next.used = 0;
+        next.seekPoints.clear();
+    }
+
+    Segment & current = segment(mWriteSegment);
+    uint8_t * record = segmentData(mWriteSegment) + current.used;
+    RecordHeader header;
+    header.pts = packet.pts;
+    header.dts = packet.dts;
+    header.duration = packet.duration;
+    header.time = time;
+    header.size = packet.size;
+    header.streamIndex = packet.stream_index;
+    header.flags = packet.flags;
+    header.reserved = 0;
+    memcpy(record, &header, sizeof(header));
+    if(packet.size > 0)
+        memcpy(record + sizeof(header), packet.data, packet.size);
+    if(seekPoint)
+        current.seekPoints.push_back(SeekPoint{time, current.used});
+    current.used += size;
+
+    mEmpty = false;
+    mWindowEnd = std::max(mWindowEnd, time);
+    mPacketsWritten ++;
+    return true;
+}
+
+void TimeshiftStore::finish()
+{
+    std::lock_guard<std::mutex> l(mMutex);
+    mFinished = true;
+}
+
+bool TimeshiftStore::seekFirst()
+{
+    for(uint64_t number = oldestSegment(); number <= mWriteSegment; number++)
+    {
+        const Segment & current = segment(number);
+        if(!current.seekPoints.empty())
+        {
+            mReadSegment = number;
+            mReadOffset = current.seekPoints.front().offset;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool TimeshiftStore::seek(double time)
+{
+    std::lock_guard<std::mutex> l(mMutex);
+    if(!mData || mEmpty)
+        return false;
+
+    //newest segment first, the search stops at the first one starting at or before time
+    uint64_t oldest = oldestSegment();
+    for(uint64_t number = mWriteSegment + 1; number-- > oldest; )
+    {
+        const auto & points = segment(number).seekPoints;
+        if(points.empty() || points.front().time > time)
+            continue;
+        auto iter = std::upper_bound(points.begin(), points.end(), time,
+                                     [](double time, const SeekPoint & point) { return time < point.time; });
+        mReadSegment = number;
+        mReadOffset = (iter - 1)->offset;
+        return true;
+    }
+    return seekFirst();
+}
+
+int TimeshiftStore::read(AVPacket & packet)
+{
+    std::lock_guard<std::mutex> l(mMutex);
+    if(!mData)
+        return AVERROR(EINVAL);
+
+    //the writer took the segment we were in, continue at the oldest keyframe left
+    if(!mEmpty && mReadSegment < oldestSegment())
+    {
+        mOverruns ++;
+        if(!seekFirst())
+        {
+            mReadSegment = mWriteSegment;
+            mReadOffset = segment(mWriteSegment).used;
+        }
+    }
+
+    while(mReadSegment < mWriteSegment && mReadOffset >= segment(mReadSegment).used)
+    {
+        mReadSegment ++;
+        mReadOffset = 0;
+    }
+    if(mReadSegment == mWriteSegment && mReadOffset >= segment(mWriteSegment).used)
+        return mFinished ? AVERROR_EOF : AVERROR(EAGAIN);
+
+    const uint8_t * record = segmentData(mReadSegment) + mReadOffset;
+    RecordHeader header;
+    memcpy(&header, record, sizeof(header));
+    int ret = av_new_packet(&packet, header.size);
+    if(ret < 0)
+        return ret;
+    memcpy(packet.data, record + sizeof(header), header.size);
+    packet.pts = header.pts;
+    packet.dts = header.dts;
+    packet.duration = header.duration;
+    packet.stream_index = header.streamIndex;
+    packet.flags = header.flags;
+    packet.pos = -1;
+    mReadOffset += recordSize(header.size);
+    mPacketsRead ++;
+    return 0;
+}
+
+bool TimeshiftStore::readable() const
+{
+    std::lock_guard<std::mutex> l(mMutex);
+    if(!mData)
+        return false;
+    return mFinished || mReadSegment < mWriteSegment || mReadOffset < mSegments[mWriteSegment % mSegments.size()].used;
+}
+
+double TimeshiftStore::windowStart() const
+{
+    std::lock_guard<std::mutex> l(mMutex);
+    if(!mData || mEmpty)
+        return -1;
+    for(uint64_t number = oldestSegment(); number <= mWriteSegment; number++)
+    {
+        const auto & points = mSegments[number % mSegments.size()].seekPoints;
+        if(!points.empty())
+            return points.front().time;
+    }
+    return -1;
+}
+
+double TimeshiftStore::windowEnd() const
+{
+    std::lock_guard<std::mutex> l(mMutex);
+    return mWindowEnd;
+}
+
+void TimeshiftStore::dump(Info & info) const
+{
+    double start = windowStart();
+    std::lock_guard<std::mutex> l(mMutex);
+    info.budget = mSize;
+    info.used = 0;
+    for(const auto & current : mSegments)
+        info.used += current.used;
+    info.windowStart = start;
+    info.windowEnd = mWindowEnd;
+    info.packetsWritten = mPacketsWritten;
+    info.packetsRead = mPacketsRead;
+    info.overruns = mOverruns;
+}
@@ -0,0 +1,124 @@
+#ifndef TIMESHIFTSTORE_HPP
+#define TIMESHIFTSTORE_HPP
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+}
+
+#include <mutex>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+namespace miniplayer
+{
+
+/*
+ * Disk ring of demuxed packets for pause/rewind on live inputs. The ring is one file of
+ * fixed size segments mapped into memory, packets are appended to the current segment
+ * and once the ring is full the oldest segment is dropped for the next one.
+ *
+ * Every video keyframe is a seek point, kept per segment in memory with its time (s,
+ * relative to the stream start), so seek() lands on a keyframe without reading the
+ * file. read() copies the next packet out of the mapping into a new refcounted packet;
+ * a reader that falls out of the window is moved to its oldest seek point.
+ *
+ * One writer (the thread reading the input) and one reader (the player's read thread),
+ * the mapping is only touched under the store's mutex, records are small enough for that.
+ */
+class TimeshiftStore
+{
+public:
+    typedef struct {
+        int64_t budget;         //bytes on disk
+        int64_t used;           //bytes holding packets
+        double windowStart;     //oldest seek point (s), -1 while empty
+        double windowEnd;       //newest packet (s), -1 while empty
+        int64_t packetsWritten;
+        int64_t packetsRead;
+        int64_t overruns;       //times the reader was behind the window and moved up
+    } Info;
+
+    TimeshiftStore();
+    ~TimeshiftStore();
+
+    TimeshiftStore(const TimeshiftStore&) = delete;
+    TimeshiftStore& operator=(const TimeshiftStore&) = delete;
+
+    //creates path with budget bytes (rounded down to whole segments) reserved on disk, it is removed again
+    //by close(); false when the budget is below the minimum or the disk cannot hold it
+    bool open(const std::string & path, int64_t budget);
+    void close();
+
+    //writer: time in s, seekPoint for video keyframes
+    bool append(const AVPacket & packet, double time, bool seekPoint);
+    //writer: the input ended, read() reports AVERROR_EOF once it caught up
+    void finish();
+
+    //reader: moves to the last seek point at or before time, the first one when time is before the window
+    bool seek(double time);
+    //reader: 0, AVERROR(EAGAIN) at the live edge, AVERROR_EOF after finish()
+    int read(AVPacket & packet);
+    bool readable() const;
+
+    double windowStart() const;
+    double windowEnd() const;
+    void dump(Info & info) const;
+
+private:
+    typedef struct {
+        int64_t pts;
+        int64_t dts;
+        int64_t duration;
+        double time;
+        int32_t size;
+        int32_t streamIndex;
+        int32_t flags;
+        int32_t reserved;
+    } RecordHeader;
+
+    typedef struct {
+        double time;
+        int64_t offset;
+    } SeekPoint;
+
+    struct Segment
+    {
+        int64_t used;                       //bytes of records
+        std::vector<SeekPoint> seekPoints;
+    };
+
+    static int64_t recordSize(int64_t dataSize);
+    uint8_t * segmentData(uint64_t number) const;
+    Segment & segment(uint64_t number) { return mSegments[number % mSegments.size()]; }
+    uint64_t oldestSegment() const;
+    bool seekFirst();
+    bool map(const std::string & path, int64_t size);
+    void unmap();
+
+private:
+    mutable std::mutex mMutex;
+    std::string mPath;
+    uint8_t * mData;
+    int64_t mSize;
+    int64_t mSegmentSize;           //fixed while open, smaller than the maximum for small budgets
+#ifdef _WIN32
+    void * mFile;
+    void * mMapping;
+#endif
+    std::vector<Segment> mSegments;
+    uint64_t mWriteSegment;         //segment numbers count up for good, the slot is number % count
+    bool mEmpty;
+    bool mFinished;
+    uint64_t mReadSegment;
+    int64_t mReadOffset;
+    double mWindowEnd;
+    int64_t mPacketsWritten;
+    int64_t mPacketsRead;
+    int64_t mOverruns;
+};
+
+}
+
+#endif // TIMESHIFTSTORE_HPP
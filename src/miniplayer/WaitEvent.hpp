@@ -0,0 +1,138 @@
+#ifndef WAITEVENT_HPP
+#define WAITEVENT_HPP
+
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include <condition_variable>
+
+namespace miniplayer
+{
+
+/*
+ * Wakeup channel for one pipeline stage. notify() only touches the mutex when
+ * somebody is actually waiting, so the lock-free queues can signal on every
+ * append/acquire without paying for a syscall on the hot path.
+ *
+ * Every notify() bumps serial(). A stage that takes the serial before looking at
+ * its queues can later block in waitChanged() or arm() the listener without
+ * missing a notification that raced with its checks.
+ */
+class WaitEvent
+{
+public:
+    class Listener
+    {
+    public:
+        virtual ~Listener() {}
+        virtual void onNotify() = 0;
+    };
+
+    WaitEvent() :
+        mWaiters(0),
+        mSerial(0),
+        mListener(nullptr),
+        mArmed(false)
+    {}
+
+    WaitEvent(const WaitEvent&) = delete;
+    WaitEvent& operator=(const WaitEvent&) = delete;
+
+    void notify()
+    {
+        mSerial.fetch_add(1, std::memory_order_release);
+        //pairs with the fence in waitFor()/arm(): either we see the waiter or it sees our state change
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(mWaiters.load(std::memory_order_relaxed) == 0)
+            return;
+        std::lock_guard<std::mutex> l(mMutex);
+        mCond.notify_all();
+        if(mArmed)
+        {
+            mArmed = false;
+            mWaiters.fetch_sub(1, std::memory_order_relaxed);
+            if(mListener)
+                mListener->onNotify();
+        }
+    }
+
+    uint64_t serial() const
+    {
+        return mSerial.load(std::memory_order_acquire);
+    }
+
+    //returns the last value of the predicate
+    template<typename Predicate>
+    bool waitFor(int64_t timeoutMs, Predicate predicate)
+    {
+        if(predicate())
+            return true;
+        if(timeoutMs <= 0)
+            return false;
+
+        std::unique_lock<std::mutex> l(mMutex);
+        mWaiters.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool ret = mCond.wait_for(l, std::chrono::milliseconds(timeoutMs), predicate);
+        mWaiters.fetch_sub(1, std::memory_order_relaxed);
+        return ret;
+    }
+
+    //waits until notify() has been called since serial was taken
+    bool waitChanged(uint64_t serial, int64_t timeoutMs)
+    {
+        return waitFor(timeoutMs, [&] { return mSerial.load(std::memory_order_acquire) != serial; });
+    }
+
+    //the listener is called (with the event locked) by the first notify() after arm()
+    void setListener(Listener * listener)
+    {
+        std::lock_guard<std::mutex> l(mMutex);
+        mListener = listener;
+        disarmLocked();
+    }
+
+    //fails when notify() has been called since serial was taken
+    bool arm(uint64_t serial)
+    {
+        std::lock_guard<std::mutex> l(mMutex);
+        if(!mArmed)
+        {
+            mArmed = true;
+            mWaiters.fetch_add(1, std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(mSerial.load(std::memory_order_acquire) == serial)
+            return true;
+        disarmLocked();
+        return false;
+    }
+
+    void disarm()
+    {
+        std::lock_guard<std::mutex> l(mMutex);
+        disarmLocked();
+    }
+
+private:
+    void disarmLocked()
+    {
+        if(!mArmed)
+            return;
+        mArmed = false;
+        mWaiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+private:
+    std::mutex mMutex;
+    std::condition_variable mCond;
+    std::atomic_int mWaiters;
+    std::atomic<uint64_t> mSerial;
+    Listener * mListener;
+    bool mArmed;
+};
+
+}
+
+#endif // WAITEVENT_HPP
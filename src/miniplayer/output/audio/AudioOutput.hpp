@@ -11,18 +11,37 @@ extern "C"
 class AudioOutput
 {
 public:
+    typedef struct {
+        int deviceOpens;        //times the device was opened, once for the output's lifetime unless it failed
+        double deviceOpenTime;  //ms the last device open took
+        int reconfigures;       //open()/format changes served by the device already open
+        double latency;         //s queued ahead of the device as of the last getLatency(), -1 when unknown
+        int64_t underruns;      //pull mode: times the device ran dry while more audio was coming
+        double bufferFill;      //pull mode: s waiting in the ring as last seen by the feeding thread
+        double bufferCapacity;  //pull mode: s the ring holds, 0 in push mode
+    } Info;
+
     AudioOutput() {}
 
     virtual ~AudioOutput() {}
 
+    //sets the output up for the format of avFrame, the device is opened the first time only
     virtual bool open(AVFrame * avFrame) = 0;
     virtual bool stop() = 0;
+    //ends playback and drops what is queued, the device stays open until the output is destroyed
     virtual bool close() = 0;
     virtual bool render(AVFrame * avFrame) = 0;
     virtual bool setVolume(float value) = 0;
     virtual float getVolume() = 0;
     virtual bool setMute(bool value) = 0;
     virtual bool getMute() = 0;
+    //s of what render() was given that the device has not played yet, -1 when the output cannot tell
+    virtual double getLatency() = 0;
+    //s the device played since open()/stop(), -1 when the output cannot tell
+    virtual double getPlayedTime() = 0;
+    //s render() takes without waiting, -1 when it takes any frame (waiting inside if it must)
+    virtual double getBufferSpace() = 0;
+    virtual void dump(Info & info) const = 0;
 };
 
 #endif // AUDIOOUTPUT_HPP
@@ -0,0 +1,83 @@
+#include "AudioOutputNull.hpp"
+#include <QDebug>
+
+AudioOutputNull::AudioOutputNull() :
+    mOpened(false),
+    mVolume(1.0f),
+    mMute(false)
+{
+    qDebug() << __FUNCTION__;
+}
+
+AudioOutputNull::~AudioOutputNull()
+{
+    qDebug() << __FUNCTION__;
+}
+
+bool AudioOutputNull::open(AVFrame *)
+{
+    qDebug() << __FUNCTION__;
+    mOpened = true;
+    return true;
+}
+
+bool AudioOutputNull::stop()
+{
+    return true;
+}
+
+bool AudioOutputNull::close()
+{
+    qDebug() << __FUNCTION__;
+    mOpened = false;
+    return true;
+}
+
+bool AudioOutputNull::render(AVFrame *)
+{
+    return mOpened;
+}
+
+bool AudioOutputNull::setVolume(float value)
+{
+    mVolume = value;
+    return true;
+}
+
+float AudioOutputNull::getVolume()
+{
+    return mVolume;
+}
+
+bool AudioOutputNull::setMute(bool value)
+{
+    mMute = value;
+    return true;
+}
+
+bool AudioOutputNull::getMute()
+{
+    return mMute;
+}
+
+//frames are gone as soon as they are rendered, the player keeps to their timestamps
+double AudioOutputNull::getLatency()
+{
+    return -1;
+}
+
+double AudioOutputNull::getPlayedTime()
+{
+    return -1;
+}
+
+double AudioOutputNull::getBufferSpace()
+{
+    return -1;
+}
+
+void AudioOutputNull::dump(Info & info) const
+{
+    info = Info();
+    info.latency = -1;
+}
@@ -0,0 +1,30 @@
+#ifndef AUDIOOUTPUTNULL_HPP
+#define AUDIOOUTPUTNULL_HPP
+
+#include "AudioOutput.hpp"
+
+//discards every frame, used where no audio device is available (benchmarks, CI)
+class AudioOutputNull : public AudioOutput
+{
+public:
+    AudioOutputNull();
+    virtual ~AudioOutputNull();
+    bool open(AVFrame * avFrame);
+    bool stop();
+    bool close();
+    bool render(AVFrame * avFrame);
+    bool setVolume(float value);
+    float getVolume();
+    bool setMute(bool value);
+    bool getMute();
+    double getLatency();
+    double getPlayedTime();
+    double getBufferSpace();
+    void dump(Info & info) const;
+private:
+    bool mOpened;
+    float mVolume;
+    bool mMute;
+};
+
+#endif // AUDIOOUTPUTNULL_HPP
@@ -1,9 +1,26 @@
 #include "AudioOutputOpenAL.hpp"
 #include <memory>
 #include <thread>
+#include <algorithm>
+#include <cstdint>
 #include <QDebug>
 
+extern "C"
+{
+#include <libavutil/time.h>
+}
+
 std::mutex AudioOutputOpenAL::globalMutex;
+std::mutex AudioOutputOpenAL::feederMutex;
+std::thread AudioOutputOpenAL::feeder;
+std::atomic_bool AudioOutputOpenAL::feederRunning(false);
+std::vector<AudioOutputOpenAL *> AudioOutputOpenAL::pullOutputs;
+
+//pull mode: ring size and AL buffer size in s, the ring holds at least RingFrames frames; feeder pass interval in ms
+static const double PullRingDuration = 0.3;
+static const int RingFrames = 4;
+static const double FeedChunkDuration = 0.02;
+static const int64_t FeedInterval = 5;
 
 #define SCOPE_LOCK_CONTEXT() \
     std::lock_guard<std::mutex> l(globalMutex); \
@@ -23,9 +40,31 @@ AudioOutputOpenAL::AudioOutputOpenAL() :
     mSwrSampleRate(0),
     mSwrFormat(AV_SAMPLE_FMT_NONE),
     mSwrNbSamples(0),
-    mALBufferState(0),
+    mALSource(0),
+    mFreeCount(0),
+    mQueuedHead(0),
+    mQueuedCount(0),
+    mPlayedTime(0),
+    mLastBufferDuration(0),
     mVolume(1.0f),
-    mMute(false)
+    mMute(false),
+    mDeviceOpens(0),
+    mDeviceOpenTime(0),
+    mReconfigures(0),
+    mLatency(-1),
+    mPullMode(false),
+    mRequestedPullMode(false),
+    mOpened(false),
+    mFlushSerial(0),
+    mRingFlushSerial(0),
+    mRegistered(false),
+    mFeeding(false),
+    mRingChannels(0),
+    mRingSampleRate(0),
+    mDevicePlayedTime(0),
+    mUnderruns(0),
+    mBufferFill(0),
+    mBufferCapacity(0)
 {
     qDebug() << __FUNCTION__;
 }
@@ -33,25 +72,47 @@ AudioOutputOpenAL::AudioOutputOpenAL() :
 AudioOutputOpenAL::~AudioOutputOpenAL()
 {
     qDebug() << __FUNCTION__;
+    closeDevice();
     swrFree();
 }
 
-bool AudioOutputOpenAL::open(AVFrame *)
+//buffers queued on a source share one format
+static ALenum alFormat(int channels)
+{
+    return channels == 1 ? AL_FORMAT_MONO16 : AL_FORMAT_STEREO16;
+}
+
+bool AudioOutputOpenAL::open(AVFrame * avFrame)
 {
     qDebug() << __FUNCTION__;
-    if (mContext)
-        return true;
+    bool reused = mContext != nullptr;
+    if (!mContext && !openDevice())
+        return false;
+    std::lock_guard<std::mutex> m(mModeMutex);
+    mOpened = true;
+    applyPullMode();
 
+    //only what depends on the stream is set up again, the converter follows the frames by itself
+    SCOPE_LOCK_CONTEXT();
+    resetSource();
+    mALFormat = alFormat(avFrame ? std::min(avFrame->channels, 2) : 2);
+    if(reused)
+        mReconfigures ++;
+    return true;
+}
+
+bool AudioOutputOpenAL::openDevice()
+{
     bool success = false;
 
     std::unique_ptr<int, std::function<void (int *)>> scope((int *)1, [&](void*)
     {
         if(success)
             return;
-        close();
+        closeDevice();
     });
 
-
+    int64_t openStart = av_gettime_relative();
     const ALCchar* defaultDevice = alcGetString(NULL, ALC_DEFAULT_DEVICE_SPECIFIER);
     qDebug() << __FUNCTION__ << "OpenAL opening default device:" << defaultDevice;
     mDevice = alcOpenDevice(NULL); //parameter: NULL or default_device
@@ -73,7 +134,6 @@ bool AudioOutputOpenAL::open(AVFrame *)
     qDebug() << __FUNCTION__ << "device:" << mDevice << "context:" << mContext;
 
     mALFormat = AL_FORMAT_STEREO16;
-    mALBufferState = 0;
 
     alGenBuffers(AL_NUM_BUFFERS, mALBuffers);
     err = alGetError();
@@ -89,6 +149,7 @@ bool AudioOutputOpenAL::open(AVFrame *)
     {
         qWarning() << __FUNCTION__ << "Failed to generate OpenAL source: " << alGetString(err);
         alDeleteBuffers(AL_NUM_BUFFERS, mALBuffers);
+        mALSource = 0;
         return false;
     }
 
@@ -99,18 +160,17 @@ bool AudioOutputOpenAL::open(AVFrame *)
     alSource3f(mALSource, AL_VELOCITY, 0.0, 0.0, 0.0);
     alListener3f(AL_POSITION, 0.0, 0.0, 0.0);
     alListenerf(AL_GAIN, mMute ? 0 : mVolume);
+    resetSource();
+    mDeviceOpens ++;
+    mDeviceOpenTime = (av_gettime_relative() - openStart) / 1000.0;
+    qDebug() << __FUNCTION__ << "device open time(ms):" << mDeviceOpenTime.load();
     success = true;
     return true;
 }
 
-bool AudioOutputOpenAL::stop()
+//stops the source and takes every buffer back, globalMutex held
+void AudioOutputOpenAL::resetSource()
 {
-    qDebug() << __FUNCTION__;
-    if(!mContext)
-        return false;
-
-    SCOPE_LOCK_CONTEXT();
-
     ALint state = 0;
     alSourceStop(mALSource);
     do
@@ -118,15 +178,129 @@ bool AudioOutputOpenAL::stop()
         alGetSourcei(mALSource, AL_SOURCE_STATE, &state);
     } while (alGetError() == AL_NO_ERROR && state == AL_PLAYING);
 
+    //a stopped source lets go of its whole queue at once
+    alSourcei(mALSource, AL_BUFFER, 0);
+    alGetError();
+    for(int i = 0; i < AL_NUM_BUFFERS; i++)
+        mFreeBuffers[i] = mALBuffers[i];
+    mFreeCount = AL_NUM_BUFFERS;
+    mQueuedHead = 0;
+    mQueuedCount = 0;
+    mPlayedTime = 0;
+    mLatency = 0;
+    //render() may be writing to the ring right now, it clears the ring itself once it sees the new
+    //serial and the feeder leaves it alone until then
+    mFlushSerial ++;
+    mFeeding = false;
+    mDevicePlayedTime = 0;
+    mBufferFill = 0;
+}
+
+//buffers the device is done with go back to the free list, globalMutex held
+void AudioOutputOpenAL::reclaimBuffers()
+{
     ALint processed = 0;
     alGetSourcei(mALSource, AL_BUFFERS_PROCESSED, &processed);
-    ALuint buf;
     while (processed-- > 0)
     {
-        alSourceUnqueueBuffers(mALSource, 1, &buf);
+        ALuint buffer = 0;
+        alSourceUnqueueBuffers(mALSource, 1, &buffer);
+        if(alGetError() != AL_NO_ERROR)
+            break;
+        mFreeBuffers[mFreeCount ++] = buffer;
+        if(mQueuedCount > 0)
+        {
+            const QueuedBuffer & played = mQueued[mQueuedHead];
+            mPlayedTime += (double)played.samples / played.sampleRate;
+            mQueuedHead = (mQueuedHead + 1) % AL_NUM_BUFFERS;
+            mQueuedCount --;
+        }
+    }
+}
+
+//AL_SAMPLE_OFFSET counts from the start of the oldest buffer still queued, globalMutex held
+void AudioOutputOpenAL::queryPosition(double & latency, double & played)
+{
+    ALint state = 0;
+    ALint offset = 0;
+    alGetSourcei(mALSource, AL_SOURCE_STATE, &state);
+    alGetSourcei(mALSource, AL_SAMPLE_OFFSET, &offset);
+    //a stopped source played everything it had
+    if(state != AL_PLAYING && state != AL_PAUSED)
+        offset = INT32_MAX;
+
+    latency = 0;
+    played = mPlayedTime;
+    for(int i = 0; i < mQueuedCount; i++)
+    {
+        const QueuedBuffer & buffer = mQueued[(mQueuedHead + i) % AL_NUM_BUFFERS];
+        int consumed = std::min<ALint>(offset, buffer.samples);
+        offset -= consumed;
+        latency += (double)(buffer.samples - consumed) / buffer.sampleRate;
+        played += (double)consumed / buffer.sampleRate;
+    }
+    mLatency = latency;
+}
+
+double AudioOutputOpenAL::getLatency()
+{
+    if(!mContext)
+        return -1;
+    //the feeder keeps the device part current, the ring is ours
+    if(mPullMode)
+    {
+        bool flushed = mFlushSerial != mRingFlushSerial;
+        double ring = mRing && !flushed ? (double)mRing->size() / (mRingChannels * 2) / mRingSampleRate : 0;
+        return mLatency + ring;
     }
-    mALBufferState = 0;
+    SCOPE_LOCK_CONTEXT();
+    double latency = 0;
+    double played = 0;
+    queryPosition(latency, played);
+    return latency;
+}
+
+double AudioOutputOpenAL::getPlayedTime()
+{
+    if(!mContext)
+        return -1;
+    if(mPullMode)
+        return mDevicePlayedTime;
+    SCOPE_LOCK_CONTEXT();
+    double latency = 0;
+    double played = 0;
+    queryPosition(latency, played);
+    return played;
+}
+
+//what render() takes without waiting: the ring's free part in pull mode, the free buffers in push mode
+double AudioOutputOpenAL::getBufferSpace()
+{
+    if(!mContext)
+        return -1;
+    if(mPullMode)
+    {
+        if(!mRing)
+            return -1;
+        size_t used = mFlushSerial != mRingFlushSerial ? 0 : mRing->size();
+        return (double)(mRing->capacity() - used) / (mRingChannels * 2) / mRingSampleRate;
+    }
+    SCOPE_LOCK_CONTEXT();
+    //nothing queued yet, there is no size to go by and no buffer is taken
+    if(mLastBufferDuration <= 0)
+        return -1;
+    reclaimBuffers();
+    return mFreeCount * mLastBufferDuration;
+}
+
+bool AudioOutputOpenAL::stop()
+{
+    qDebug() << __FUNCTION__;
+    if(!mContext)
+        return false;
 
+    SCOPE_LOCK_CONTEXT();
+    resetSource();
     return true;
 }
 
@@ -180,44 +354,230 @@ bool AudioOutputOpenAL::getMute()
 bool AudioOutputOpenAL::close()
 {
     qDebug() << __FUNCTION__;
+    std::lock_guard<std::mutex> m(mModeMutex);
+    mOpened = false;
     if(!mContext)
+    {
+        applyPullMode();
         return true;
+    }
 
-    SCOPE_LOCK_CONTEXT();
+    //the next open() reuses device, context and source
+    {
+        SCOPE_LOCK_CONTEXT();
+        resetSource();
+        swrFree();
+    }
+    applyPullMode();
+    return true;
+}
 
-    mALBufferState = 0;
+void AudioOutputOpenAL::closeDevice()
+{
+    if(!mContext && !mDevice)
+        return;
 
-    ALint state = 0;
-    alSourceStop(mALSource);
-    do
+    unregisterPull();
     {
-        alGetSourcei(mALSource, AL_SOURCE_STATE, &state);
-    } while (alGetError() == AL_NO_ERROR && state == AL_PLAYING);
+        std::lock_guard<std::mutex> l(globalMutex);
+        if(mContext)
+        {
+            alcMakeContextCurrent(mContext);
+            if(mALSource)
+            {
+                resetSource();
+                alDeleteSources(1, &mALSource);
+                alDeleteBuffers(AL_NUM_BUFFERS, mALBuffers);
+                mALSource = 0;
+            }
+            alcMakeContextCurrent(NULL);
+            alcDestroyContext(mContext);
+            mContext = nullptr;
+        }
+    }
+    if(mDevice)
+    {
+        alcCloseDevice(mDevice);
+        mDevice = nullptr;
+    }
+}
 
-    ALint processed = 0;
-    alGetSourcei(mALSource, AL_BUFFERS_PROCESSED, &processed);
-    ALuint buf;
-    while (processed-- > 0)
+void AudioOutputOpenAL::dump(Info & info) const
+{
+    info.deviceOpens = mDeviceOpens;
+    info.deviceOpenTime = mDeviceOpenTime;
+    info.reconfigures = mReconfigures;
+    info.latency = mLatency;
+    info.underruns = mUnderruns;
+    info.bufferFill = mBufferFill;
+    info.bufferCapacity = mPullMode ? mBufferCapacity.load() : 0;
+}
+
+void AudioOutputOpenAL::setPullMode(bool value)
+{
+    qDebug() << __FUNCTION__ << value;
+    std::lock_guard<std::mutex> m(mModeMutex);
+    mRequestedPullMode = value;
+    //render() may be running, the mode changes with the next open()/close()
+    if(!mOpened)
+        applyPullMode();
+}
+
+//mModeMutex held, nothing renders
+void AudioOutputOpenAL::applyPullMode()
+{
+    mPullMode = mRequestedPullMode.load();
+    if(!mPullMode)
+        unregisterPull();
+    else if(mContext && !mRegistered)
+        registerPull();
+}
+
+void AudioOutputOpenAL::registerPull()
+{
+    std::lock_guard<std::mutex> l(feederMutex);
+    {
+        std::lock_guard<std::mutex> g(globalMutex);
+        pullOutputs.push_back(this);
+        mRegistered = true;
+    }
+    if(!feederRunning)
     {
-        alSourceUnqueueBuffers(mALSource, 1, &buf);
+        feederRunning = true;
+        feeder = std::thread(&AudioOutputOpenAL::feederLoop);
     }
-    alDeleteSources(1, &mALSource);
-    alDeleteBuffers(AL_NUM_BUFFERS, mALBuffers);
-    mALBufferState = 0;
+}
 
-    alcMakeContextCurrent(NULL);
-    if(mContext)
+void AudioOutputOpenAL::unregisterPull()
+{
+    if(!mRegistered)
+        return;
+    std::lock_guard<std::mutex> l(feederMutex);
+    bool last = false;
     {
-        alcDestroyContext(mContext);
-        mContext = nullptr;
+        std::lock_guard<std::mutex> g(globalMutex);
+        pullOutputs.erase(std::remove(pullOutputs.begin(), pullOutputs.end(), this), pullOutputs.end());
+        mRegistered = false;
+        last = pullOutputs.empty();
     }
-    if(mDevice)
+    if(last && feederRunning)
     {
-        alcCloseDevice(mDevice);
-        mDevice = nullptr;
+        feederRunning = false;
+        feeder.join();
     }
-    swrFree();
+}
+
+//one thread for every pull mode output, the only one taking globalMutex while they play
+void AudioOutputOpenAL::feederLoop()
+{
+    qDebug() << __FUNCTION__ << "start";
+    while(feederRunning)
+    {
+        {
+            std::lock_guard<std::mutex> l(globalMutex);
+            for(auto output : pullOutputs)
+            {
+                alcMakeContextCurrent(output->mContext);
+                output->feed();
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(FeedInterval));
+    }
+    qDebug() << __FUNCTION__ << "end";
+}
+
+//moves ring data into free AL buffers, globalMutex held
+void AudioOutputOpenAL::feed()
+{
+    //what is in the ring was written before the last reset
+    if(!mRing || mFlushSerial != mRingFlushSerial)
+        return;
+    reclaimBuffers();
+
+    size_t frameBytes = mRingChannels * 2;
+    size_t chunk = mFeedBuffer.size();
+    while(mFreeCount > 0)
+    {
+        size_t available = mRing->size() / frameBytes * frameBytes;
+        //a short buffer only when the device would run dry otherwise
+        if(available == 0 || (available < chunk && mQueuedCount > 0))
+            break;
+        size_t size = mRing->read(mFeedBuffer.data(), std::min(available, chunk));
+        ALuint buffer = mFreeBuffers[-- mFreeCount];
+        alBufferData(buffer, mALFormat, mFeedBuffer.data(), (ALsizei)size, mRingSampleRate);
+        alSourceQueueBuffers(mALSource, 1, &buffer);
+        ALCenum err = alGetError();
+        if (err != AL_NO_ERROR)
+        {
+            qWarning() << __FUNCTION__ << "Failed to buffering: " << alGetString(err);
+            mFreeBuffers[mFreeCount ++] = buffer;
+            break;
+        }
+        mQueued[(mQueuedHead + mQueuedCount) % AL_NUM_BUFFERS] = QueuedBuffer{ (int)(size / frameBytes), mRingSampleRate };
+        mQueuedCount ++;
+    }
+
+    ALint state = 0;
+    alGetSourcei(mALSource, AL_SOURCE_STATE, &state);
+    if(state != AL_PLAYING && mQueuedCount > 0)
+    {
+        //started before and stopped by itself: it ran out before the ring had more
+        if(mFeeding)
+            mUnderruns ++;
+        alSourcePlay(mALSource);
+        mFeeding = true;
+    }
+
+    double latency = 0;
+    double played = 0;
+    queryPosition(latency, played);
+    mDevicePlayedTime = played;
+    mBufferFill = (double)mRing->size() / frameBytes / mRingSampleRate;
+}
+
+//a new ring for another format, what is queued of the old one is dropped, globalMutex held
+void AudioOutputOpenAL::setupRing(int channels, int sampleRate, int samples)
+{
+    resetSource();
+    size_t frameBytes = channels * 2;
+    size_t ringSamples = std::max<size_t>((size_t)(PullRingDuration * sampleRate), (size_t)samples * RingFrames);
+    mRing.reset(new miniplayer::SPSCByteRing(ringSamples * frameBytes));
+    mFeedBuffer.resize((size_t)(FeedChunkDuration * sampleRate) * frameBytes);
+    mRingChannels = channels;
+    mRingSampleRate = sampleRate;
+    mALFormat = alFormat(channels);
+    mBufferCapacity = (double)mRing->capacity() / frameBytes / sampleRate;
+    mRingFlushSerial = mFlushSerial.load();
+}
 
+bool AudioOutputOpenAL::renderPull(AVFrame * frame)
+{
+    //a reset since the last frame, only the producer may clear the ring
+    if(mRing && mFlushSerial != mRingFlushSerial)
+    {
+        SCOPE_LOCK_CONTEXT();
+        mRing->clear();
+        resetSource();
+        mRingFlushSerial = mFlushSerial.load();
+    }
+
+    if(!mRing || frame->channels != mRingChannels || frame->sample_rate != mRingSampleRate)
+    {
+        qDebug() << __FUNCTION__ << "ring format, channels:" << frame->channels << "sample rate:" << frame->sample_rate;
+        SCOPE_LOCK_CONTEXT();
+        if(mRing)
+            mReconfigures ++;
+        setupRing(frame->channels, frame->sample_rate, frame->nb_samples);
+    }
+
+    //no lock and no waiting, the caller checks getBufferSpace() first
+    size_t size = frame->nb_samples * frame->channels * av_get_bytes_per_sample(AV_SAMPLE_FMT_S16);
+    if(mRing->capacity() - mRing->size() < size)
+    {
+        qWarning() << __FUNCTION__ << "ring full, dropping" << frame->nb_samples << "samples";
+        return false;
+    }
+    mRing->write(frame->data[0], size);
     return true;
 }
 
@@ -335,44 +695,46 @@ bool AudioOutputOpenAL::render(AVFrame * avFrame)
         return false;
     }
 
-    SCOPE_LOCK_CONTEXT();
+    if(mPullMode)
+        return renderPull(dstFrame);
 
-    //ALint processed,queued;
-    //alGetSourcei(mALSource, AL_BUFFERS_QUEUED, &queued);
+    SCOPE_LOCK_CONTEXT();
 
-    ALuint buffer = 0;
-    if(mALBufferState < AL_NUM_BUFFERS)
-        buffer = mALBuffers[mALBufferState ++];
-    else
+    //a playlist item with another channel count, the source starts over with buffers of the new format
+    ALenum alFrameFormat = alFormat(dstFrame->channels);
+    if(alFrameFormat != mALFormat)
     {
-        ALint processed;
-        while(true)
-        {
-            alGetSourcei(mALSource, AL_BUFFERS_PROCESSED, &processed);
-            if(processed > 0)
-            {
-//                if(processed > 1)
-//                    qDebug() << processed;
-                alSourceUnqueueBuffers(mALSource, 1, &buffer);
-                break;
-            }
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
-        }
+        qDebug() << __FUNCTION__ << "format change, channels:" << dstFrame->channels;
+        resetSource();
+        mALFormat = alFrameFormat;
+        mReconfigures ++;
     }
 
-    //qDebug() << buffer - mALBuffers[0];
-
-    //qDebug() << dstFrame->linesize[0] << buffer << processed << queued;
+    //once the source ran dry all of its queue is processed, none of it may be played again;
+    //the render stage waits on getBufferSpace() first, this only covers a block bigger than the last one
+    reclaimBuffers();
+    while(mFreeCount == 0)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        reclaimBuffers();
+    }
+    ALuint buffer = mFreeBuffers[-- mFreeCount];
 
-    alBufferData(buffer, mALFormat, dstFrame->data[0], dstFrame->linesize[0], dstFrame->sample_rate);
+    //linesize may be padded, only the samples go to the device
+    int size = dstFrame->nb_samples * dstFrame->channels * av_get_bytes_per_sample(AV_SAMPLE_FMT_S16);
+    alBufferData(buffer, mALFormat, dstFrame->data[0], size, dstFrame->sample_rate);
     alSourceQueueBuffers(mALSource, 1, &buffer);
 
     ALCenum err = alGetError();
     if (err != AL_NO_ERROR)
     {
         qWarning() << __FUNCTION__ << "Failed to buffering: " << alGetString(err);
+        mFreeBuffers[mFreeCount ++] = buffer;
         return false;
     }
+    mQueued[(mQueuedHead + mQueuedCount) % AL_NUM_BUFFERS] = QueuedBuffer{ dstFrame->nb_samples, dstFrame->sample_rate };
+    mQueuedCount ++;
+    mLastBufferDuration = (double)dstFrame->nb_samples / dstFrame->sample_rate;
 
     ALint sourceState;
     alGetSourcei(mALSource, AL_SOURCE_STATE, &sourceState);
@@ -2,12 +2,24 @@
 #define AUDIOOUTPUTOPENAL_HPP
 
 #include "AudioOutput.hpp"
+#include "../../RingBuffer.hpp"
 #include <al.h>
 #include <alc.h>
 #include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
 
 #define AL_NUM_BUFFERS 6
 
+/*
+ * The device, context and source live as long as the output, open()/close() only set up and end playback.
+ *
+ * In push mode (the default) render() queues every frame on the source itself under the process-wide
+ * OpenAL lock, getBufferSpace() tells from the free buffers when it would have to wait for one. In pull mode render() only copies the PCM into a
+ * lock-free ring, one thread shared by all pull mode outputs refills their sources from it.
+ */
 class AudioOutputOpenAL : public AudioOutput
 {
 public:
@@ -21,7 +33,31 @@ public:
     float getVolume();
     bool setMute(bool value);
     bool getMute();
+    double getLatency();
+    double getPlayedTime();
+    double getBufferSpace();
+    void dump(Info & info) const;
+    //takes effect right away while the output is closed, otherwise with the next open()/close()
+    void setPullMode(bool value);
+    bool getPullMode() const { return mRequestedPullMode; }
 private:
+    typedef struct {
+        int samples;
+        int sampleRate;
+    } QueuedBuffer;
+
+    bool openDevice();
+    void closeDevice();
+    void resetSource();
+    void reclaimBuffers();
+    void queryPosition(double & latency, double & played);
+    bool renderPull(AVFrame * frame);
+    void setupRing(int channels, int sampleRate, int samples);
+    void feed();
+    void applyPullMode();
+    void registerPull();
+    void unregisterPull();
+    static void feederLoop();
     bool swrConvert(AVFrame * src);
     void swrFree();
 private:
@@ -38,12 +74,44 @@ private:
     int mSwrNbSamples;
     ALuint mALSource;
     ALuint mALBuffers[AL_NUM_BUFFERS];
+    ALuint mFreeBuffers[AL_NUM_BUFFERS];
+    int mFreeCount;
+    QueuedBuffer mQueued[AL_NUM_BUFFERS];   //what the source has queued, oldest first
+    int mQueuedHead;
+    int mQueuedCount;
+    double mPlayedTime;                     //s of the buffers taken back since the last reset
+    double mLastBufferDuration;             //s of the buffer queued last, what a free one is taken to hold
     ALenum mALFormat;
-    int mALBufferState;
     float mVolume;
     bool mMute;
+    std::atomic_int mDeviceOpens;
+    std::atomic<double> mDeviceOpenTime;
+    std::atomic_int mReconfigures;
+    std::atomic<double> mLatency;
+
+    //pull mode, the ring is replaced and cleared by the producer (render()) under globalMutex only
+    std::atomic_bool mPullMode;             //changes only while closed
+    std::atomic_bool mRequestedPullMode;
+    bool mOpened;
+    std::mutex mModeMutex;                  //mRequestedPullMode against open()/close(), taken before feederMutex
+    std::atomic<uint64_t> mFlushSerial;     //bumped by resetSource() from any thread
+    std::atomic<uint64_t> mRingFlushSerial; //the last flush the producer cleared the ring for
+    bool mRegistered;
+    bool mFeeding;                          //the feeder started the source since the last reset
+    std::unique_ptr<miniplayer::SPSCByteRing> mRing;
+    std::atomic_int mRingChannels;
+    std::atomic_int mRingSampleRate;
+    std::vector<uint8_t> mFeedBuffer;
+    std::atomic<double> mDevicePlayedTime;
+    std::atomic<int64_t> mUnderruns;
+    std::atomic<double> mBufferFill;
+    std::atomic<double> mBufferCapacity;
 
     static std::mutex globalMutex;
+    static std::mutex feederMutex;          //starts and stops the feeder, taken before globalMutex
+    static std::thread feeder;
+    static std::atomic_bool feederRunning;
+    static std::vector<AudioOutputOpenAL *> pullOutputs;
 };
 
 #endif // AUDIOOUTPUTOPENAL_HPP
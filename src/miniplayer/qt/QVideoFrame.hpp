@@ -10,21 +10,28 @@ extern "C"
 #include <libavformat/avformat.h>
 }
 
+#include "../FramePool.hpp"
+
 namespace miniplayer
 {
 
 struct QVideoFrame
 {
     AVFrame* frame;
+    std::shared_ptr<AVFramePool> pool;
 
-    QVideoFrame(AVFrame* f = nullptr) : frame(f)
+    QVideoFrame(AVFrame* f = nullptr, const std::shared_ptr<AVFramePool> & p = nullptr) : frame(f), pool(p)
     {
 
     }
 
+    //the surface is done with the frame, hand it back to the decoder
     virtual ~QVideoFrame()
     {
-        av_frame_free(&frame);
+        if(pool)
+            pool->release(&frame);
+        else
+            av_frame_free(&frame);
     }
 };
 
@@ -38,7 +45,7 @@ struct QI420VideoFrame : public QVideoFrame
 
     }
 
-    QI420VideoFrame(AVFrame * f) : QVideoFrame(f)
+    QI420VideoFrame(AVFrame * f, const std::shared_ptr<AVFramePool> & p = nullptr) : QVideoFrame(f, p)
     {
         width = f->width;
         height = f->height;
@@ -1,6 +1,115 @@
 #include "QmlMiniPlayer.hpp"
 #include "QmlVideoSurface.hpp"
 
+QVariantMap QmlDumpInfo::metrics() const
+{
+    auto latency = [](const LatencyInfo & info)
+    {
+        QVariantMap result;
+        result["count"] = static_cast<qulonglong>(info.count);
+        result["mean"] = info.mean;
+        result["p50"] = info.p50;
+        result["p95"] = info.p95;
+        result["p99"] = info.p99;
+        result["max"] = info.max;
+        return result;
+    };
+
+    const auto & metrics = data.metrics;
+    QVariantMap result;
+    result["enabled"] = metrics.enabled;
+    for(int i = 0; i < PipelineMetrics::StageCount; i++)
+        result[PipelineMetrics::stageName(i)] = latency(metrics.stages[i]);
+    result["avDrift"] = latency(metrics.avDrift);
+    result["avDriftMean"] = metrics.avDriftMean;
+    for(int i = 0; i < PipelineMetrics::CounterCount; i++)
+        result[PipelineMetrics::counterName(i)] = static_cast<qulonglong>(metrics.counters[i]);
+    result["videoDecodeFps"] = metrics.videoDecodeFps;
+    result["audioDecodeFps"] = metrics.audioDecodeFps;
+    result["videoDecodeBitrate"] = metrics.videoDecodeBitrate;
+    result["audioDecodeBitrate"] = metrics.audioDecodeBitrate;
+    result["videoDecoderFps"] = metrics.videoDecoderThroughput;
+    result["audioDecoderFps"] = metrics.audioDecoderThroughput;
+    for(int i = 0; i < PipelineMetrics::ThreadCount; i++)
+        result[QString(PipelineMetrics::threadName(i)) + "Cpu"] = metrics.threadCpuTime[i];
+    QVariantMap startup;
+    for(int i = 0; i < PipelineMetrics::StartupPhaseCount; i++)
+        startup[PipelineMetrics::startupPhaseName(i)] = metrics.startup[i];
+    result["startup"] = startup;
+    return result;
+}
+
+static QVariantMap framePoolInfo(const AVFramePool::Info & info)
+{
+    QVariantMap result;
+    result["allocated"] = static_cast<qlonglong>(info.allocated);
+    result["available"] = static_cast<qlonglong>(info.available);
+    result["inUse"] = static_cast<qlonglong>(info.inUse);
+    return result;
+}
+
+QVariantMap QmlDumpInfo::videoFramePool() const
+{
+    return framePoolInfo(data.videoFramePool);
+}
+
+QVariantMap QmlDumpInfo::audioFramePool() const
+{
+    return framePoolInfo(data.audioFramePool);
+}
+
+QVariantMap QmlDumpInfo::readAhead() const
+{
+    QVariantMap result;
+    result["capacity"] = static_cast<qlonglong>(data.readAhead.capacity);
+    result["fill"] = static_cast<qlonglong>(data.readAhead.fill);
+    result["stalls"] = static_cast<qlonglong>(data.readAhead.stalls);
+    result["stallTime"] = data.readAhead.stallTime;
+    result["windowSeeks"] = static_cast<qlonglong>(data.readAhead.windowSeeks);
+    result["inputSeeks"] = static_cast<qlonglong>(data.readAhead.inputSeeks);
+    result["connections"] = data.readAhead.connections;
+    result["bytesRead"] = static_cast<qlonglong>(data.readAhead.bytesRead);
+    return result;
+}
+
+QVariantMap QmlDumpInfo::timeshift() const
+{
+    QVariantMap result;
+    result["budget"] = static_cast<qlonglong>(data.timeshift.budget);
+    result["used"] = static_cast<qlonglong>(data.timeshift.used);
+    result["windowStart"] = data.timeshift.windowStart;
+    result["windowEnd"] = data.timeshift.windowEnd;
+    result["packetsWritten"] = static_cast<qlonglong>(data.timeshift.packetsWritten);
+    result["packetsRead"] = static_cast<qlonglong>(data.timeshift.packetsRead);
+    result["overruns"] = static_cast<qlonglong>(data.timeshift.overruns);
+    return result;
+}
+
+QVariantMap QmlDumpInfo::recording() const
+{
+    QVariantMap result;
+    result["recording"] = data.recording.recording;
+    result["packetsWritten"] = static_cast<qlonglong>(data.recording.packetsWritten);
+    result["packetsDropped"] = static_cast<qlonglong>(data.recording.packetsDropped);
+    result["bytesWritten"] = static_cast<qlonglong>(data.recording.bytesWritten);
+    result["queued"] = static_cast<qlonglong>(data.recording.queued);
+    result["duration"] = data.recording.duration;
+    return result;
+}
+
+QVariantMap QmlDumpInfo::audioOutput() const
+{
+    QVariantMap result;
+    result["deviceOpens"] = data.audioOutput.deviceOpens;
+    result["deviceOpenTime"] = data.audioOutput.deviceOpenTime;
+    result["reconfigures"] = data.audioOutput.reconfigures;
+    result["latency"] = data.audioOutput.latency;
+    result["underruns"] = (qint64)data.audioOutput.underruns;
+    result["bufferFill"] = data.audioOutput.bufferFill;
+    result["bufferCapacity"] = data.audioOutput.bufferCapacity;
+    return result;
+}
+
 
 QmlMiniPlayer::QmlMiniPlayer(QQuickItem *parent)
     : QObject(parent)
@@ -60,7 +169,7 @@ void QmlMiniPlayer::videoFrameUpdated()
 void QmlMiniPlayer::onVideoRender(AVFrame * avframe)
 {
     std::lock_guard<std::mutex> l(mVideoRenderMutex);
-    mVideoRenderFrame = std::make_shared<QI420VideoFrame>(avframe);
+    mVideoRenderFrame = std::make_shared<QI420VideoFrame>(avframe, mPlayer->getVideoFramePool());
     QMetaObject::invokeMethod(this, "videoFrameUpdated");
 }
 
@@ -89,6 +198,12 @@ void QmlMiniPlayer::setPosition(double pos)
     mPlayer->seek(pos);
 }
 
+//while the slider is dragged, setting position afterwards resumes normal playback
+void QmlMiniPlayer::scrub(double pos)
+{
+    mPlayer->seek(pos, true);
+}
+
 double QmlMiniPlayer::duration()
 {
     return mPlayer->getDuration();
@@ -96,7 +211,7 @@ double QmlMiniPlayer::duration()
 
 bool QmlMiniPlayer::seekable()
 {
-    return mPlayer->isSeekable();
+    return mPlayer->isSeekable() || mPlayer->isTimeshifting();
 }
 
 long QmlMiniPlayer::downloadSpeed()
@@ -114,6 +229,284 @@ bool QmlMiniPlayer::endReached()
     return mPlayer->isEndReached();
 }
 
+bool QmlMiniPlayer::metricsEnabled()
+{
+    return mPlayer->isMetricsEnabled();
+}
+
+void QmlMiniPlayer::setMetricsEnabled(bool val)
+{
+    mPlayer->setMetricsEnabled(val);
+}
+
+bool QmlMiniPlayer::sharedExecutor()
+{
+    return mPlayer->getExecutor() != nullptr;
+}
+
+void QmlMiniPlayer::setSharedExecutor(bool val)
+{
+    mPlayer->setExecutor(val ? Executor::shared() : nullptr);
+}
+
+bool QmlMiniPlayer::boosted()
+{
+    return mPlayer->isBoosted();
+}
+
+void QmlMiniPlayer::setBoosted(bool val)
+{
+    mPlayer->setBoosted(val);
+}
+
+//0 leaves buffering to the adaptive policy
+double QmlMiniPlayer::startBufferDuration()
+{
+    return mPlayer->getStartBufferDuration();
+}
+
+void QmlMiniPlayer::setStartBufferDuration(double val)
+{
+    mPlayer->setStartBufferDuration(val);
+}
+
+int QmlMiniPlayer::maxPacketBufferSize()
+{
+    return (int)mPlayer->getMaxPacketBufferSize();
+}
+
+void QmlMiniPlayer::setMaxPacketBufferSize(int val)
+{
+    mPlayer->setMaxPacketBufferSize(val);
+}
+
+bool QmlMiniPlayer::accurateSeek()
+{
+    return mPlayer->isAccurateSeek();
+}
+
+void QmlMiniPlayer::setAccurateSeek(bool val)
+{
+    mPlayer->setAccurateSeek(val);
+}
+
+int QmlMiniPlayer::trickSpeed()
+{
+    return mPlayer->getTrickSpeed();
+}
+
+void QmlMiniPlayer::setTrickSpeed(int val)
+{
+    mPlayer->setTrickSpeed(val);
+}
+
+double QmlMiniPlayer::playbackRate()
+{
+    return mPlayer->getPlaybackRate();
+}
+
+void QmlMiniPlayer::setPlaybackRate(double val)
+{
+    mPlayer->setPlaybackRate(val);
+}
+
+double QmlMiniPlayer::liveLatency()
+{
+    return mPlayer->getLiveLatency();
+}
+
+void QmlMiniPlayer::setLiveLatency(double val)
+{
+    mPlayer->setLiveLatency(val);
+}
+
+bool QmlMiniPlayer::fastOpen()
+{
+    return mPlayer->isFastOpen();
+}
+
+void QmlMiniPlayer::setFastOpen(bool val)
+{
+    mPlayer->setFastOpen(val);
+}
+
+int QmlMiniPlayer::readAheadSize()
+{
+    return (int)mPlayer->getReadAheadSize();
+}
+
+void QmlMiniPlayer::setReadAheadSize(int val)
+{
+    mPlayer->setReadAheadSize(val);
+}
+
+int QmlMiniPlayer::readAheadConnections()
+{
+    return mPlayer->getReadAheadConnections();
+}
+
+void QmlMiniPlayer::setReadAheadConnections(int val)
+{
+    mPlayer->setReadAheadConnections(val);
+}
+
+QString QmlMiniPlayer::streamInfoCachePath()
+{
+    return QString::fromStdString(StreamInfoCache::shared()->getPath());
+}
+
+void QmlMiniPlayer::setStreamInfoCachePath(const QString & val)
+{
+    StreamInfoCache::shared()->setPath(val.toStdString());
+}
+
+QString QmlMiniPlayer::timeshiftPath()
+{
+    return QString::fromStdString(mPlayer->getTimeshiftPath());
+}
+
+void QmlMiniPlayer::setTimeshiftPath(const QString & val)
+{
+    mPlayer->setTimeshift(val.toStdString(), mPlayer->getTimeshiftBudget());
+}
+
+qint64 QmlMiniPlayer::timeshiftBudget()
+{
+    return mPlayer->getTimeshiftBudget();
+}
+
+void QmlMiniPlayer::setTimeshiftBudget(qint64 val)
+{
+    mPlayer->setTimeshift(mPlayer->getTimeshiftPath(), val);
+}
+
+double QmlMiniPlayer::timeshiftStart()
+{
+    return mPlayer->getTimeshiftStart();
+}
+
+bool QmlMiniPlayer::recording()
+{
+    return mPlayer->isRecording();
+}
+
+QStringList QmlMiniPlayer::playlist()
+{
+    QStringList result;
+    for(const auto & path : mPlayer->getPlaylist())
+        result.append(QString::fromStdString(path));
+    return result;
+}
+
+void QmlMiniPlayer::setPlaylist(const QStringList & val)
+{
+    std::vector<std::string> paths;
+    for(const auto & path : val)
+        paths.push_back(path.toStdString());
+    mPlayer->setPlaylist(paths);
+}
+
+bool QmlMiniPlayer::playlistLoop()
+{
+    return mPlayer->isPlaylistLoop();
+}
+
+void QmlMiniPlayer::setPlaylistLoop(bool val)
+{
+    mPlayer->setPlaylistLoop(val);
+}
+
+bool QmlMiniPlayer::audioPullMode()
+{
+    return mAudioOutput.getPullMode();
+}
+
+void QmlMiniPlayer::setAudioPullMode(bool val)
+{
+    mAudioOutput.setPullMode(val);
+}
+
+bool QmlMiniPlayer::prefetchEnabled()
+{
+    return mPlayer->getPrefetcher() != nullptr;
+}
+
+void QmlMiniPlayer::setPrefetchEnabled(bool val)
+{
+    mPlayer->setPrefetcher(val ? InputPrefetcher::shared() : nullptr);
+}
+
+//the standby set is shared by all players, so are its caps
+int QmlMiniPlayer::standbyInputs()
+{
+    return InputPrefetcher::shared()->getMaxInputs();
+}
+
+void QmlMiniPlayer::setStandbyInputs(int val)
+{
+    InputPrefetcher::shared()->setMaxInputs(val);
+}
+
+int QmlMiniPlayer::standbyBytes()
+{
+    return static_cast<int>(InputPrefetcher::shared()->getMaxBytes());
+}
+
+void QmlMiniPlayer::setStandbyBytes(int val)
+{
+    InputPrefetcher::shared()->setMaxBytes(val);
+}
+
+int QmlMiniPlayer::standbyProbes()
+{
+    return InputPrefetcher::shared()->getMaxProbes();
+}
+
+void QmlMiniPlayer::setStandbyProbes(int val)
+{
+    InputPrefetcher::shared()->setMaxProbes(val);
+}
+
+int QmlMiniPlayer::decoderThreads()
+{
+    return mPlayer->getDecoderThreads();
+}
+
+void QmlMiniPlayer::setDecoderThreads(int val)
+{
+    mPlayer->setDecoderThreads(val);
+}
+
+QmlMiniPlayer::DecoderThreadType QmlMiniPlayer::decoderThreadType()
+{
+    return static_cast<DecoderThreadType>(mPlayer->getDecoderThreadType());
+}
+
+void QmlMiniPlayer::setDecoderThreadType(DecoderThreadType val)
+{
+    mPlayer->setDecoderThreadType(val);
+}
+
+void QmlMiniPlayer::resetMetrics()
+{
+    mPlayer->resetMetrics();
+}
+
+bool QmlMiniPlayer::dumpMetrics(const QString & path)
+{
+    return mPlayer->dumpMetrics(path.toStdString());
+}
+
+void QmlMiniPlayer::startRecording(const QString & path)
+{
+    mPlayer->startRecording(path.toStdString());
+}
+
+void QmlMiniPlayer::stopRecording()
+{
+    mPlayer->stopRecording();
+}
+
 void QmlMiniPlayer::mute()
 {
     mPlayer->mute();
@@ -164,6 +557,14 @@ void QmlMiniPlayer::open(const QString & mediaPath)
     mPlayer->open(mediaPath.toStdString());
 }
 
+void QmlMiniPlayer::prefetch(const QStringList & mediaPaths)
+{
+    std::vector<std::string> urls;
+    for(const auto & path : mediaPaths)
+        urls.push_back(path.toStdString());
+    InputPrefetcher::shared()->prefetch(urls);
+}
+
 void QmlMiniPlayer::stop()
 {
     mPlayer->stop();
@@ -19,6 +19,14 @@ class QmlDumpInfo : public QObject
     Q_OBJECT
     Q_PROPERTY(int packetBufferSize READ packetBufferSize CONSTANT)
     Q_PROPERTY(int maxPacketBufferSize READ maxPacketBufferSize CONSTANT)
+    Q_PROPERTY(double startBufferDuration READ startBufferDuration CONSTANT)
+    Q_PROPERTY(int rebufferCount READ rebufferCount CONSTANT)
+    Q_PROPERTY(int keyframeIndexSize READ keyframeIndexSize CONSTANT)
+    Q_PROPERTY(double liveLatency READ liveLatency CONSTANT)
+    Q_PROPERTY(double liveLatencyTarget READ liveLatencyTarget CONSTANT)
+    Q_PROPERTY(double catchUpRate READ catchUpRate CONSTANT)
+    Q_PROPERTY(qint64 catchUpSpeedUps READ catchUpSpeedUps CONSTANT)
+    Q_PROPERTY(qint64 catchUpJumps READ catchUpJumps CONSTANT)
     Q_PROPERTY(int maxFrameQueueSize READ maxFrameQueueSize CONSTANT)
     Q_PROPERTY(int videoPacketQueueSize READ videoPacketQueueSize CONSTANT)
     Q_PROPERTY(int audioPacketQueueSize READ audioPacketQueueSize CONSTANT)
@@ -30,12 +38,34 @@ class QmlDumpInfo : public QObject
     Q_PROPERTY(double audioFrameQueueDuration READ audioFrameQueueDuration CONSTANT)
     Q_PROPERTY(double videoClock READ videoClock CONSTANT)
     Q_PROPERTY(double audioClock READ audioClock CONSTANT)
+    Q_PROPERTY(int videoDecoderThreads READ videoDecoderThreads CONSTANT)
+    Q_PROPERTY(int videoDecoderThreadType READ videoDecoderThreadType CONSTANT)
+    Q_PROPERTY(bool warmStart READ warmStart CONSTANT)
+    Q_PROPERTY(bool streamInfoCached READ streamInfoCached CONSTANT)
+    Q_PROPERTY(qint64 packetShellsAllocated READ packetShellsAllocated CONSTANT)
+    Q_PROPERTY(QVariantMap videoFramePool READ videoFramePool CONSTANT)
+    Q_PROPERTY(QVariantMap audioFramePool READ audioFramePool CONSTANT)
+    Q_PROPERTY(QVariantMap readAhead READ readAhead CONSTANT)
+    Q_PROPERTY(QVariantMap timeshift READ timeshift CONSTANT)
+    Q_PROPERTY(QVariantMap recording READ recording CONSTANT)
+    Q_PROPERTY(QVariantMap audioOutput READ audioOutput CONSTANT)
+    Q_PROPERTY(qint64 itemSwitches READ itemSwitches CONSTANT)
+    Q_PROPERTY(double itemSwitchGap READ itemSwitchGap CONSTANT)
+    Q_PROPERTY(QVariantMap metrics READ metrics CONSTANT)
 public:    
     explicit QmlDumpInfo(QObject *parent = NULL) : QObject(parent)
     {}
 
     int packetBufferSize() const { return (int)data.packetBufferSize; }
     int maxPacketBufferSize() const { return (int)data.maxPacketBufferSize; }
+    double startBufferDuration() const { return data.startBufferDuration; }
+    int rebufferCount() const { return data.rebufferCount; }
+    int keyframeIndexSize() const { return (int)data.keyframeIndexSize; }
+    double liveLatency() const { return data.liveLatency; }
+    double liveLatencyTarget() const { return data.liveLatencyTarget; }
+    double catchUpRate() const { return data.catchUpRate; }
+    qint64 catchUpSpeedUps() const { return (qint64)data.catchUpSpeedUps; }
+    qint64 catchUpJumps() const { return (qint64)data.catchUpJumps; }
     int maxFrameQueueSize() const { return (int)data.maxFrameQueueSize; }
     int videoPacketQueueSize() const { return (int)data.videoPacketQueueSize; }
     int audioPacketQueueSize() const { return (int)data.audioPacketQueueSize; }
@@ -47,6 +77,20 @@ public:
     double audioFrameQueueDuration() const { return data.audioFrameQueueDuration; }
     double videoClock() const { return data.videoClock; }
     double audioClock() const { return data.audioClock; }
+    int videoDecoderThreads() const { return data.videoDecoderThreads; }
+    int videoDecoderThreadType() const { return data.videoDecoderThreadType; }
+    bool warmStart() const { return data.warmStart; }
+    bool streamInfoCached() const { return data.streamInfoCached; }
+    qint64 packetShellsAllocated() const { return data.packetShellsAllocated; }
+    qint64 itemSwitches() const { return (qint64)data.itemSwitches; }
+    double itemSwitchGap() const { return data.itemSwitchGap; }
+    QVariantMap videoFramePool() const;
+    QVariantMap audioFramePool() const;
+    QVariantMap readAhead() const;
+    QVariantMap timeshift() const;
+    QVariantMap recording() const;
+    QVariantMap audioOutput() const;
+    QVariantMap metrics() const;
 public:
     MiniPlayer::DumpInfo data;
 };
@@ -64,6 +108,32 @@ class QmlMiniPlayer : public QObject, public QQmlParserStatus, private MiniPlaye
     Q_PROPERTY(float volume READ volume WRITE setVolume)
     Q_PROPERTY(bool buffering READ buffering NOTIFY bufferingChanged)
     Q_PROPERTY(bool endReached READ endReached)
+    Q_PROPERTY(double startBufferDuration READ startBufferDuration WRITE setStartBufferDuration)
+    Q_PROPERTY(int maxPacketBufferSize READ maxPacketBufferSize WRITE setMaxPacketBufferSize)
+    Q_PROPERTY(bool accurateSeek READ accurateSeek WRITE setAccurateSeek)
+    Q_PROPERTY(int trickSpeed READ trickSpeed WRITE setTrickSpeed)
+    Q_PROPERTY(double playbackRate READ playbackRate WRITE setPlaybackRate)
+    Q_PROPERTY(double liveLatency READ liveLatency WRITE setLiveLatency)
+    Q_PROPERTY(bool metricsEnabled READ metricsEnabled WRITE setMetricsEnabled)
+    Q_PROPERTY(bool sharedExecutor READ sharedExecutor WRITE setSharedExecutor)
+    Q_PROPERTY(bool boosted READ boosted WRITE setBoosted)
+    Q_PROPERTY(bool prefetchEnabled READ prefetchEnabled WRITE setPrefetchEnabled)
+    Q_PROPERTY(bool fastOpen READ fastOpen WRITE setFastOpen)
+    Q_PROPERTY(int readAheadSize READ readAheadSize WRITE setReadAheadSize)
+    Q_PROPERTY(int readAheadConnections READ readAheadConnections WRITE setReadAheadConnections)
+    Q_PROPERTY(QString streamInfoCachePath READ streamInfoCachePath WRITE setStreamInfoCachePath)
+    Q_PROPERTY(QString timeshiftPath READ timeshiftPath WRITE setTimeshiftPath)
+    Q_PROPERTY(qint64 timeshiftBudget READ timeshiftBudget WRITE setTimeshiftBudget)
+    Q_PROPERTY(double timeshiftStart READ timeshiftStart)
+    Q_PROPERTY(bool recording READ recording)
+    Q_PROPERTY(QStringList playlist READ playlist WRITE setPlaylist)
+    Q_PROPERTY(bool playlistLoop READ playlistLoop WRITE setPlaylistLoop)
+    Q_PROPERTY(bool audioPullMode READ audioPullMode WRITE setAudioPullMode)
+    Q_PROPERTY(int standbyInputs READ standbyInputs WRITE setStandbyInputs)
+    Q_PROPERTY(int standbyBytes READ standbyBytes WRITE setStandbyBytes)
+    Q_PROPERTY(int standbyProbes READ standbyProbes WRITE setStandbyProbes)
+    Q_PROPERTY(int decoderThreads READ decoderThreads WRITE setDecoderThreads)
+    Q_PROPERTY(DecoderThreadType decoderThreadType READ decoderThreadType WRITE setDecoderThreadType)
 
 private:
     AudioOutputOpenAL mAudioOutput;
@@ -83,6 +153,14 @@ public:
     };
     Q_ENUMS(State)
 
+    enum DecoderThreadType
+    {
+        DecoderThreadAuto = MiniPlayer::DecoderThreadAuto,
+        DecoderThreadFrame = MiniPlayer::DecoderThreadFrame,
+        DecoderThreadSlice = MiniPlayer::DecoderThreadSlice
+    };
+    Q_ENUMS(DecoderThreadType)
+
     explicit QmlMiniPlayer(QQuickItem *parent = nullptr);
     virtual ~QmlMiniPlayer();
 
@@ -106,6 +184,56 @@ public:
     long downloadSpeed();
     bool endReached();
     int fps();
+    double startBufferDuration();
+    void setStartBufferDuration(double val);
+    int maxPacketBufferSize();
+    void setMaxPacketBufferSize(int val);
+    bool accurateSeek();
+    void setAccurateSeek(bool val);
+    int trickSpeed();
+    void setTrickSpeed(int val);
+    double playbackRate();
+    void setPlaybackRate(double val);
+    double liveLatency();
+    void setLiveLatency(double val);
+    bool metricsEnabled();
+    void setMetricsEnabled(bool val);
+    bool sharedExecutor();
+    void setSharedExecutor(bool val);
+    bool boosted();
+    void setBoosted(bool val);
+    bool fastOpen();
+    void setFastOpen(bool val);
+    int readAheadSize();
+    void setReadAheadSize(int val);
+    int readAheadConnections();
+    void setReadAheadConnections(int val);
+    QString streamInfoCachePath();
+    void setStreamInfoCachePath(const QString & val);
+    QString timeshiftPath();
+    void setTimeshiftPath(const QString & val);
+    qint64 timeshiftBudget();
+    void setTimeshiftBudget(qint64 val);
+    double timeshiftStart();
+    bool recording();
+    QStringList playlist();
+    void setPlaylist(const QStringList & val);
+    bool playlistLoop();
+    void setPlaylistLoop(bool val);
+    bool audioPullMode();
+    void setAudioPullMode(bool val);
+    bool prefetchEnabled();
+    void setPrefetchEnabled(bool val);
+    int standbyInputs();
+    void setStandbyInputs(int val);
+    int standbyBytes();
+    void setStandbyBytes(int val);
+    int standbyProbes();
+    void setStandbyProbes(int val);
+    int decoderThreads();
+    void setDecoderThreads(int val);
+    DecoderThreadType decoderThreadType();
+    void setDecoderThreadType(DecoderThreadType val);
 
 private: //MiniPlayer::Callback
     void onVideoRender(AVFrame * frame);
@@ -116,6 +244,8 @@ private: //MiniPlayer::Callback
 public slots:
     void dump(QmlDumpInfo * info);
     void open(const QString & mediaPath);
+    void prefetch(const QStringList & mediaPaths);
+    void scrub(double pos);
     void stop();
     void play();
     void pause();
@@ -124,6 +254,10 @@ public slots:
     void unMute();
     bool getMute();
     void toggleMute();
+    void resetMetrics();
+    bool dumpMetrics(const QString & path);
+    void startRecording(const QString & path);
+    void stopRecording();
 
 private slots:
     void videoFrameUpdated();